@@ -3,131 +3,521 @@
 #include <grpc++/grpc++.h>
 #include "behavior_recognition.grpc.pb.h"
 #include "behavior_recognition.pb.h"
+#include "grpc_client_base.h"
+#include "mpsc_queue.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
-struct BehaviorRecognitionClient::Impl {
-    std::mutex stubMutex;
-    behaviorRecognition::Communicate::Stub* stub = nullptr;
-    int64_t taskId = 0;
-    std::atomic<bool> shouldStop{false};
+template <>
+struct ServiceTraits<behaviorRecognition::Communicate> {
+    static constexpr const char* NAME = "behavior_recognition";
+    static constexpr bool ACCEPT_COMPRESSION = true;
 };
 
+namespace {
+
+using Stub = behaviorRecognition::Communicate::Stub;
+
+struct InformImageId: RpcMethod<Stub, behaviorRecognition::InformImageIdRequest, behaviorRecognition::InformImageIdResponse, &Stub::informImageId, &Stub::PrepareAsyncinformImageId> {
+    static constexpr const char* NAME = "informImageId";
+    static constexpr bool IDEMPOTENT = false;
+};
+
+struct GetResultByImageId: RpcMethod<Stub, behaviorRecognition::GetResultByImageIdRequest, behaviorRecognition::GetResultByImageIdResponse, &Stub::getResultByImageId, &Stub::PrepareAsyncgetResultByImageId> {
+    static constexpr const char* NAME = "getResultByImageId";
+};
+
+struct GetLatestResult: RpcMethod<Stub, behaviorRecognition::GetLatestResultRequest, behaviorRecognition::GetLatestResultResponse, &Stub::getLatestResult, &Stub::PrepareAsyncgetLatestResult> {
+    static constexpr const char* NAME = "getLatestResult";
+};
+
+} // namespace
+
+struct BehaviorRecognitionClient::Impl: GrpcClientBase<behaviorRecognition::Communicate> {
+    std::atomic<int64_t> taskId{0};     // setTaskId 与后台线程并发读写
+
+    // 非阻塞通知：调用方只入队，后台线程按批发出 informImageId
+    std::mutex notifierLifecycleMutex;     // 保护 startNotifier/stopNotifier
+    std::mutex notifierMutex;
+    std::condition_variable notifierCv;
+    std::thread notifier;
+    std::atomic<bool> notifying{false};
+    NotifyOptions notifyOptions;
+    // 每次 startNotifier 新建，带上本次的批大小，入队方不读取可能正被改写的 notifyOptions
+    struct NotifyQueue {
+        NotifyQueue(size_t capacity, size_t maxBatchSize): items(capacity), maxBatchSize(maxBatchSize) {}
+        MpscQueue<int64_t> items;
+        const size_t maxBatchSize;
+        // 入队方先登记再检查 open，stopNotifier 关闭后等登记清零，此后队列不再增加，最后一次取出能取完
+        std::atomic<bool> open{true};
+        std::atomic<int> producers{0};
+    };
+    std::shared_ptr<NotifyQueue> notifyQueue;
+    std::atomic<uint64_t> notifyEnqueued{0};
+    std::atomic<uint64_t> notifyDropped{0};
+    std::atomic<uint64_t> notifyCoalesced{0};
+    std::atomic<uint64_t> notifyAcknowledged{0};
+    std::atomic<uint64_t> notifyFailed{0};
+    std::atomic<uint64_t> notifyBatches{0};
+
+    void runNotifier();
+    void sendNotifyBatch(std::vector<int64_t>& batch);
+    void stopNotifier();
+
+    // 订阅：后台线程轮询 getLatestResult，结果变化时发布新快照
+    std::mutex subscriptionLifecycleMutex;  // 保护 subscribeLatestResult/unsubscribeLatestResult
+    std::mutex subscriptionMutex;
+    std::condition_variable subscriptionCv;
+    std::thread subscriber;
+    std::atomic<bool> subscribed{false};
+    SubscribeOptions subscribeOptions;
+    LatestResultCallback latestResultCallback;
+    // 双缓冲发布最新快照：读者在当前槽登记后确认下标未变再复制，只用原子计数，不经 atomic_load 的全局锁池
+    // 写者只写非当前的槽，写前等该槽的读者离开
+    struct LatestSlot {
+        std::shared_ptr<const LatestResult> snapshot{std::make_shared<const LatestResult>()};
+        std::atomic<uint32_t> readers{0};
+    };
+    std::mutex latestPublishMutex;          // 写者通常只有订阅线程，重新订阅时的重置也经过这里
+    LatestSlot latestSlots[2];
+    std::atomic<int> latestIndex{0};
+
+    std::shared_ptr<const LatestResult> loadLatest();
+    std::shared_ptr<const LatestResult> publishLatest(std::shared_ptr<const LatestResult> snapshot);
+    bool fetchLatestResult(std::vector<BehaviorRecognitionClient::Result>& results);
+    void runSubscriber();
+    void unsubscribe();
+
+    // 复用 results 中已有元素的容量，输出只包含本次结果
+    template <typename ResultsProto>
+    static void parseResults(const ResultsProto& resultsProto, std::vector<BehaviorRecognitionClient::Result>& results) {
+        int resultsCnt = resultsProto.size();
+        results.resize(resultsCnt);
+        for (int i = 0; i < resultsCnt; ++i) {
+            const auto& result_proto = resultsProto[i];
+            Result& result = results[i];
+            const auto& labelInfos = result_proto.labelinfos();
+            int labelInfosCnt = labelInfos.size();
+            result.labelConfidencePairs.resize(labelInfosCnt);
+            for (int j = 0; j < labelInfosCnt; ++j) {
+                result.labelConfidencePairs[j].first = labelInfos[j].label();
+                result.labelConfidencePairs[j].second = labelInfos[j].confidence();
+            }
+            result.personId = result_proto.personid();
+            result.x1 = result_proto.x1();
+            result.y1 = result_proto.y1();
+            result.x2 = result_proto.x2();
+            result.y2 = result_proto.y2();
+        }
+    }
+
+    static bool sameResults(const std::vector<BehaviorRecognitionClient::Result>& a, const std::vector<BehaviorRecognitionClient::Result>& b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (a[i].personId != b[i].personId || a[i].x1 != b[i].x1 || a[i].y1 != b[i].y1 ||
+                a[i].x2 != b[i].x2 || a[i].y2 != b[i].y2 || a[i].labelConfidencePairs != b[i].labelConfidencePairs) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+void BehaviorRecognitionClient::Impl::runNotifier() {
+    std::shared_ptr<NotifyQueue> queue = std::atomic_load(&notifyQueue);
+    std::vector<int64_t> batch;
+    batch.reserve(queue->maxBatchSize);
+    std::chrono::milliseconds interval(std::max(1, notifyOptions.flushIntervalMs));
+    while (true) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(notifierMutex);
+            notifierCv.wait_for(lock, interval, [this, &queue]() {
+                return !notifying.load() || queue->items.size() >= queue->maxBatchSize;
+            });
+            stopping = !notifying.load();
+        }
+        // 停止时把队列中剩余的通知全部发出
+        int64_t imageId = 0;
+        while (queue->items.pop(imageId)) {
+            batch.push_back(imageId);
+            if (batch.size() >= queue->maxBatchSize) {
+                sendNotifyBatch(batch);
+            }
+        }
+        if (!batch.empty()) {
+            sendNotifyBatch(batch);
+        }
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void BehaviorRecognitionClient::Impl::sendNotifyBatch(std::vector<int64_t>& batch) {
+    ++notifyBatches;
+    if (notifyOptions.latestOnly && batch.size() > 1) {
+        // 服务端只需知道最新一帧时合并为一次通知
+        notifyCoalesced += batch.size() - 1;
+        batch.front() = *std::max_element(batch.begin(), batch.end());
+        batch.resize(1);
+    }
+    StubHolder<behaviorRecognition::Communicate::Stub>::Lease stub = leaseFor<InformImageId>();
+    if (nullptr == stub) {
+        notifyFailed += batch.size();
+        batch.clear();
+        return;
+    }
+    // 服务端没有批量接口，一批通知以异步请求同时发出，等待整批完成再发下一批
+    struct Pending {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t remaining = 0;
+    };
+    std::shared_ptr<Pending> pending = std::make_shared<Pending>();
+    pending->remaining = batch.size();
+    static const int metric = Impl::metric("notifyImageId");
+    int64_t taskId = this->taskId.load();
+    for (int64_t imageId : batch) {
+        behaviorRecognition::InformImageIdRequest request;
+        request.set_taskid(taskId);
+        request.set_imageid(imageId);
+        startCall<InformImageId>(metric, stub, request,
+            [](const behaviorRecognition::InformImageIdResponse&) {
+                return true;
+            },
+            [this, pending](bool ok) {
+                if (ok) {
+                    ++notifyAcknowledged;
+                } else {
+                    ++notifyFailed;
+                }
+                std::lock_guard<std::mutex> lock(pending->mutex);
+                if (0 == --pending->remaining) {
+                    pending->cv.notify_all();
+                }
+            });
+    }
+    std::unique_lock<std::mutex> lock(pending->mutex);
+    pending->cv.wait(lock, [&pending]() { return 0 == pending->remaining; });
+    batch.clear();
+}
+
+void BehaviorRecognitionClient::Impl::stopNotifier() {
+    std::lock_guard<std::mutex> lifecycleLock(notifierLifecycleMutex);
+    if (!notifier.joinable()) {
+        return;
+    }
+    std::shared_ptr<NotifyQueue> queue = std::atomic_load(&notifyQueue);
+    queue->open.store(false);
+    // 正在入队的调用方只做一次 push，很快离开
+    while (0 != queue->producers.load()) {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock(notifierMutex);
+        notifying.store(false);
+    }
+    notifierCv.notify_all();
+    notifier.join();
+}
+
+bool BehaviorRecognitionClient::Impl::fetchLatestResult(std::vector<BehaviorRecognitionClient::Result>& results) {
+    static const int metric = Impl::metric("getLatestResult");
+    int64_t taskId = this->taskId.load();
+    return call<GetLatestResult>(metric,
+        [taskId](behaviorRecognition::GetLatestResultRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [&results](const behaviorRecognition::GetLatestResultResponse& response) {
+            parseResults(response.results(), results);
+            return true;
+        });
+}
+
+std::shared_ptr<const BehaviorRecognitionClient::LatestResult> BehaviorRecognitionClient::Impl::loadLatest() {
+    // 只有写者恰好切换了下标时才重试，发布间隔远大于一次复制，实际至多重试一次
+    for (;;) {
+        int index = latestIndex.load();
+        LatestSlot& slot = latestSlots[index];
+        slot.readers.fetch_add(1);
+        if (latestIndex.load() == index) {
+            std::shared_ptr<const LatestResult> snapshot = slot.snapshot;
+            slot.readers.fetch_sub(1);
+            return snapshot;
+        }
+        slot.readers.fetch_sub(1);
+    }
+}
+
+// 返回被替换下来的旧快照
+std::shared_ptr<const BehaviorRecognitionClient::LatestResult> BehaviorRecognitionClient::Impl::publishLatest(std::shared_ptr<const LatestResult> snapshot) {
+    std::lock_guard<std::mutex> lock(latestPublishMutex);
+    int next = 1 - latestIndex.load();
+    LatestSlot& slot = latestSlots[next];
+    // 读者只在复制 shared_ptr 期间持有计数
+    while (0 != slot.readers.load()) {
+        std::this_thread::yield();
+    }
+    std::shared_ptr<const LatestResult> replaced = std::move(slot.snapshot);
+    slot.snapshot = std::move(snapshot);
+    latestIndex.store(next);
+    return replaced;
+}
+
+void BehaviorRecognitionClient::Impl::runSubscriber() {
+    std::chrono::milliseconds interval(std::max(1, subscribeOptions.pollIntervalMs));
+    // 在 spare 中解析后发布；被替换下来的快照没有读者持有时回收为下一次的 spare，稳态下不分配
+    std::shared_ptr<LatestResult> spare = std::make_shared<LatestResult>();
+    while (subscribed.load()) {
+        // 查询失败时不解析，spare 中仍是上次发布的结果
+        bool ok = fetchLatestResult(spare->results);
+        std::shared_ptr<const LatestResult> current = loadLatest();
+        bool changed = ok && (0 == current->version || !sameResults(current->results, spare->results));
+        spare->version = changed ? current->version + 1 : current->version;
+        spare->lastSuccess = ok ? std::chrono::steady_clock::now() : current->lastSuccess;
+        spare->errors = ok ? current->errors : current->errors + 1;
+        current.reset();
+        std::shared_ptr<const LatestResult> published = spare;
+        std::shared_ptr<const LatestResult> replaced = publishLatest(published);
+        if (changed && latestResultCallback) {
+            latestResultCallback(published);
+        }
+        if (replaced && 1 == replaced.use_count()) {
+            spare = std::const_pointer_cast<LatestResult>(replaced);
+        } else {
+            spare = std::make_shared<LatestResult>();
+        }
+        // 先按已发布的结果填充，下一次解析可复用字符串容量
+        spare->results = published->results;
+        std::unique_lock<std::mutex> lock(subscriptionMutex);
+        subscriptionCv.wait_for(lock, interval, [this]() { return !subscribed.load(); });
+    }
+}
+
+void BehaviorRecognitionClient::Impl::unsubscribe() {
+    std::lock_guard<std::mutex> lifecycleLock(subscriptionLifecycleMutex);
+    if (!subscriber.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        subscribed.store(false);
+    }
+    subscriptionCv.notify_all();
+    subscriber.join();
+}
+
 BehaviorRecognitionClient::BehaviorRecognitionClient(): pImpl(new Impl()) {
 
 }
 
 BehaviorRecognitionClient::~BehaviorRecognitionClient() {
     pImpl->shouldStop.store(true);
-    std::lock_guard<std::mutex> lock(pImpl->stubMutex);
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
-    }
+    pImpl->unsubscribe();
+    // 通知线程退出前发出队列中剩余的通知，之后才取消在途请求
+    pImpl->stopNotifier();
+    pImpl->stop();
 }
 
 bool BehaviorRecognitionClient::setAddress(std::string ip, int port) {
-    if (pImpl->shouldStop.load()) return false;
-    // TODO 重置时未考虑线程安全
-    std::shared_ptr<grpc::ChannelInterface> channel = grpc::CreateChannel(ip + ":" + std::to_string(port), grpc::InsecureChannelCredentials());
-    std::unique_ptr<behaviorRecognition::Communicate::Stub> stubTmp = behaviorRecognition::Communicate::NewStub(channel);
-    // 重置
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
-    }
-    // unique_ptr 转为 普通指针
-    pImpl->stub = stubTmp.get();
-    stubTmp.release();
-    return true;
+    return pImpl->connect(ip, port);
+}
+
+bool BehaviorRecognitionClient::setAddresses(std::vector<std::string> addresses, int channelsPerAddress, bool leastOutstanding) {
+    return pImpl->connect(addresses, channelsPerAddress, leastOutstanding);
 }
 
 bool BehaviorRecognitionClient::setTaskId(int64_t taskId) {
     if (pImpl->shouldStop.load()) return false;
-    pImpl->taskId = taskId;
+    pImpl->taskId.store(taskId);
     return true;
 }
 
+bool BehaviorRecognitionClient::setCallPolicy(CallPolicy policy) {
+    return pImpl->setCallPolicy(std::move(policy));
+}
+
+bool BehaviorRecognitionClient::getPayloadCounters(std::vector<PayloadCounters>& counters) {
+    return pImpl->getPayloadCounters(counters);
+}
+
 bool BehaviorRecognitionClient::informImageId(int64_t imageId) {
     if (pImpl->shouldStop.load()) return false;
-    behaviorRecognition::InformImageIdRequest request;
-    request.set_taskid(pImpl->taskId);
-    request.set_imageid(imageId);
+    static const int metric = Impl::metric("informImageId");
+    int64_t taskId = pImpl->taskId.load();
+    return pImpl->call<InformImageId>(metric,
+        [taskId, imageId](behaviorRecognition::InformImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+        },
+        [](const behaviorRecognition::InformImageIdResponse&) {
+            return true;
+        });
+}
 
-    behaviorRecognition::InformImageIdResponse response;
-    grpc::ClientContext context;
+bool BehaviorRecognitionClient::getResultByImageId(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return false;
+    static const int metric = Impl::metric("getResultByImageId");
+    int64_t taskId = pImpl->taskId.load();
+    return pImpl->call<GetResultByImageId>(metric,
+        [taskId, imageId](behaviorRecognition::GetResultByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+        },
+        [&results](const behaviorRecognition::GetResultByImageIdResponse& response) {
+            Impl::parseResults(response.results(), results);
+            return true;
+        });
+}
 
-    grpc::Status status = pImpl->stub->informImageId(&context, request, &response);
+bool BehaviorRecognitionClient::getLatestResult(std::vector<BehaviorRecognitionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return false;
+    return pImpl->fetchLatestResult(results);
+}
 
-    if (status.ok() && response.response().code() == 200) {
-        return true;
-    } else {
-        std::cerr << "InformImageId failed with code: " << response.response().code()
-                  << ", message: " << response.response().message() << std::endl;
-        return false;
-    }
+std::future<bool> BehaviorRecognitionClient::informImageIdAsync(int64_t imageId) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    return completionFuture([&](BehaviorRecognitionClient::CompletionCallback callback) {
+        informImageIdAsync(imageId, std::move(callback));
+    });
 }
 
-bool BehaviorRecognitionClient::getResultByImageId(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results) {
-    if (pImpl->shouldStop.load()) return false;
-    behaviorRecognition::GetResultByImageIdRequest request;
-    request.set_taskid(pImpl->taskId);
-    request.set_imageid(imageId);
+void BehaviorRecognitionClient::informImageIdAsync(int64_t imageId, BehaviorRecognitionClient::CompletionCallback callback) {
+    static const int metric = Impl::metric("informImageIdAsync");
+    int64_t taskId = pImpl->taskId.load();
+    pImpl->callAsync<InformImageId>(metric,
+        [taskId, imageId](behaviorRecognition::InformImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+        },
+        [](const behaviorRecognition::InformImageIdResponse&) {
+            return true;
+        },
+        std::move(callback));
+}
 
-    behaviorRecognition::GetResultByImageIdResponse response;
-    grpc::ClientContext context;
+std::future<bool> BehaviorRecognitionClient::getResultByImageIdAsync(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    return completionFuture([&](BehaviorRecognitionClient::CompletionCallback callback) {
+        getResultByImageIdAsync(imageId, results, std::move(callback));
+    });
+}
 
-    grpc::Status status = pImpl->stub->getResultByImageId(&context, request, &response);
+void BehaviorRecognitionClient::getResultByImageIdAsync(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results, BehaviorRecognitionClient::CompletionCallback callback) {
+    static const int metric = Impl::metric("getResultByImageIdAsync");
+    int64_t taskId = pImpl->taskId.load();
+    std::vector<BehaviorRecognitionClient::Result>* output = &results;
+    pImpl->callAsync<GetResultByImageId>(metric,
+        [taskId, imageId](behaviorRecognition::GetResultByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+        },
+        [output](const behaviorRecognition::GetResultByImageIdResponse& response) {
+            Impl::parseResults(response.results(), *output);
+            return true;
+        },
+        std::move(callback));
+}
 
-    if (status.ok() && response.response().code() == 200) {
-        // 正确处理结果的代码...
-        for (const auto& result_proto : response.results()) {
-            Result result;
-            for (const auto& label_info : result_proto.labelinfos()) {
-                result.labelConfidencePairs.emplace_back(label_info.label(), label_info.confidence());
-            }
-            result.personId = result_proto.personid();
-            result.x1 = result_proto.x1();
-            result.y1 = result_proto.y1();
-            result.x2 = result_proto.x2();
-            result.y2 = result_proto.y2();
-            results.push_back(result);
-        }
-        return true;
-    } else {
-        std::cerr << "GetResultByImageId failed with code: " << response.response().code()
-                  << ", message: " << response.response().message() << std::endl;
+std::future<bool> BehaviorRecognitionClient::getLatestResultAsync(std::vector<BehaviorRecognitionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    static const int metric = Impl::metric("getLatestResultAsync");
+    int64_t taskId = pImpl->taskId.load();
+    std::vector<BehaviorRecognitionClient::Result>* output = &results;
+    return pImpl->callAsync<GetLatestResult>(metric,
+        [taskId](behaviorRecognition::GetLatestResultRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [output](const behaviorRecognition::GetLatestResultResponse& response) {
+            Impl::parseResults(response.results(), *output);
+            return true;
+        });
+}
+
+bool BehaviorRecognitionClient::startNotifier(BehaviorRecognitionClient::NotifyOptions options) {
+    if (pImpl->shouldStop.load()) return false;
+    if (0 == options.maxBatchSize || 0 == options.queueCapacity) {
         return false;
     }
+    pImpl->stopNotifier();
+    std::lock_guard<std::mutex> lifecycleLock(pImpl->notifierLifecycleMutex);
+    pImpl->notifyOptions = options;
+    // 旧队列由仍在入队的调用方持有到返回
+    std::atomic_store(&pImpl->notifyQueue, std::make_shared<Impl::NotifyQueue>(options.queueCapacity, options.maxBatchSize));
+    pImpl->notifying.store(true);
+    pImpl->notifier = std::thread(&Impl::runNotifier, pImpl.get());
+    return true;
 }
 
-bool BehaviorRecognitionClient::getLatestResult(std::vector<BehaviorRecognitionClient::Result>& results) {
+bool BehaviorRecognitionClient::notifyImageId(int64_t imageId) {
     if (pImpl->shouldStop.load()) return false;
-    behaviorRecognition::GetLatestResultRequest request;
-    request.set_taskid(pImpl->taskId);
+    if (!pImpl->notifying.load()) {
+        return false;
+    }
+    std::shared_ptr<Impl::NotifyQueue> queue = std::atomic_load(&pImpl->notifyQueue);
+    // 队列已关闭时不入队，入队成功的通知都由后台线程发出
+    queue->producers.fetch_add(1);
+    if (!queue->open.load()) {
+        queue->producers.fetch_sub(1);
+        return false;
+    }
+    bool pushed = queue->items.push(imageId);
+    if (pushed) {
+        ++pImpl->notifyEnqueued;
+    } else {
+        ++pImpl->notifyDropped;
+    }
+    queue->producers.fetch_sub(1);
+    if (!pushed) {
+        return false;
+    }
+    // 攒满一批时提前唤醒，否则等到下一个发送间隔
+    if (queue->items.size() >= queue->maxBatchSize) {
+        pImpl->notifierCv.notify_one();
+    }
+    return true;
+}
 
-    behaviorRecognition::GetLatestResultResponse response;
-    grpc::ClientContext context;
+void BehaviorRecognitionClient::stopNotifier() {
+    pImpl->stopNotifier();
+}
 
-    grpc::Status status = pImpl->stub->getLatestResult(&context, request, &response);
+BehaviorRecognitionClient::NotifyStats BehaviorRecognitionClient::getNotifyStats() {
+    NotifyStats stats;
+    stats.enqueued = pImpl->notifyEnqueued.load();
+    stats.dropped = pImpl->notifyDropped.load();
+    stats.coalesced = pImpl->notifyCoalesced.load();
+    stats.acknowledged = pImpl->notifyAcknowledged.load();
+    stats.failed = pImpl->notifyFailed.load();
+    stats.batches = pImpl->notifyBatches.load();
+    return stats;
+}
 
-    if (status.ok() && response.response().code() == 200) {
-        // 正确处理结果的代码...
-        for (const auto& result_proto : response.results()) {
-            Result result;
-            for (const auto& label_info : result_proto.labelinfos()) {
-                result.labelConfidencePairs.emplace_back(label_info.label(), label_info.confidence());
-            }
-            result.personId = result_proto.personid();
-            result.x1 = result_proto.x1();
-            result.y1 = result_proto.y1();
-            result.x2 = result_proto.x2();
-            result.y2 = result_proto.y2();
-            results.push_back(result);
-        }
-        return true;
-    } else {
-        std::cerr << "GetLatestResult failed with code: " << response.response().code()
-                  << ", message: " << response.response().message() << std::endl;
+bool BehaviorRecognitionClient::subscribeLatestResult(BehaviorRecognitionClient::SubscribeOptions options, BehaviorRecognitionClient::LatestResultCallback callback) {
+    if (pImpl->shouldStop.load()) return false;
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
+    pImpl->unsubscribe();
+    std::lock_guard<std::mutex> lifecycleLock(pImpl->subscriptionLifecycleMutex);
+    pImpl->subscribeOptions = options;
+    pImpl->latestResultCallback = callback;
+    pImpl->publishLatest(std::make_shared<const LatestResult>());
+    pImpl->subscribed.store(true);
+    pImpl->subscriber = std::thread(&Impl::runSubscriber, pImpl.get());
+    return true;
+}
+
+void BehaviorRecognitionClient::unsubscribeLatestResult() {
+    pImpl->unsubscribe();
+}
+
+std::shared_ptr<const BehaviorRecognitionClient::LatestResult> BehaviorRecognitionClient::getLatestSnapshot() {
+    return pImpl->loadLatest();
 }
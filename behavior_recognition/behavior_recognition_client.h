@@ -15,7 +15,11 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
 #include <memory>
+#include <future>
+#include <functional>
+#include "call_policy.h"
 
 class BehaviorRecognitionClient {
 public:
@@ -29,12 +33,69 @@ public:
         double x2;
         double y2;
     };
+    struct NotifyOptions {
+        size_t queueCapacity = 1024;    // 队列满时新的通知被丢弃
+        int flushIntervalMs = 5;        // 未攒满一批时的发送间隔
+        size_t maxBatchSize = 32;       // 每批最多同时发出的请求数
+        bool latestOnly = false;        // 每批只通知其中最新的 imageId
+    };
+    struct NotifyStats {
+        uint64_t enqueued = 0;
+        uint64_t dropped = 0;           // 队列满
+        uint64_t coalesced = 0;         // latestOnly 合并掉的通知
+        uint64_t acknowledged = 0;      // 服务端返回 200
+        uint64_t failed = 0;
+        uint64_t batches = 0;
+    };
+    struct SubscribeOptions {
+        int pollIntervalMs = 20;        // 后台查询最新结果的间隔
+    };
+    struct LatestResult {
+        uint64_t version = 0;           // 结果变化时递增，0 表示尚未取到结果
+        std::vector<BehaviorRecognitionClient::Result> results;
+        std::chrono::steady_clock::time_point lastSuccess;  // 最近一次查询成功的时刻，据此判断结果是否过期
+        uint64_t errors = 0;            // 本次订阅以来查询失败的次数
+    };
+    using LatestResultCallback = std::function<void(std::shared_ptr<const BehaviorRecognitionClient::LatestResult>)>;
+    // 异步请求完成时在轮询线程中调用，未能发起时在调用线程中同步调用
+    using CompletionCallback = std::function<void(bool)>;
 
     bool setAddress(std::string ip, int port);
+    // 地址形如 ip:port，请求在全部地址的全部连接间按轮询或最少在途请求分摊
+    // 连接在同一进程的客户端实例间共享
+    bool setAddresses(std::vector<std::string> addresses, int channelsPerAddress = 1, bool leastOutstanding = false);
     bool setTaskId(int64_t taskId);
+    // 各方法的超时、重试与对冲策略，方法名为 informImageId、getResultByImageId、getLatestResult
+    // 异步版本与后台通知沿用同名方法的超时，默认不限时、不重试；informImageId 不对冲
+    // compression 让该方法声明接受压缩的响应，是否压缩由服务端决定
+    bool setCallPolicy(CallPolicy policy);
+    // 各方法成功响应的次数与序列化字节数；compressedCalls 为按策略走接受压缩的连接完成的次数
+    bool getPayloadCounters(std::vector<PayloadCounters>& counters);
     bool informImageId(int64_t imageId);
     bool getResultByImageId(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results);
     bool getLatestResult(std::vector<BehaviorRecognitionClient::Result>& results);
+
+    // 异步版本，由共享的 CompletionQueue 驱动，results 须在 future 就绪前保持有效
+    std::future<bool> informImageIdAsync(int64_t imageId);
+    std::future<bool> getResultByImageIdAsync(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results);
+    std::future<bool> getLatestResultAsync(std::vector<BehaviorRecognitionClient::Result>& results);
+    // 回调版本，results 须在回调前保持有效
+    void informImageIdAsync(int64_t imageId, BehaviorRecognitionClient::CompletionCallback callback);
+    void getResultByImageIdAsync(int64_t imageId, std::vector<BehaviorRecognitionClient::Result>& results, BehaviorRecognitionClient::CompletionCallback callback);
+
+    // 非阻塞的 informImageId：notifyImageId 只入队，由后台线程按批发出
+    // stopNotifier 会先发出队列中剩余的通知
+    bool startNotifier(BehaviorRecognitionClient::NotifyOptions options);
+    bool notifyImageId(int64_t imageId);
+    void stopNotifier();
+    BehaviorRecognitionClient::NotifyStats getNotifyStats();
+
+    // 订阅最新结果：由后台线程查询，结果变化时发布新快照并回调（回调在后台线程中执行）
+    // 每次查询后都发布快照以更新 lastSuccess 和 errors，只在 version 变化时回调
+    // getLatestSnapshot 只读取已发布的快照，不发请求、不加锁，快照发布后不再修改
+    bool subscribeLatestResult(BehaviorRecognitionClient::SubscribeOptions options, BehaviorRecognitionClient::LatestResultCallback callback = nullptr);
+    void unsubscribeLatestResult();
+    std::shared_ptr<const BehaviorRecognitionClient::LatestResult> getLatestSnapshot();
 private:
     struct Impl;
     std::unique_ptr<Impl> pImpl;
@@ -0,0 +1,695 @@
+#include "mock_services.h"
+#include "image_harmony_client.h"
+#include "target_detection_client.h"
+#include "target_tracking_client.h"
+#include "behavior_recognition_client.h"
+#include "frame_pipeline.h"
+#include "rpc_metrics.h"
+#include "rpc_log.h"
+#include "thread_arena.h"
+#include "behavior_recognition.grpc.pb.h"
+#include <grpc++/grpc++.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// 只统计调用线程上的分配次数，服务端和客户端后台线程的分配不计入
+static thread_local uint64_t threadAllocations = 0;
+
+void* operator new(size_t size) {
+    ++threadAllocations;
+    void* p = std::malloc(size ? size : 1);
+    if (nullptr == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+struct Config {
+    int maxThreads = 8;
+    int calls = 2000;               // 每个线程的调用次数，另有 10% 预热
+    int batchSize = 64;
+    std::string filter;
+    bool csv = false;
+    bool metrics = false;
+    bool checkAllocations = false;  // 稳态分配超出预算时以非零值退出
+    std::string target;             // ip:port，非空时不启动模拟服务，如对着回放服务端测量
+    std::string recordPath;         // 非空时录制全部请求
+    int streamSeconds = 3;          // 按帧率出帧的场景每种方式运行的时长
+    // 检测、跟踪、行为识别客户端的默认压缩策略，服务端以 --compress 开启压缩时生效
+    CompressionAlgorithm acceptCompression = CompressionAlgorithm::NONE;
+    int compressAboveBytes = 0;
+    MockServices::Options mock;
+
+    Config() {
+        mock.frameRate = 30;
+    }
+};
+
+struct RunResult {
+    uint64_t calls = 0;
+    uint64_t failures = 0;
+    double seconds = 0;
+    double p50Us = 0;
+    double p99Us = 0;
+    double p999Us = 0;
+    double allocationsPerCall = -1;  // 小于 0 表示未统计
+    double wireBytesPerCall = -1;    // 服务端发往客户端的字节数，小于 0 表示未统计
+};
+
+// 参数为线程序号和调用序号，返回调用是否成功
+using Call = std::function<bool(int, int)>;
+
+// 每次调用允许的稳态分配：每个 RPC 有 gRPC 自身的下限，客户端另可分配 perRpc 次
+// rpcs 为 0 的场景不检查，如取图时解码器和 protobuf 的字节缓冲必然分配
+// 只统计调用线程，工作落在轮询线程上的异步场景用 unchecked 说明不检查的原因
+struct AllocationBudget {
+    int rpcs = 0;
+    double perRpc = 0;
+    const char* unchecked = nullptr;
+};
+
+// 裸 stub 一次一元调用在调用线程上的分配次数，小于 0 表示未测得
+double grpcAllocationFloor = -1;
+// 统计传输字节数的模拟服务，为空时不统计
+const MockServices* wireCounter = nullptr;
+std::vector<std::string> allocationViolations;
+
+double percentile(const std::vector<double>& sorted, double quantile) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(quantile * static_cast<double>(sorted.size() - 1));
+    return sorted[index];
+}
+
+RunResult summarize(std::vector<double>& latencies, uint64_t failures, double seconds) {
+    RunResult result;
+    std::sort(latencies.begin(), latencies.end());
+    result.calls = latencies.size();
+    result.failures = failures;
+    result.seconds = seconds;
+    result.p50Us = percentile(latencies, 0.5);
+    result.p99Us = percentile(latencies, 0.99);
+    result.p999Us = percentile(latencies, 0.999);
+    return result;
+}
+
+RunResult runThreads(int threads, int calls, const Call& call) {
+    std::vector<std::vector<double>> latencies(threads);
+    std::vector<uint64_t> failures(threads, 0);
+    std::vector<uint64_t> allocations(threads, 0);
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    int warmup = std::max(1, calls / 10);
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            for (int i = 0; i < warmup; ++i) {
+                call(t, -1 - i);
+            }
+            latencies[t].reserve(calls);
+            ++ready;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            uint64_t allocationsBefore = threadAllocations;
+            for (int i = 0; i < calls; ++i) {
+                std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                bool ok = call(t, i);
+                double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+                latencies[t].push_back(us);
+                if (!ok) {
+                    ++failures[t];
+                }
+            }
+            allocations[t] = threadAllocations - allocationsBefore;
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    uint64_t wireBytesBefore = nullptr == wireCounter ? 0 : wireCounter->wireBytes();
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    go.store(true);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::vector<double> merged;
+    uint64_t failed = 0;
+    uint64_t allocated = 0;
+    for (int t = 0; t < threads; ++t) {
+        merged.insert(merged.end(), latencies[t].begin(), latencies[t].end());
+        failed += failures[t];
+        allocated += allocations[t];
+    }
+    RunResult result = summarize(merged, failed, seconds);
+    result.allocationsPerCall = result.calls ? static_cast<double>(allocated) / result.calls : 0;
+    if (nullptr != wireCounter && result.calls > 0) {
+        result.wireBytesPerCall = static_cast<double>(wireCounter->wireBytes() - wireBytesBefore) / result.calls;
+    }
+    return result;
+}
+
+void printHeader(const Config& config) {
+    if (config.csv) {
+        std::printf("scenario,threads,calls,failures,calls_per_sec,p50_us,p99_us,p999_us,allocs_per_call%s\n",
+                    config.mock.countWireBytes ? ",wire_bytes_per_call" : "");
+    } else {
+        std::printf("%-44s %7s %8s %6s %12s %10s %10s %10s %8s%s\n",
+                    "scenario", "threads", "calls", "fail", "calls/s", "p50(us)", "p99(us)", "p999(us)", "allocs",
+                    config.mock.countWireBytes ? "   wire B/call" : "");
+    }
+}
+
+void printResult(const Config& config, const std::string& scenario, int threads, const RunResult& result) {
+    double throughput = result.seconds > 0 ? result.calls / result.seconds : 0;
+    if (config.csv) {
+        std::printf("%s,%d,%llu,%llu,%.1f,%.1f,%.1f,%.1f,%.2f", scenario.c_str(), threads,
+                    static_cast<unsigned long long>(result.calls), static_cast<unsigned long long>(result.failures),
+                    throughput, result.p50Us, result.p99Us, result.p999Us, result.allocationsPerCall);
+        if (config.mock.countWireBytes) {
+            std::printf(",%.1f", result.wireBytesPerCall);
+        }
+        std::printf("\n");
+    } else {
+        char allocations[32] = "-";
+        if (result.allocationsPerCall >= 0) {
+            std::snprintf(allocations, sizeof(allocations), "%.1f", result.allocationsPerCall);
+        }
+        std::printf("%-44s %7d %8llu %6llu %12.1f %10.1f %10.1f %10.1f %8s", scenario.c_str(), threads,
+                    static_cast<unsigned long long>(result.calls), static_cast<unsigned long long>(result.failures),
+                    throughput, result.p50Us, result.p99Us, result.p999Us, allocations);
+        if (config.mock.countWireBytes) {
+            char wireBytes[32] = "-";
+            if (result.wireBytesPerCall >= 0) {
+                std::snprintf(wireBytes, sizeof(wireBytes), "%.1f", result.wireBytesPerCall);
+            }
+            std::printf(" %14s", wireBytes);
+        }
+        std::printf("\n");
+    }
+    std::fflush(stdout);
+}
+
+std::vector<int> threadCounts(int maxThreads) {
+    std::vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(std::max(1, maxThreads));
+    return counts;
+}
+
+// 超出预算时输出到 stderr，不打断 csv 输出
+void checkAllocations(const std::string& scenario, int threads, const RunResult& result, AllocationBudget budget) {
+    if (nullptr != budget.unchecked || 0 == budget.rpcs || grpcAllocationFloor < 0 || result.allocationsPerCall < 0) {
+        return;
+    }
+    // 每个 RPC 容许 0.1 次的波动，gRPC 偶尔会在调用线程上扩容内部结构
+    double allowed = budget.rpcs * (grpcAllocationFloor + budget.perRpc + 0.1);
+    if (result.allocationsPerCall <= allowed) {
+        return;
+    }
+    char message[256];
+    std::snprintf(message, sizeof(message), "%s (%d threads): %.2f allocs/call, budget %.2f",
+                  scenario.c_str(), threads, result.allocationsPerCall, allowed);
+    std::fprintf(stderr, "WARNING steady-state allocations over budget: %s\n", message);
+    allocationViolations.push_back(message);
+}
+
+void runScenario(const Config& config, const std::string& scenario, const Call& call, AllocationBudget budget = AllocationBudget()) {
+    if (!config.filter.empty() && std::string::npos == scenario.find(config.filter)) {
+        return;
+    }
+    if (nullptr != budget.unchecked && grpcAllocationFloor >= 0) {
+        std::fprintf(stderr, "NOTE %s: allocations not checked, %s\n", scenario.c_str(), budget.unchecked);
+    }
+    for (int threads : threadCounts(config.maxThreads)) {
+        RunResult result = runThreads(threads, config.calls, call);
+        printResult(config, scenario, threads, result);
+        checkAllocations(scenario, threads, result, budget);
+    }
+}
+
+// 以裸 stub 和 Arena 上的消息测量一次同步调用中 gRPC 自身的分配次数，作为各场景预算的下限
+void measureAllocationFloor(const Config& config, const std::string& address) {
+    std::unique_ptr<behaviorRecognition::Communicate::Stub> stub =
+        behaviorRecognition::Communicate::NewStub(grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+    int calls = std::max(100, config.calls);
+    uint64_t allocationsBefore = 0;
+    for (int i = -calls / 10; i < calls; ++i) {
+        if (0 == i) {
+            allocationsBefore = threadAllocations;
+        }
+        ScopedArena arena;
+        behaviorRecognition::InformImageIdRequest& request = *arena.create<behaviorRecognition::InformImageIdRequest>();
+        behaviorRecognition::InformImageIdResponse& response = *arena.create<behaviorRecognition::InformImageIdResponse>();
+        request.set_taskid(1);
+        request.set_imageid(i + calls + 1);
+        grpc::ClientContext context;
+        if (!stub->informImageId(&context, request, &response).ok()) {
+            std::fprintf(stderr, "cannot measure the gRPC allocation floor, allocation budgets are not checked\n");
+            return;
+        }
+    }
+    grpcAllocationFloor = static_cast<double>(threadAllocations - allocationsBefore) / calls;
+    if (!config.csv) {
+        std::printf("gRPC allocation floor %.2f allocs per unary call on the calling thread\n", grpcAllocationFloor);
+    }
+}
+
+// 每个线程、每次调用使用不同的非零 imageId，预热调用为负序号
+int64_t imageIdOf(const Config& config, int thread, int i) {
+    return static_cast<int64_t>(thread) * (config.calls + 1) * 2 + i + config.calls + 1;
+}
+
+void runPipeline(const Config& config, ImageHarmonyClient& imageHarmonyClient, TargetDetectionClient& targetDetectionClient,
+                 TargetTrackingClient& targetTrackingClient, BehaviorRecognitionClient& behaviorRecognitionClient) {
+    const std::string scenario = "frame_pipeline.push";
+    if (!config.filter.empty() && std::string::npos == scenario.find(config.filter)) {
+        return;
+    }
+    // 流水线只有一个 push 线程，线程数对应每个阶段的在途请求数
+    for (int threads : threadCounts(config.maxThreads)) {
+        FramePipeline pipeline(&imageHarmonyClient, &targetDetectionClient, &targetTrackingClient, &behaviorRecognitionClient);
+        FramePipeline::Options options;
+        options.imageInfo.width = config.mock.imageWidth;
+        options.imageInfo.height = config.mock.imageHeight;
+        options.maxInFlightPerStage = threads;
+        options.maxInFlightFrames = threads * 4;
+        std::mutex mutex;
+        std::vector<double> latencies;
+        uint64_t failures = 0;
+        pipeline.start(options, [&](FramePipeline::FrameRecord& record) {
+            bool ok = std::all_of(std::begin(record.ok), std::end(record.ok), [](bool stageOk) { return stageOk; });
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.push_back(static_cast<double>(record.totalLatencyUs));
+            if (!ok) {
+                ++failures;
+            }
+        });
+        int frames = config.calls * threads;
+        latencies.reserve(frames);
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i) {
+            pipeline.push(i + 1);
+        }
+        pipeline.stop();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printResult(config, scenario, threads, summarize(latencies, failures, seconds));
+    }
+}
+
+// 本机替身服务在应答元数据前把帧写入共享内存帧环，客户端直接租用槽位
+// 与 image_harmony.getImageByImageId 的 gRPC 整帧传输对比
+void runSharedMemory(const Config& config, const ImageHarmonyClient::ImageInfo& imageInfo) {
+    const std::string scenario = "image_harmony.getImageByImageId(shm)";
+    if (!config.target.empty() || (!config.filter.empty() && std::string::npos == scenario.find(config.filter))) {
+        return;
+    }
+    MockServices::Options options = config.mock;
+    options.shmName = "/dai_grpc_clients_benchmark_" + std::to_string(getpid());
+    MockServices standIn;
+    if (!standIn.start(options)) {
+        return;
+    }
+    ImageHarmonyClient client;
+    client.setAddress("127.0.0.1", standIn.port());
+    client.connectImageLoader(1);
+    if (!client.setSharedMemory(options.shmName)) {
+        return;
+    }
+    runScenario(config, scenario, [&](int thread, int i) {
+        // 调用方处理完上一帧才取下一帧，取图前先归还上一帧的租约
+        thread_local cv::Mat image;
+        ImageHarmonyClient::ImageInfo request = imageInfo;
+        request.imageId = imageIdOf(config, thread, i);
+        int64_t imageId = 0;
+        image.release();
+        return client.getImageByImageId(request, imageId, image);
+    });
+    client.disconnectImageLoader();
+}
+
+// 模拟服务按帧率出帧，比较订阅与循环请求最新帧两种取法
+// calls/s 为送达的帧率，延迟为帧从产生到解码完成
+void runStream(const Config& config, const MockServices& services, ImageHarmonyClient& imageHarmonyClient, const ImageHarmonyClient::ImageInfo& imageInfo) {
+    if (!config.target.empty() || config.mock.frameRate <= 0) {
+        return;
+    }
+    const std::string pollScenario = "image_harmony.stream.poll";
+    const std::string subscribeScenario = "image_harmony.stream.subscribe";
+    std::chrono::steady_clock::duration duration = std::chrono::seconds(std::max(1, config.streamSeconds));
+    auto latencyOf = [&services](int64_t imageId) {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - services.frameTime(imageId)).count();
+    };
+    auto selected = [&config](const std::string& scenario) {
+        return config.filter.empty() || std::string::npos != scenario.find(config.filter);
+    };
+
+    if (selected(pollScenario)) {
+        // 调用方自己循环请求 imageId 0，新帧出现前的请求都是重复帧
+        ImageHarmonyClient::ImageInfo latest = imageInfo;
+        latest.imageId = 0;
+        std::vector<double> latencies;
+        uint64_t failures = 0;
+        int64_t lastId = 0;
+        cv::Mat image;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        while (std::chrono::steady_clock::now() - begin < duration) {
+            int64_t imageId = 0;
+            if (!imageHarmonyClient.getImageByImageId(latest, imageId, image)) {
+                ++failures;
+                continue;
+            }
+            if (imageId != lastId) {
+                lastId = imageId;
+                latencies.push_back(latencyOf(imageId));
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printResult(config, pollScenario, 1, summarize(latencies, failures, seconds));
+    }
+
+    if (selected(subscribeScenario)) {
+        ImageHarmonyClient::SubscribeOptions options;
+        options.imageInfo = imageInfo;
+        options.pollIntervalMs = 1;
+        std::vector<double> latencies;
+        ImageHarmonyClient::DecodedImage frame;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        if (!imageHarmonyClient.subscribe(options)) {
+            return;
+        }
+        while (std::chrono::steady_clock::now() - begin < duration) {
+            if (imageHarmonyClient.popSubscribedFrame(frame)) {
+                latencies.push_back(latencyOf(frame.imageId));
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+        imageHarmonyClient.unsubscribe();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        printResult(config, subscribeScenario, 1, summarize(latencies, 0, seconds));
+    }
+}
+
+// 各服务注入不同的延迟，同时只有一帧在途，整帧延迟应接近最慢的阶段而不是各阶段之和
+void runStageLatency(const Config& config) {
+    const std::string scenario = "frame_pipeline.stages";
+    if (!config.target.empty() || (!config.filter.empty() && std::string::npos == scenario.find(config.filter))) {
+        return;
+    }
+    // 未单独指定时取一组互不相同的延迟，检测最慢；行为识别阶段有两次请求
+    MockServices::Options options = config.mock;
+    auto pick = [](int configured, int fallback) { return configured >= 0 ? configured : fallback; };
+    options.imageHarmonyLatencyUs = pick(options.imageHarmonyLatencyUs, 1000);
+    options.targetDetectionLatencyUs = pick(options.targetDetectionLatencyUs, 6000);
+    options.targetTrackingLatencyUs = pick(options.targetTrackingLatencyUs, 3000);
+    options.behaviorRecognitionLatencyUs = pick(options.behaviorRecognitionLatencyUs, 1500);
+    MockServices standIn;
+    if (!standIn.start(options)) {
+        return;
+    }
+    ImageHarmonyClient imageHarmonyClient;
+    imageHarmonyClient.setAddress("127.0.0.1", standIn.port());
+    imageHarmonyClient.connectImageLoader(1);
+    TargetDetectionClient targetDetectionClient;
+    targetDetectionClient.setAddress("127.0.0.1", standIn.port());
+    targetDetectionClient.setTaskId(1);
+    targetDetectionClient.getMappingTable();
+    TargetTrackingClient targetTrackingClient;
+    targetTrackingClient.setAddress("127.0.0.1", standIn.port());
+    targetTrackingClient.setTaskId(1);
+    BehaviorRecognitionClient behaviorRecognitionClient;
+    behaviorRecognitionClient.setAddress("127.0.0.1", standIn.port());
+    behaviorRecognitionClient.setTaskId(1);
+
+    FramePipeline pipeline(&imageHarmonyClient, &targetDetectionClient, &targetTrackingClient, &behaviorRecognitionClient);
+    FramePipeline::Options pipelineOptions;
+    pipelineOptions.imageInfo.width = options.imageWidth;
+    pipelineOptions.imageInfo.height = options.imageHeight;
+    pipelineOptions.maxInFlightPerStage = 1;
+    pipelineOptions.maxInFlightFrames = 1;
+    std::mutex mutex;
+    std::vector<double> stageLatencies[FramePipeline::STAGE_COUNT];
+    std::vector<double> frameLatencies;
+    uint64_t failures = 0;
+    pipeline.start(pipelineOptions, [&](FramePipeline::FrameRecord& record) {
+        bool ok = std::all_of(std::begin(record.ok), std::end(record.ok), [](bool stageOk) { return stageOk; });
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int stage = 0; stage < FramePipeline::STAGE_COUNT; ++stage) {
+            stageLatencies[stage].push_back(static_cast<double>(record.latencyUs[stage]));
+        }
+        frameLatencies.push_back(static_cast<double>(record.totalLatencyUs));
+        if (!ok) {
+            ++failures;
+        }
+    });
+    int frames = std::min(config.calls, 200);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; ++i) {
+        pipeline.push(i + 1);
+    }
+    pipeline.stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    static const char* const stageNames[FramePipeline::STAGE_COUNT] = {"fetch", "detect", "track", "behavior"};
+    double slowestUs = 0;
+    double sumUs = 0;
+    for (int stage = 0; stage < FramePipeline::STAGE_COUNT; ++stage) {
+        RunResult result = summarize(stageLatencies[stage], 0, seconds);
+        printResult(config, scenario + "." + stageNames[stage], 1, result);
+        slowestUs = std::max(slowestUs, result.p50Us);
+        sumUs += result.p50Us;
+    }
+    RunResult frame = summarize(frameLatencies, failures, seconds);
+    printResult(config, scenario + ".frame", 1, frame);
+    if (!config.csv) {
+        std::printf("  frame p50 %.1f us, slowest stage p50 %.1f us, sum of stages p50 %.1f us\n", frame.p50Us, slowestUs, sumUs);
+    }
+    imageHarmonyClient.disconnectImageLoader();
+}
+
+bool parseCompression(const std::string& name, CompressionAlgorithm& algorithm) {
+    if ("none" == name) algorithm = CompressionAlgorithm::NONE;
+    else if ("deflate" == name) algorithm = CompressionAlgorithm::DEFLATE;
+    else if ("gzip" == name) algorithm = CompressionAlgorithm::GZIP;
+    else return false;
+    return true;
+}
+
+// 各方法共用的默认策略，只设置压缩
+CallPolicy compressionPolicy(const Config& config) {
+    CallPolicy policy;
+    policy.defaults.compression = config.acceptCompression;
+    policy.defaults.compressAboveBytes = static_cast<size_t>(std::max(0, config.compressAboveBytes));
+    return policy;
+}
+
+bool parseArgs(int argc, char** argv, Config& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto next = [&](int& value) {
+            if (i + 1 >= argc) {
+                return false;
+            }
+            value = std::atoi(argv[++i]);
+            return true;
+        };
+        bool ok = true;
+        if ("--threads" == arg) ok = next(config.maxThreads);
+        else if ("--calls" == arg) ok = next(config.calls);
+        else if ("--batch" == arg) ok = next(config.batchSize);
+        else if ("--width" == arg) ok = next(config.mock.imageWidth);
+        else if ("--height" == arg) ok = next(config.mock.imageHeight);
+        else if ("--quality" == arg) ok = next(config.mock.jpegQuality);
+        else if ("--boxes" == arg) ok = next(config.mock.boxes);
+        else if ("--tracks" == arg) ok = next(config.mock.tracks);
+        else if ("--track-length" == arg) ok = next(config.mock.trackLength);
+        else if ("--labels" == arg) ok = next(config.mock.labels);
+        else if ("--latency-us" == arg) ok = next(config.mock.latencyUs);
+        else if ("--ih-latency-us" == arg) ok = next(config.mock.imageHarmonyLatencyUs);
+        else if ("--td-latency-us" == arg) ok = next(config.mock.targetDetectionLatencyUs);
+        else if ("--tt-latency-us" == arg) ok = next(config.mock.targetTrackingLatencyUs);
+        else if ("--br-latency-us" == arg) ok = next(config.mock.behaviorRecognitionLatencyUs);
+        else if ("--compress" == arg) config.mock.compressResponses = true;
+        else if ("--wire-bytes" == arg) config.mock.countWireBytes = true;
+        else if ("--accept-compression" == arg && i + 1 < argc) ok = parseCompression(argv[++i], config.acceptCompression);
+        else if ("--compress-above" == arg) ok = next(config.compressAboveBytes);
+        else if ("--fps" == arg) ok = next(config.mock.frameRate);
+        else if ("--stream-seconds" == arg) ok = next(config.streamSeconds);
+        else if ("--filter" == arg && i + 1 < argc) config.filter = argv[++i];
+        else if ("--csv" == arg) config.csv = true;
+        else if ("--metrics" == arg) config.metrics = true;
+        else if ("--check-allocs" == arg) config.checkAllocations = true;
+        else if ("--target" == arg && i + 1 < argc) config.target = argv[++i];
+        else if ("--record" == arg && i + 1 < argc) config.recordPath = argv[++i];
+        else ok = false;
+        if (!ok) {
+            std::cout << "usage: " << argv[0] << " [--threads N] [--calls N] [--batch N] [--width W] [--height H] [--quality Q]\n"
+                      << "       [--boxes N] [--tracks N] [--track-length N] [--labels N] [--latency-us US] [--compress]\n"
+                      << "       [--ih-latency-us US] [--td-latency-us US] [--tt-latency-us US] [--br-latency-us US]\n"
+                      << "       [--fps N] [--stream-seconds N] [--wire-bytes] [--accept-compression none|deflate|gzip] [--compress-above BYTES]\n"
+                      << "       [--filter SUBSTRING] [--csv] [--metrics] [--check-allocs] [--target IP:PORT] [--record PATH]" << std::endl;
+            return false;
+        }
+    }
+    config.maxThreads = std::max(1, config.maxThreads);
+    config.calls = std::max(1, config.calls);
+    config.batchSize = std::max(1, config.batchSize);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Config config;
+    if (!parseArgs(argc, argv, config)) {
+        return 1;
+    }
+    MockServices services;
+    std::string ip = "127.0.0.1";
+    int port = 0;
+    if (config.target.empty()) {
+        if (!services.start(config.mock)) {
+            return 1;
+        }
+        port = services.port();
+        if (config.mock.countWireBytes) {
+            wireCounter = &services;
+        }
+        if (!config.csv) {
+            std::printf("mock services on 127.0.0.1:%d, image %dx%d (%zu bytes jpeg), %d boxes, %d tracks x %d, latency %d us, %d fps\n",
+                        port, config.mock.imageWidth, config.mock.imageHeight, services.encodedImageBytes(),
+                        config.mock.boxes, config.mock.tracks, config.mock.trackLength, config.mock.latencyUs, config.mock.frameRate);
+        }
+    } else {
+        size_t colon = config.target.rfind(':');
+        if (std::string::npos == colon) {
+            std::cout << "invalid target " << config.target << std::endl;
+            return 1;
+        }
+        ip = config.target.substr(0, colon);
+        port = std::atoi(config.target.c_str() + colon + 1);
+    }
+    if (!config.recordPath.empty() && !RpcRecorder::instance().start(config.recordPath)) {
+        return 1;
+    }
+    measureAllocationFloor(config, ip + ":" + std::to_string(port));
+    printHeader(config);
+
+    ImageHarmonyClient imageHarmonyClient;
+    imageHarmonyClient.setAddress(ip, port);
+    imageHarmonyClient.connectImageLoader(1);
+    ImageHarmonyClient::ImageInfo imageInfo;
+    imageInfo.width = config.mock.imageWidth;
+    imageInfo.height = config.mock.imageHeight;
+    runScenario(config, "image_harmony.getImageByImageId", [&](int thread, int i) {
+        thread_local cv::Mat image;
+        ImageHarmonyClient::ImageInfo request = imageInfo;
+        request.imageId = imageIdOf(config, thread, i);
+        int64_t imageId = 0;
+        return imageHarmonyClient.getImageByImageId(request, imageId, image);
+    });
+    runSharedMemory(config, imageInfo);
+    runScenario(config, "image_harmony.getImageSize", [&](int thread, int i) {
+        ImageHarmonyClient::ImageInfo request = imageInfo;
+        request.imageId = imageIdOf(config, thread, i);
+        int64_t imageId = 0;
+        int width = 0;
+        int height = 0;
+        return imageHarmonyClient.getImageSize(request, imageId, width, height);
+    }, AllocationBudget{1, 0});
+    runStream(config, services, imageHarmonyClient, imageInfo);
+
+    TargetDetectionClient targetDetectionClient;
+    targetDetectionClient.setAddress(ip, port);
+    targetDetectionClient.setTaskId(1);
+    targetDetectionClient.setCallPolicy(compressionPolicy(config));
+    targetDetectionClient.getMappingTable();
+    runScenario(config, "target_detection.getResultByImageId", [&](int thread, int i) {
+        thread_local std::vector<TargetDetectionClient::Result> results;
+        return targetDetectionClient.getResultByImageId(imageIdOf(config, thread, i), results);
+    }, AllocationBudget{1, 0});
+    runScenario(config, "target_detection.getResultByImageId(columns)", [&](int thread, int i) {
+        thread_local TargetDetectionClient::ResultColumns columns;
+        return targetDetectionClient.getResultByImageId(imageIdOf(config, thread, i), columns);
+    }, AllocationBudget{1, 0});
+    // 每次调用取一批 imageId，延迟为整批耗时
+    runScenario(config, "target_detection.getResultsByImageIds", [&](int thread, int i) {
+        thread_local std::vector<int64_t> imageIds;
+        thread_local TargetDetectionClient::BatchResults batchResults;
+        imageIds.resize(config.batchSize);
+        for (int j = 0; j < config.batchSize; ++j) {
+            imageIds[j] = imageIdOf(config, thread, i) * config.batchSize + j;
+        }
+        return targetDetectionClient.getResultsByImageIds(imageIds, batchResults);
+    }, AllocationBudget{config.batchSize, 1,
+                        "the per-id RPCs complete on the async poller threads and allocs/call only counts the calling thread"});
+
+    TargetTrackingClient targetTrackingClient;
+    targetTrackingClient.setAddress(ip, port);
+    targetTrackingClient.setTaskId(1);
+    targetTrackingClient.setCallPolicy(compressionPolicy(config));
+    runScenario(config, "target_tracking.getResultByImageId", [&](int thread, int i) {
+        thread_local std::vector<TargetTrackingClient::Result> results;
+        return targetTrackingClient.getResultByImageId(imageIdOf(config, thread, i), results);
+    }, AllocationBudget{1, 0});
+
+    BehaviorRecognitionClient behaviorRecognitionClient;
+    behaviorRecognitionClient.setAddress(ip, port);
+    behaviorRecognitionClient.setTaskId(1);
+    behaviorRecognitionClient.setCallPolicy(compressionPolicy(config));
+    runScenario(config, "behavior_recognition.informImageId", [&](int thread, int i) {
+        return behaviorRecognitionClient.informImageId(imageIdOf(config, thread, i));
+    }, AllocationBudget{1, 0});
+    runScenario(config, "behavior_recognition.getResultByImageId", [&](int thread, int i) {
+        thread_local std::vector<BehaviorRecognitionClient::Result> results;
+        return behaviorRecognitionClient.getResultByImageId(imageIdOf(config, thread, i), results);
+    }, AllocationBudget{1, 0});
+    runScenario(config, "behavior_recognition.getLatestResult", [&](int thread, int i) {
+        thread_local std::vector<BehaviorRecognitionClient::Result> results;
+        return behaviorRecognitionClient.getLatestResult(results);
+    }, AllocationBudget{1, 0});
+
+    runPipeline(config, imageHarmonyClient, targetDetectionClient, targetTrackingClient, behaviorRecognitionClient);
+    runStageLatency(config);
+
+    if (config.metrics && !config.csv) {
+        std::cout << RpcMetrics::instance().exportText();
+    }
+    imageHarmonyClient.disconnectImageLoader();
+    RpcRecorder::instance().stop();
+    if (!allocationViolations.empty()) {
+        std::fprintf(stderr, "%zu scenario runs allocate more than the gRPC floor plus their budget\n", allocationViolations.size());
+        if (config.checkAllocations) {
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "image_harmony.pb.h"
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+// 统计堆分配的字节数，与显式拷贝的字节数一起说明每帧的内存开销
+static uint64_t allocatedBytes = 0;
+
+void* operator new(size_t size) {
+    allocatedBytes += size;
+    void* p = std::malloc(size ? size : 1);
+    if (nullptr == p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+struct Options {
+    int width = 1920;
+    int height = 1080;
+    int quality = 90;
+    int iterations = 200;
+    std::string format = ".jpg";
+};
+
+struct Result {
+    double msPerFrame = 0;
+    double copiedBytesPerFrame = 0;
+    double allocatedBytesPerFrame = 0;
+};
+
+// 改动前的做法：拷贝到 std::string，再拷贝到 std::vector，解码后 clone
+uint64_t copyingDecode(const imageHarmony::GetImageByImageIdResponse& response, cv::Mat& imageOutput) {
+    std::string buffer = response.imageresponse().buffer();
+    std::vector<uint8_t> vecBuffer(buffer.begin(), buffer.end());
+    cv::Mat image = cv::imdecode(vecBuffer, cv::IMREAD_COLOR);
+    imageOutput = image.clone();
+    return buffer.size() + vecBuffer.size() + image.total() * image.elemSize();
+}
+
+// 现在的做法：以不持有内存的 Mat 引用 protobuf 的字节，解码到可复用的 Mat
+uint64_t inPlaceDecode(const imageHarmony::GetImageByImageIdResponse& response, cv::Mat& imageOutput) {
+    const std::string& buffer = response.imageresponse().buffer();
+    cv::Mat encoded(1, static_cast<int>(buffer.size()), CV_8UC1, const_cast<char*>(buffer.data()));
+    cv::imdecode(encoded, cv::IMREAD_COLOR, &imageOutput);
+    return 0;
+}
+
+template <typename Decode>
+Result measure(int iterations, const imageHarmony::GetImageByImageIdResponse& response, Decode decode) {
+    cv::Mat image;
+    // 预热一次，让可复用的输出完成分配
+    decode(response, image);
+    uint64_t copied = 0;
+    uint64_t allocatedBefore = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        copied += decode(response, image);
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    Result result;
+    result.msPerFrame = elapsed.count() / iterations;
+    result.copiedBytesPerFrame = static_cast<double>(copied) / iterations;
+    result.allocatedBytesPerFrame = static_cast<double>(allocatedBytes - allocatedBefore) / iterations;
+    return result;
+}
+
+void printResult(const std::string& name, const Result& result) {
+    std::cout << std::setw(8) << std::left << name << std::right
+              << std::setprecision(3) << result.msPerFrame << " ms/frame, "
+              << std::setprecision(0) << result.copiedBytesPerFrame << " bytes copied/frame, "
+              << result.allocatedBytesPerFrame << " bytes allocated/frame\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ("--width" == arg && hasValue) options.width = std::atoi(argv[++i]);
+        else if ("--height" == arg && hasValue) options.height = std::atoi(argv[++i]);
+        else if ("--quality" == arg && hasValue) options.quality = std::atoi(argv[++i]);
+        else if ("--iterations" == arg && hasValue) options.iterations = std::atoi(argv[++i]);
+        else if ("--bmp" == arg) options.format = ".bmp";
+        else {
+            std::cout << "usage: " << argv[0] << " [--width N] [--height N] [--quality Q] [--iterations N] [--bmp]" << std::endl;
+            return 1;
+        }
+    }
+
+    cv::Mat image(options.height, options.width, CV_8UC3);
+    cv::randu(image, cv::Scalar(0, 0, 0), cv::Scalar(256, 256, 256));
+    std::vector<uchar> encoded;
+    cv::imencode(options.format, image, encoded, {cv::IMWRITE_JPEG_QUALITY, options.quality});
+    imageHarmony::GetImageByImageIdResponse response;
+    response.mutable_imageresponse()->set_buffer(encoded.data(), encoded.size());
+
+    Result before = measure(options.iterations, response, copyingDecode);
+    Result after = measure(options.iterations, response, inPlaceDecode);
+
+    std::cout << std::fixed
+              << options.width << "x" << options.height << " " << options.format << ", "
+              << encoded.size() << " bytes encoded, " << options.iterations << " iterations\n";
+    printResult("before", before);
+    printResult("after", after);
+    return 0;
+}
@@ -0,0 +1,433 @@
+#include "mock_services.h"
+#include "image_harmony_shm.h"
+#include <grpc++/grpc++.h>
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "image_harmony.grpc.pb.h"
+#include "target_detection.grpc.pb.h"
+#include "target_tracking.grpc.pb.h"
+#include "behavior_recognition.grpc.pb.h"
+
+namespace {
+
+void injectLatency(int latencyUs) {
+    if (latencyUs > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(latencyUs));
+    }
+}
+
+int latencyOf(int serviceLatencyUs, const MockServices::Options& options) {
+    return serviceLatencyUs < 0 ? options.latencyUs : serviceLatencyUs;
+}
+
+class MockImageHarmony : public imageHarmony::Communicate::Service {
+public:
+    MockImageHarmony(const MockServices::Options& options): options(options), latencyUs(latencyOf(options.imageHarmonyLatencyUs, options)), startTime(std::chrono::steady_clock::now()) {
+        // 带噪声的渐变图，压缩率接近真实画面
+        image.create(options.imageHeight, options.imageWidth, CV_8UC3);
+        std::mt19937 rng(20231024);
+        for (int y = 0; y < image.rows; ++y) {
+            uint8_t* row = image.ptr<uint8_t>(y);
+            for (int x = 0; x < image.cols; ++x) {
+                uint8_t noise = static_cast<uint8_t>(rng() % 32);
+                row[3 * x] = static_cast<uint8_t>(x + noise);
+                row[3 * x + 1] = static_cast<uint8_t>(y + noise);
+                row[3 * x + 2] = static_cast<uint8_t>(x + y);
+            }
+        }
+        std::vector<uint8_t> buffer;
+        cv::imencode(".jpg", image, buffer, {cv::IMWRITE_JPEG_QUALITY, options.jpegQuality});
+        jpeg.assign(buffer.begin(), buffer.end());
+        cv::imencode(".bmp", image, buffer);
+        bitmap.assign(buffer.begin(), buffer.end());
+    }
+
+    grpc::Status connectImageLoader(grpc::ServerContext* context, const imageHarmony::ConnectImageLoaderRequest* request, imageHarmony::ConnectImageLoaderResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        response->set_connectionid(1);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status disconnectImageLoader(grpc::ServerContext* context, const imageHarmony::DisconnectImageLoaderRequest* request, imageHarmony::DisconnectImageLoaderResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status getImageByImageId(grpc::ServerContext* context, const imageHarmony::GetImageByImageIdRequest* request, imageHarmony::GetImageByImageIdResponse* response) override {
+        injectLatency(latencyUs);
+        const imageHarmony::ImageRequest& imageRequest = request->imagerequest();
+        // imageId 为 0 时返回“最新”一帧，未设置帧率时每次调用前进一帧
+        int64_t imageId = imageRequest.imageid() ? imageRequest.imageid() : latest();
+        response->mutable_response()->set_code(200);
+        imageHarmony::ImageResponse* imageResponse = response->mutable_imageresponse();
+        imageResponse->set_imageid(imageId);
+        imageResponse->set_width(options.imageWidth);
+        imageResponse->set_height(options.imageHeight);
+        if (imageRequest.noimagebuffer() && shmRing.isOpen()) {
+            // 共享内存读端只请求元数据，帧在应答前写入槽位；槽位被租用时读端回退到 gRPC
+            std::lock_guard<std::mutex> lock(shmMutex);
+            shmRing.write(imageId, image);
+        }
+        if (!imageRequest.noimagebuffer()) {
+            imageResponse->set_buffer(".bmp" == imageRequest.format() ? bitmap : jpeg);
+        }
+        return grpc::Status::OK;
+    }
+
+    int64_t latest() {
+        if (options.frameRate <= 0) {
+            return ++latestImageId;
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+        return 1 + static_cast<int64_t>(elapsed.count() * options.frameRate);
+    }
+
+    std::chrono::steady_clock::time_point frameTime(int64_t imageId) const {
+        std::chrono::duration<double> offset(static_cast<double>(imageId - 1) / std::max(1, options.frameRate));
+        return startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+    }
+
+    MockServices::Options options;
+    int latencyUs = 0;
+    cv::Mat image;
+    std::string jpeg;
+    std::string bitmap;
+    std::atomic<int64_t> latestImageId{0};
+    std::chrono::steady_clock::time_point startTime;
+    // 帧环按单写端设计，服务端多个线程写入时串行
+    std::mutex shmMutex;
+    ImageHarmonyShmRing shmRing;
+};
+
+class MockTargetDetection : public targetDetection::Communicate::Service {
+public:
+    MockTargetDetection(const MockServices::Options& options): options(options), latencyUs(latencyOf(options.targetDetectionLatencyUs, options)) {}
+
+    grpc::Status getResultMappingTable(grpc::ServerContext* context, const targetDetection::GetResultMappingTableRequest* request, targetDetection::GetResultMappingTableResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        for (int i = 0; i < options.labels; ++i) {
+            response->add_labels("label_" + std::to_string(i));
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status getResultIndexByImageId(grpc::ServerContext* context, const targetDetection::GetResultIndexByImageIdRequest* request, targetDetection::GetResultIndexByImageIdResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        for (int i = 0; i < options.boxes; ++i) {
+            targetDetection::Result* result = response->add_results();
+            result->set_labelid(i % std::max(1, options.labels));
+            result->set_confidence(0.5 + 0.5 * i / std::max(1, options.boxes));
+            result->set_x1(0.01 * i);
+            result->set_y1(0.02 * i);
+            result->set_x2(0.01 * i + 0.1);
+            result->set_y2(0.02 * i + 0.2);
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status loadModel(grpc::ServerContext* context, const targetDetection::LoadModelRequest* request, targetDetection::LoadModelResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        return grpc::Status::OK;
+    }
+
+    MockServices::Options options;
+    int latencyUs = 0;
+};
+
+class MockTargetTracking : public targetTracking::Communicate::Service {
+public:
+    MockTargetTracking(const MockServices::Options& options): options(options), latencyUs(latencyOf(options.targetTrackingLatencyUs, options)) {}
+
+    grpc::Status getResultByImageId(grpc::ServerContext* context, const targetTracking::GetResultByImageIdRequest* request, targetTracking::GetResultByImageIdResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        int length = request->onlythelatest() ? 1 : options.trackLength;
+        for (int i = 0; i < options.tracks; ++i) {
+            targetTracking::Result* result = response->add_results();
+            result->set_id(i + 1);
+            for (int j = 0; j < length; ++j) {
+                targetTracking::BoundingBox* bbox = result->add_bboxs();
+                bbox->set_x1(0.01 * j);
+                bbox->set_y1(0.01 * i);
+                bbox->set_x2(0.01 * j + 0.1);
+                bbox->set_y2(0.01 * i + 0.1);
+            }
+        }
+        return grpc::Status::OK;
+    }
+
+    MockServices::Options options;
+    int latencyUs = 0;
+};
+
+class MockBehaviorRecognition : public behaviorRecognition::Communicate::Service {
+public:
+    MockBehaviorRecognition(const MockServices::Options& options): options(options), latencyUs(latencyOf(options.behaviorRecognitionLatencyUs, options)) {}
+
+    grpc::Status informImageId(grpc::ServerContext* context, const behaviorRecognition::InformImageIdRequest* request, behaviorRecognition::InformImageIdResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        return grpc::Status::OK;
+    }
+
+    grpc::Status getResultByImageId(grpc::ServerContext* context, const behaviorRecognition::GetResultByImageIdRequest* request, behaviorRecognition::GetResultByImageIdResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        fillResults(*response->mutable_results());
+        return grpc::Status::OK;
+    }
+
+    grpc::Status getLatestResult(grpc::ServerContext* context, const behaviorRecognition::GetLatestResultRequest* request, behaviorRecognition::GetLatestResultResponse* response) override {
+        injectLatency(latencyUs);
+        response->mutable_response()->set_code(200);
+        fillResults(*response->mutable_results());
+        return grpc::Status::OK;
+    }
+
+    void fillResults(google::protobuf::RepeatedPtrField<behaviorRecognition::Result>& results) {
+        for (int i = 0; i < options.boxes; ++i) {
+            behaviorRecognition::Result* result = results.Add();
+            result->set_personid(i + 1);
+            result->set_x1(0.01 * i);
+            result->set_y1(0.02 * i);
+            result->set_x2(0.01 * i + 0.1);
+            result->set_y2(0.02 * i + 0.2);
+            behaviorRecognition::LabelInfo* labelInfo = result->add_labelinfos();
+            labelInfo->set_label("walking");
+            labelInfo->set_confidence(0.9);
+        }
+    }
+
+    MockServices::Options options;
+    int latencyUs = 0;
+};
+
+// 127.0.0.1 上的 TCP 转发，统计服务端发往客户端的字节数，即压缩后实际传输的大小（含 HTTP/2 帧头）
+class WireRelay {
+public:
+    ~WireRelay() {
+        stop();
+    }
+
+    bool start(int serverPort) {
+        listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenFd < 0) {
+            return false;
+        }
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (0 != bind(listenFd, reinterpret_cast<sockaddr*>(&address), length) || 0 != listen(listenFd, 64)
+            || 0 != getsockname(listenFd, reinterpret_cast<sockaddr*>(&address), &length)) {
+            close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        relayPort = ntohs(address.sin_port);
+        upstreamPort = serverPort;
+        acceptor = std::thread(&WireRelay::acceptLoop, this);
+        return true;
+    }
+
+    void stop() {
+        if (listenFd < 0) {
+            return;
+        }
+        shutdown(listenFd, SHUT_RDWR);
+        acceptor.join();
+        close(listenFd);
+        listenFd = -1;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : fds) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        for (std::thread& pump : pumps) {
+            pump.join();
+        }
+        for (int fd : fds) {
+            close(fd);
+        }
+        pumps.clear();
+        fds.clear();
+    }
+
+    int port() const {
+        return relayPort;
+    }
+
+    uint64_t bytes() const {
+        return downstreamBytes.load(std::memory_order_relaxed);
+    }
+private:
+    void acceptLoop() {
+        while (true) {
+            int client = accept(listenFd, nullptr, nullptr);
+            if (client < 0) {
+                return;
+            }
+            int server = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            address.sin_port = htons(static_cast<uint16_t>(upstreamPort));
+            if (server < 0 || 0 != connect(server, reinterpret_cast<sockaddr*>(&address), sizeof(address))) {
+                if (server >= 0) {
+                    close(server);
+                }
+                close(client);
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            fds.push_back(client);
+            fds.push_back(server);
+            pumps.emplace_back(&WireRelay::pump, client, server, nullptr);
+            pumps.emplace_back(&WireRelay::pump, server, client, &downstreamBytes);
+        }
+    }
+
+    // 一侧关闭后同时关闭两侧，另一个方向的转发随之退出
+    static void pump(int from, int to, std::atomic<uint64_t>* counter) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t received = recv(from, buffer, sizeof(buffer), 0);
+            if (received <= 0) {
+                break;
+            }
+            if (nullptr != counter) {
+                counter->fetch_add(static_cast<uint64_t>(received), std::memory_order_relaxed);
+            }
+            ssize_t sent = 0;
+            while (sent < received) {
+                ssize_t n = send(to, buffer + sent, received - sent, MSG_NOSIGNAL);
+                if (n <= 0) {
+                    break;
+                }
+                sent += n;
+            }
+            if (sent < received) {
+                break;
+            }
+        }
+        shutdown(from, SHUT_RDWR);
+        shutdown(to, SHUT_RDWR);
+    }
+
+    int listenFd = -1;
+    int relayPort = 0;
+    int upstreamPort = 0;
+    std::thread acceptor;
+    std::mutex mutex;
+    std::vector<std::thread> pumps;
+    std::vector<int> fds;
+    std::atomic<uint64_t> downstreamBytes{0};
+};
+
+} // namespace
+
+struct MockServices::Impl {
+    std::unique_ptr<MockImageHarmony> imageHarmony;
+    std::unique_ptr<MockTargetDetection> targetDetection;
+    std::unique_ptr<MockTargetTracking> targetTracking;
+    std::unique_ptr<MockBehaviorRecognition> behaviorRecognition;
+    std::unique_ptr<grpc::Server> server;
+    int port = 0;
+    std::unique_ptr<WireRelay> relay;
+};
+
+MockServices::MockServices(): pImpl(new Impl()) {
+
+}
+
+MockServices::~MockServices() {
+    stop();
+}
+
+bool MockServices::start(MockServices::Options options) {
+    stop();
+    pImpl->imageHarmony.reset(new MockImageHarmony(options));
+    if (!options.shmName.empty()) {
+        size_t slotBytes = static_cast<size_t>(options.imageWidth) * options.imageHeight * 3;
+        if (!pImpl->imageHarmony->shmRing.create(options.shmName, options.shmSlots, slotBytes)) {
+            // TODO 以后改成日志
+            std::cout << "failed to create shared memory ring " << options.shmName << std::endl;
+            return false;
+        }
+    }
+    pImpl->targetDetection.reset(new MockTargetDetection(options));
+    pImpl->targetTracking.reset(new MockTargetTracking(options));
+    pImpl->behaviorRecognition.reset(new MockBehaviorRecognition(options));
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("127.0.0.1:0", grpc::InsecureServerCredentials(), &pImpl->port);
+    builder.SetMaxSendMessageSize(-1);
+    if (options.compressResponses) {
+        // 标准的 grpc-encoding 协商，算法从客户端声明接受的算法中选择
+        builder.SetDefaultCompressionLevel(GRPC_COMPRESS_LEVEL_MED);
+    }
+    builder.RegisterService(pImpl->imageHarmony.get());
+    builder.RegisterService(pImpl->targetDetection.get());
+    builder.RegisterService(pImpl->targetTracking.get());
+    builder.RegisterService(pImpl->behaviorRecognition.get());
+    pImpl->server = builder.BuildAndStart();
+    if (nullptr == pImpl->server || 0 == pImpl->port) {
+        // TODO 以后改成日志
+        std::cout << "failed to start mock services" << std::endl;
+        pImpl->server.reset();
+        return false;
+    }
+    if (options.countWireBytes) {
+        pImpl->relay.reset(new WireRelay());
+        if (!pImpl->relay->start(pImpl->port)) {
+            // TODO 以后改成日志
+            std::cout << "failed to start wire relay" << std::endl;
+            pImpl->relay.reset();
+            stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void MockServices::stop() {
+    if (nullptr == pImpl->server) {
+        return;
+    }
+    // 先断开转发，客户端的连接随之失效
+    pImpl->relay.reset();
+    pImpl->server->Shutdown();
+    pImpl->server->Wait();
+    pImpl->server.reset();
+}
+
+int MockServices::port() const {
+    return nullptr == pImpl->relay ? pImpl->port : pImpl->relay->port();
+}
+
+uint64_t MockServices::wireBytes() const {
+    return nullptr == pImpl->relay ? 0 : pImpl->relay->bytes();
+}
+
+size_t MockServices::encodedImageBytes() const {
+    return nullptr == pImpl->imageHarmony ? 0 : pImpl->imageHarmony->jpeg.size();
+}
+
+std::chrono::steady_clock::time_point MockServices::frameTime(int64_t imageId) const {
+    return nullptr == pImpl->imageHarmony ? std::chrono::steady_clock::time_point() : pImpl->imageHarmony->frameTime(imageId);
+}
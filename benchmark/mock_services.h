@@ -0,0 +1,67 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     mock_services.h                                                 *
+*  @brief    基准测试用的进程内模拟服务端                                    *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 在同一个 gRPC Server 上实现四个服务，返回按配置生成的固定数据， *
+*            每个请求可注入固定延迟，用于在没有真实服务时测量客户端开销。    *
+*            设置 shmName 时像同机部署的图像服务一样把帧写入共享内存帧环。   *
+*            countWireBytes 时客户端经本机 TCP 转发连接，转发统计压缩后      *
+*            实际传输的响应字节数，客户端拿不到这一数据。                    *
+*****************************************************************************/
+
+#ifndef _MOCK_SERVICES_H_
+#define _MOCK_SERVICES_H_
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class MockServices {
+public:
+    struct Options {
+        int imageWidth = 1280;
+        int imageHeight = 720;
+        int jpegQuality = 90;
+        int boxes = 20;             // 每帧检测框数，也是行为识别的人数
+        int tracks = 20;            // 每帧轨迹数
+        int trackLength = 30;       // 每条轨迹的历史框数
+        int labels = 80;            // 检测映射表大小
+        int latencyUs = 0;          // 每个请求注入的延迟
+        // 各服务单独注入的延迟，小于 0 时使用 latencyUs
+        int imageHarmonyLatencyUs = -1;
+        int targetDetectionLatencyUs = -1;
+        int targetTrackingLatencyUs = -1;
+        int behaviorRecognitionLatencyUs = -1;
+        bool compressResponses = false; // 以默认压缩级别压缩响应，客户端声明接受时生效
+        int frameRate = 0;          // 请求最新帧时按此帧率出新帧，0 表示每次请求出一帧
+        std::string shmName;        // 非空时作为本机图像服务的替身，元数据请求的帧同时写入该共享内存帧环
+        int shmSlots = 64;
+        bool countWireBytes = false;    // 客户端经本机 TCP 转发连接，统计实际传输的响应字节数
+    };
+
+    MockServices();
+    ~MockServices();
+
+    // 监听 127.0.0.1 上的随机端口，返回 false 表示启动失败
+    bool start(MockServices::Options options);
+    void stop();
+    // countWireBytes 时为转发端口
+    int port() const;
+    // 服务端发往客户端的累计字节数，countWireBytes 为 false 时为 0
+    uint64_t wireBytes() const;
+    // 编码后的图像大小，即 getImageByImageId 的负载
+    size_t encodedImageBytes() const;
+    // frameRate 大于 0 时某一帧出现的时刻，用于计算帧从产生到送达的延迟
+    std::chrono::steady_clock::time_point frameTime(int64_t imageId) const;
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _MOCK_SERVICES_H_ */
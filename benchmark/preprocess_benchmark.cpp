@@ -0,0 +1,118 @@
+#include "image_harmony_preprocess.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    int sourceWidth = 1920;
+    int sourceHeight = 1080;
+    int width = 640;
+    int height = 640;
+    int iterations = 200;
+};
+
+// 检测器原先的做法：resize、copyMakeBorder、cvtColor、convertTo，最后 split 到 CHW
+void naiveChain(const cv::Mat& image, const ImageHarmonyPreprocessor::Options& options, cv::Mat& resized, cv::Mat& boxed, cv::Mat& rgb, cv::Mat& floats, cv::Mat& tensor) {
+    double ratio = std::min(static_cast<double>(options.width) / image.cols, static_cast<double>(options.height) / image.rows);
+    int contentWidth = static_cast<int>(std::lround(image.cols * ratio));
+    int contentHeight = static_cast<int>(std::lround(image.rows * ratio));
+    int padLeft = (options.width - contentWidth) / 2;
+    int padTop = (options.height - contentHeight) / 2;
+    cv::resize(image, resized, cv::Size(contentWidth, contentHeight), 0, 0, cv::INTER_LINEAR);
+    cv::copyMakeBorder(resized, boxed, padTop, options.height - contentHeight - padTop, padLeft, options.width - contentWidth - padLeft,
+        cv::BORDER_CONSTANT, cv::Scalar(options.padValue, options.padValue, options.padValue));
+    cv::cvtColor(boxed, rgb, cv::COLOR_BGR2RGB);
+    rgb.convertTo(floats, CV_32F, options.scale);
+    int sizes[] = {1, 3, options.height, options.width};
+    tensor.create(4, sizes, CV_32F);
+    std::vector<cv::Mat> planes;
+    for (int c = 0; c < 3; ++c) {
+        planes.emplace_back(options.height, options.width, CV_32F, tensor.ptr<float>() + c * options.width * options.height);
+    }
+    cv::split(floats, planes);
+}
+
+template <typename Function>
+double msPerFrame(int iterations, Function function) {
+    // 预热一次，让各缓冲区完成分配
+    function();
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        function();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ("--source-width" == arg && hasValue) options.sourceWidth = std::atoi(argv[++i]);
+        else if ("--source-height" == arg && hasValue) options.sourceHeight = std::atoi(argv[++i]);
+        else if ("--width" == arg && hasValue) options.width = std::atoi(argv[++i]);
+        else if ("--height" == arg && hasValue) options.height = std::atoi(argv[++i]);
+        else if ("--iterations" == arg && hasValue) options.iterations = std::atoi(argv[++i]);
+        else {
+            std::cout << "usage: " << argv[0] << " [--source-width N] [--source-height N] [--width N] [--height N] [--iterations N]" << std::endl;
+            return 1;
+        }
+    }
+
+    cv::Mat image(options.sourceHeight, options.sourceWidth, CV_8UC3);
+    cv::randu(image, cv::Scalar(0, 0, 0), cv::Scalar(256, 256, 256));
+    std::vector<uchar> encoded;
+    cv::imencode(".jpg", image, encoded);
+    cv::Mat buffer(1, static_cast<int>(encoded.size()), CV_8UC1, encoded.data());
+    cv::Mat decoded;
+
+    ImageHarmonyPreprocessor::Options preprocessOptions;
+    preprocessOptions.width = options.width;
+    preprocessOptions.height = options.height;
+    ImageHarmonyPreprocessor preprocessor(preprocessOptions);
+    ImageHarmonyPreprocessor::Layout layout;
+
+    cv::Mat resized;
+    cv::Mat boxed;
+    cv::Mat rgb;
+    cv::Mat floats;
+    cv::Mat naiveTensor;
+    cv::Mat fusedTensor;
+    double decodeMs = msPerFrame(options.iterations, [&]() {
+        cv::imdecode(buffer, cv::IMREAD_COLOR, &decoded);
+    });
+    double naiveMs = msPerFrame(options.iterations, [&]() {
+        naiveChain(decoded, preprocessOptions, resized, boxed, rgb, floats, naiveTensor);
+    });
+    double fusedMs = msPerFrame(options.iterations, [&]() {
+        preprocessor.run(decoded, fusedTensor, layout);
+    });
+
+    // cv::resize 对 8 位图像以定点权重插值并取整，与浮点插值相差约一个灰度
+    double maxDiff = 0;
+    const float* naive = naiveTensor.ptr<float>();
+    const float* fused = fusedTensor.ptr<float>();
+    size_t count = static_cast<size_t>(3) * options.width * options.height;
+    for (size_t i = 0; i < count; ++i) {
+        maxDiff = std::max(maxDiff, static_cast<double>(std::fabs(naive[i] - fused[i])));
+    }
+
+    std::cout << std::fixed << std::setprecision(3)
+              << options.sourceWidth << "x" << options.sourceHeight << " -> " << options.width << "x" << options.height
+              << ", " << options.iterations << " iterations\n"
+              << "decode " << decodeMs << " ms/frame\n"
+              << "naive  " << naiveMs << " ms/frame\n"
+              << "fused  " << fusedMs << " ms/frame, " << std::setprecision(2) << naiveMs / fusedMs << "x\n"
+              << "max abs diff " << std::setprecision(6) << maxDiff << std::endl;
+    return 0;
+}
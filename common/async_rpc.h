@@ -0,0 +1,215 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     async_rpc.h                                                     *
+*  @brief    各客户端共享的异步 gRPC 调用引擎                                  *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 进程内共享一组 CompletionQueue，每个队列一个轮询线程。            *
+*            回调在轮询线程中执行，不应在回调中做阻塞操作。                     *
+*            AsyncCallTracker 记录某个客户端的在途请求，析构客户端前取消并等待。*
+*****************************************************************************/
+
+#ifndef _ASYNC_RPC_H_
+#define _ASYNC_RPC_H_
+
+#include <grpc++/grpc++.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class AsyncRpcEngine {
+public:
+    struct Tag {
+        virtual ~Tag() {}
+        virtual void complete(bool ok) = 0;
+    };
+
+    // 首次调用 instance 之前设置轮询线程数，之后设置无效
+    static void configure(int pollers) {
+        configuredPollers().store(pollers);
+    }
+
+    static AsyncRpcEngine& instance() {
+        static AsyncRpcEngine engine(configuredPollers().load());
+        return engine;
+    }
+
+    // 轮流分配到各个队列
+    grpc::CompletionQueue* queue() {
+        size_t index = next.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        return queues[index].get();
+    }
+
+    ~AsyncRpcEngine() {
+        for (auto& queue : queues) {
+            queue->Shutdown();
+        }
+        for (std::thread& poller : pollers) {
+            poller.join();
+        }
+    }
+private:
+    explicit AsyncRpcEngine(int pollerCount) {
+        pollerCount = std::max(1, pollerCount);
+        for (int i = 0; i < pollerCount; ++i) {
+            queues.emplace_back(new grpc::CompletionQueue());
+        }
+        for (int i = 0; i < pollerCount; ++i) {
+            pollers.emplace_back(&AsyncRpcEngine::poll, queues[i].get());
+        }
+    }
+
+    static std::atomic<int>& configuredPollers() {
+        static std::atomic<int> count{2};
+        return count;
+    }
+
+    static void poll(grpc::CompletionQueue* queue) {
+        void* tag = nullptr;
+        bool ok = false;
+        while (queue->Next(&tag, &ok)) {
+            static_cast<Tag*>(tag)->complete(ok);
+        }
+    }
+
+    std::vector<std::unique_ptr<grpc::CompletionQueue>> queues;
+    std::vector<std::thread> pollers;
+    std::atomic<size_t> next{0};
+};
+
+// 记录一个客户端的在途异步请求
+// 以侵入式链表串起各请求内嵌的 Node，登记和移除都不分配内存
+class AsyncCallTracker {
+public:
+    struct Node {
+        grpc::ClientContext* context = nullptr;
+        Node* prev = nullptr;
+        Node* next = nullptr;
+    };
+
+    bool add(Node* node) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (closed) {
+            return false;
+        }
+        node->prev = nullptr;
+        node->next = head;
+        if (head) {
+            head->prev = node;
+        }
+        head = node;
+        return true;
+    }
+
+    void remove(Node* node) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            head = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        node->prev = nullptr;
+        node->next = nullptr;
+        if (nullptr == head) {
+            drained.notify_all();
+        }
+    }
+
+    // 拒绝新的请求，取消在途请求并等待其回调完成
+    void cancelAndWait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        closed = true;
+        for (Node* node = head; node; node = node->next) {
+            node->context->TryCancel();
+        }
+        drained.wait(lock, [this]() { return nullptr == head; });
+    }
+private:
+    std::mutex mutex;
+    std::condition_variable drained;
+    Node* head = nullptr;
+    bool closed = false;
+};
+
+// Owner 为请求期间需要保持存活的对象，通常是 StubHolder::Lease
+// Callback 形如 void(const grpc::Status&, Response&)，按值内嵌，不经 std::function 分配
+template <typename Response, typename Owner = std::shared_ptr<void>, typename Callback = std::function<void(const grpc::Status&, Response&)>>
+class AsyncUnaryCall : public AsyncRpcEngine::Tag {
+public:
+    explicit AsyncUnaryCall(Callback callback): callback(std::move(callback)) {
+        trackerNode.context = &context;
+    }
+
+    void complete(bool) override {
+        // 先回调再移出 tracker，保证 cancelAndWait 返回时回调已执行完
+        callback(status, response);
+        if (tracker) {
+            tracker->remove(&trackerNode);
+        }
+        delete this;
+    }
+
+    grpc::ClientContext context;
+    Response response;
+    grpc::Status status;
+    std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader;
+    AsyncCallTracker* tracker = nullptr;
+    AsyncCallTracker::Node trackerNode;
+    // 请求结束前保持 stub 及其 channel 存活
+    Owner owner;
+private:
+    Callback callback;
+};
+
+// 发起一次异步一元调用，owner 通常为发起请求的 stub，prepare 形如
+//   [&](grpc::ClientContext* context, grpc::CompletionQueue* cq) { return stub->PrepareAsyncXxx(context, request, cq); }
+// 每次请求只分配一个 AsyncUnaryCall，tracker 已关闭时以 CANCELLED 状态同步回调
+template <typename Response, typename Owner, typename Prepare, typename Callback>
+void startAsyncCall(Owner owner, Prepare prepare, Callback callback, AsyncCallTracker* tracker = nullptr) {
+    AsyncUnaryCall<Response, Owner, Callback>* call = new AsyncUnaryCall<Response, Owner, Callback>(std::move(callback));
+    call->owner = std::move(owner);
+    if (tracker) {
+        if (!tracker->add(&call->trackerNode)) {
+            call->status = grpc::Status(grpc::StatusCode::CANCELLED, "client is stopping");
+            call->complete(true);
+            return;
+        }
+        call->tracker = tracker;
+    }
+    call->reader = prepare(&call->context, AsyncRpcEngine::instance().queue());
+    call->reader->StartCall();
+    call->reader->Finish(&call->response, &call->status, call);
+}
+
+// 参数检查失败等无需发起请求的情况
+template <typename T>
+std::future<T> makeReadyFuture(T value) {
+    std::promise<T> promise;
+    promise.set_value(std::move(value));
+    return promise.get_future();
+}
+
+// 以回调版本实现返回 future 的版本，start 收到的回调只调用一次
+template <typename Start>
+std::future<bool> completionFuture(Start start) {
+    std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+    std::future<bool> future = promise->get_future();
+    start([promise](bool ok) {
+        promise->set_value(ok);
+    });
+    return future;
+}
+
+#endif /* _ASYNC_RPC_H_ */
@@ -0,0 +1,375 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     call_executor.h                                                 *
+*  @brief    按 CallPolicy 执行同步一元调用：超时、重试、对冲                *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 不对冲时直接使用阻塞调用。对冲时每次尝试使用本地                *
+*            CompletionQueue，首个请求超过对冲延迟仍未返回时通过             *
+*            StubHolder::loadOther 向另一个地址再发一次，先成功者生效，      *
+*            另一个被取消并在返回前收回。对冲的响应与调用方的响应分配在      *
+*            同一个 Arena 上，胜出时 Swap 不拷贝。                           *
+*            只有 UNAVAILABLE、DEADLINE_EXCEEDED、RESOURCE_EXHAUSTED 和      *
+*            ABORTED 会重试，退避等待可被 stop 唤醒。                        *
+*            策略要求压缩时每次调用前按平均响应大小选择 accept，从对应的     *
+*            连接中取 stub。                                                 *
+*****************************************************************************/
+
+#ifndef _CALL_EXECUTOR_H_
+#define _CALL_EXECUTOR_H_
+
+#include "call_policy.h"
+#include "stub_holder.h"
+#include <grpc++/grpc++.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/message_lite.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+// 最近若干次成功请求的延迟，用于推算对冲延迟
+class LatencyWindow {
+public:
+    static const size_t CAPACITY = 128;
+    static const size_t MIN_SAMPLES = 20;       // 样本不足时不给出 p95
+    static const size_t RECOMPUTE_INTERVAL = 16;
+
+    void add(int64_t latencyUs) {
+        std::lock_guard<std::mutex> lock(mutex);
+        samples[count % CAPACITY] = latencyUs;
+        ++count;
+        if (count >= MIN_SAMPLES && 0 == count % RECOMPUTE_INTERVAL) {
+            size_t size = std::min(count, CAPACITY);
+            sorted.assign(samples, samples + size);
+            size_t index = size * 95 / 100;
+            std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+            p95.store(sorted[index], std::memory_order_relaxed);
+        }
+    }
+
+    // 0 表示样本不足
+    int64_t p95Us() const {
+        return p95.load(std::memory_order_relaxed);
+    }
+private:
+    std::mutex mutex;
+    int64_t samples[CAPACITY] = {};
+    size_t count = 0;
+    std::vector<int64_t> sorted;
+    std::atomic<int64_t> p95{0};
+};
+
+// 一个方法成功响应的负载统计，只记录可以直接测得的序列化大小
+// 平均大小为权重 1/16 的滑动平均，供自适应压缩判断
+class PayloadStats {
+public:
+    void record(const google::protobuf::MessageLite& response, CompressionAlgorithm accepted) {
+        size_t bytes = response.ByteSizeLong();
+        calls.fetch_add(1, std::memory_order_relaxed);
+        responseBytes.fetch_add(bytes, std::memory_order_relaxed);
+        if (CompressionAlgorithm::NONE != accepted) {
+            compressedCalls.fetch_add(1, std::memory_order_relaxed);
+        }
+        // 并发更新时可能丢失个别样本，不影响判断
+        double average = averageBytes.load(std::memory_order_relaxed);
+        averageBytes.store(0 == average ? bytes : average + (bytes - average) / 16, std::memory_order_relaxed);
+    }
+
+    // 该方法下一次调用应声明接受的算法
+    CompressionAlgorithm accept(const MethodPolicy& policy) const {
+        if (CompressionAlgorithm::NONE == policy.compression) {
+            return CompressionAlgorithm::NONE;
+        }
+        if (policy.compressAboveBytes > 0 && averageBytes.load(std::memory_order_relaxed) <= policy.compressAboveBytes) {
+            return CompressionAlgorithm::NONE;
+        }
+        return policy.compression;
+    }
+
+    PayloadCounters snapshot(const std::string& method) const {
+        PayloadCounters counters;
+        counters.method = method;
+        counters.calls = calls.load(std::memory_order_relaxed);
+        counters.compressedCalls = compressedCalls.load(std::memory_order_relaxed);
+        counters.responseBytes = responseBytes.load(std::memory_order_relaxed);
+        return counters;
+    }
+private:
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> compressedCalls{0};
+    std::atomic<uint64_t> responseBytes{0};
+    std::atomic<double> averageBytes{0};
+};
+
+struct MethodState {
+    LatencyWindow latency;
+    PayloadStats payload;
+    // 指向当前策略中该方法的条目，替换策略时整体切换
+    std::atomic<const MethodPolicy*> policy{nullptr};
+};
+
+// 客户端持有的策略及各方法的统计，策略可在运行中替换
+// 每个方法类型分到一个进程内唯一的槽位，首次访问后取状态和策略都不加锁
+class CallPolicyState {
+public:
+    static const size_t SLOT_COUNT = 64;
+
+    // 调用方以函数内 static 变量保存返回值
+    static size_t nextSlot() {
+        static std::atomic<size_t> next{0};
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 旧策略保留到对象销毁，在途调用读到的策略始终有效，因此策略只应偶尔替换
+    void set(CallPolicy policy) {
+        std::lock_guard<std::mutex> lock(methodsMutex);
+        policies.emplace_back(new CallPolicy(std::move(policy)));
+        for (const auto& method : methods) {
+            method.second->policy.store(&policies.back()->get(method.first.c_str()), std::memory_order_release);
+        }
+    }
+
+    // 返回的引用在对象生命周期内有效，slot 超出 SLOT_COUNT 时按名称查找
+    MethodState& method(size_t slot, const char* name) {
+        if (slot < SLOT_COUNT) {
+            MethodState* state = slots[slot].load(std::memory_order_acquire);
+            if (nullptr != state) {
+                return *state;
+            }
+        }
+        MethodState& state = method(name);
+        if (slot < SLOT_COUNT) {
+            slots[slot].store(&state, std::memory_order_release);
+        }
+        return state;
+    }
+
+    MethodState& method(const char* name) {
+        std::lock_guard<std::mutex> lock(methodsMutex);
+        auto it = methods.find(name);
+        if (it == methods.end()) {
+            it = methods.emplace(name, std::unique_ptr<MethodState>(new MethodState())).first;
+            it->second->policy.store(policies.empty() ? &defaultPolicy() : &policies.back()->get(name), std::memory_order_release);
+        }
+        return *it->second;
+    }
+
+    void payloadCounters(std::vector<PayloadCounters>& counters) {
+        std::lock_guard<std::mutex> lock(methodsMutex);
+        counters.clear();
+        for (const auto& method : methods) {
+            counters.push_back(method.second->payload.snapshot(method.first));
+        }
+    }
+private:
+    static const MethodPolicy& defaultPolicy() {
+        static const MethodPolicy policy;
+        return policy;
+    }
+
+    std::mutex methodsMutex;
+    std::vector<std::unique_ptr<const CallPolicy>> policies;
+    std::map<std::string, std::unique_ptr<MethodState>, std::less<>> methods;
+    std::atomic<MethodState*> slots[SLOT_COUNT] = {};
+};
+
+// 客户端的停止标志，重试退避等待可被 stop 立即唤醒
+class StopSignal {
+public:
+    bool load() const {
+        return stopped.load();
+    }
+
+    void store(bool value) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped.store(value);
+        }
+        cv.notify_all();
+    }
+
+    // 返回 true 表示等待期间已停止
+    bool waitFor(std::chrono::milliseconds duration) const {
+        std::unique_lock<std::mutex> lock(mutex);
+        return cv.wait_for(lock, duration, [this]() { return stopped.load(); });
+    }
+private:
+    std::atomic<bool> stopped{false};
+    mutable std::mutex mutex;
+    mutable std::condition_variable cv;
+};
+
+// 设置单次尝试的超时
+inline void applyPolicy(grpc::ClientContext* context, const MethodPolicy& policy) {
+    if (policy.deadlineMs > 0) {
+        context->set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(policy.deadlineMs));
+    }
+}
+
+inline bool isRetryableStatus(const grpc::Status& status) {
+    switch (status.error_code()) {
+    case grpc::StatusCode::UNAVAILABLE:
+    case grpc::StatusCode::DEADLINE_EXCEEDED:
+    case grpc::StatusCode::RESOURCE_EXHAUSTED:
+    case grpc::StatusCode::ABORTED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// 第 retry 次重试前的等待时间，full jitter
+inline int backoffMs(const MethodPolicy& policy, int retry) {
+    double ceiling = policy.initialBackoffMs * std::pow(policy.backoffMultiplier, retry - 1);
+    ceiling = std::min<double>(ceiling, policy.maxBackoffMs);
+    if (ceiling < 1) {
+        return 0;
+    }
+    static thread_local std::mt19937 rng(std::random_device{}());
+    return std::uniform_int_distribution<int>(0, static_cast<int>(ceiling) - 1)(rng);
+}
+
+// 按策略执行一次同步一元调用，call 与 prepare 形如
+//   [&](Stub& stub, grpc::ClientContext* context, Response* response) { return stub.Xxx(context, request, response); }
+//   [&](Stub& stub, grpc::ClientContext* context, grpc::CompletionQueue* cq) { return stub.PrepareAsyncXxx(context, request, cq); }
+// 不对冲时直接走阻塞调用，只有对冲需要本地 CompletionQueue 同时等待两个请求
+// 返回最后一次尝试的状态，status.ok() 时 response 有效
+template <typename Response, typename Stub, typename Call, typename Prepare>
+grpc::Status invokeWithPolicy(const StubHolder<Stub>& stubs, const MethodPolicy& policy, MethodState& state, const StopSignal& shouldStop, Call call, Prepare prepare, Response& response) {
+    int maxAttempts = std::max(1, policy.maxAttempts);
+    CompressionAlgorithm accept = state.payload.accept(policy);
+    if (!policy.hedge) {
+        grpc::Status status;
+        for (int attempt = 1; attempt <= maxAttempts; ++attempt) {
+            if (shouldStop.load()) {
+                return grpc::Status(grpc::StatusCode::CANCELLED, "client is stopping");
+            }
+            typename StubHolder<Stub>::Lease stub = stubs.load(accept);
+            if (nullptr == stub) {
+                return grpc::Status(grpc::StatusCode::UNAVAILABLE, "no address");
+            }
+            grpc::ClientContext context;
+            applyPolicy(&context, policy);
+            status = call(*stub, &context, &response);
+            if (status.ok()) {
+                state.payload.record(response, stub.accepted());
+                return status;
+            }
+            if (!isRetryableStatus(status) || attempt == maxAttempts) {
+                return status;
+            }
+            if (shouldStop.waitFor(std::chrono::milliseconds(backoffMs(policy, attempt)))) {
+                return grpc::Status(grpc::StatusCode::CANCELLED, "client is stopping");
+            }
+        }
+        return status;
+    }
+
+    struct Attempt {
+        typename StubHolder<Stub>::Lease stub;
+        grpc::ClientContext context;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> reader;
+        Response* response = nullptr;
+    };
+    auto start = [&prepare, &policy](Attempt& attempt, grpc::CompletionQueue* cq) {
+        applyPolicy(&attempt.context, policy);
+        attempt.reader = prepare(*attempt.stub, &attempt.context, cq);
+        attempt.reader->StartCall();
+        attempt.reader->Finish(attempt.response, &attempt.status, &attempt);
+    };
+
+    grpc::Status status;
+    for (int attempt = 1; attempt <= maxAttempts; ++attempt) {
+        if (shouldStop.load()) {
+            return grpc::Status(grpc::StatusCode::CANCELLED, "client is stopping");
+        }
+        Attempt primary;
+        primary.stub = stubs.load(accept);
+        if (nullptr == primary.stub) {
+            return grpc::Status(grpc::StatusCode::UNAVAILABLE, "no address");
+        }
+        primary.response = &response;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        grpc::CompletionQueue cq;
+        start(primary, &cq);
+
+        std::unique_ptr<Attempt> hedged;
+        std::unique_ptr<Response> hedgedOwner;
+        int pending = 1;
+        Attempt* winner = nullptr;
+        void* tag = nullptr;
+        bool ok = false;
+        int64_t hedgeDelayUs = policy.hedgeDelayMs > 0 ? policy.hedgeDelayMs * 1000LL : state.latency.p95Us();
+        if (hedgeDelayUs > 0) {
+            grpc::CompletionQueue::NextStatus next = cq.AsyncNext(&tag, &ok, std::chrono::system_clock::now() + std::chrono::microseconds(hedgeDelayUs));
+            if (grpc::CompletionQueue::GOT_EVENT == next) {
+                --pending;
+                winner = static_cast<Attempt*>(tag);
+            } else if (grpc::CompletionQueue::TIMEOUT == next) {
+                hedged.reset(new Attempt());
+                hedged->stub = stubs.loadOther(primary.stub.get(), accept);
+                if (nullptr != hedged->stub) {
+                    // 与调用方的响应同一个 Arena，无 Arena 时由 hedgedOwner 释放
+                    hedged->response = google::protobuf::Arena::CreateMessage<Response>(response.GetArena());
+                    if (nullptr == response.GetArena()) {
+                        hedgedOwner.reset(hedged->response);
+                    }
+                    start(*hedged, &cq);
+                    ++pending;
+                } else {
+                    hedged.reset();
+                }
+            }
+        }
+        // 取先成功的一个，全部失败时取最后完成的一个
+        while (nullptr == winner || (!winner->status.ok() && pending > 0)) {
+            if (!cq.Next(&tag, &ok)) {
+                break;
+            }
+            --pending;
+            winner = static_cast<Attempt*>(tag);
+        }
+        if (pending > 0) {
+            primary.context.TryCancel();
+            if (hedged) {
+                hedged->context.TryCancel();
+            }
+            while (pending > 0 && cq.Next(&tag, &ok)) {
+                --pending;
+            }
+        }
+        cq.Shutdown();
+        while (cq.Next(&tag, &ok)) {}
+
+        status = winner->status;
+        if (status.ok()) {
+            if (winner == hedged.get()) {
+                response.Swap(hedged->response);
+            }
+            state.latency.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+            state.payload.record(response, winner->stub.accepted());
+            return status;
+        }
+        if (!isRetryableStatus(status) || attempt == maxAttempts) {
+            return status;
+        }
+        if (shouldStop.waitFor(std::chrono::milliseconds(backoffMs(policy, attempt)))) {
+            return grpc::Status(grpc::StatusCode::CANCELLED, "client is stopping");
+        }
+    }
+    return status;
+}
+
+#endif /* _CALL_EXECUTOR_H_ */
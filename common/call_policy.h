@@ -0,0 +1,67 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     call_policy.h                                                   *
+*  @brief    客户端请求的超时、重试与对冲策略                                *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 每个客户端持有一份 CallPolicy，按方法名覆盖默认策略。           *
+*            超时针对单次尝试；重试只针对可重试的状态码，退避时间随机抖动；  *
+*            对冲在首个请求超过延迟阈值仍未返回时向另一个地址再发一次，      *
+*            先成功的结果生效，阈值默认取该方法最近延迟的 p95。              *
+*            gRPC 的响应压缩由服务端决定，客户端只能在 channel 上声明接受的  *
+*            算法，因此按方法的压缩策略实为把该方法路由到声明了对应算法的    *
+*            channel，见 StubHolder::load。                                  *
+*****************************************************************************/
+
+#ifndef _CALL_POLICY_H_
+#define _CALL_POLICY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+// 客户端声明接受的响应压缩算法，服务端开启压缩时从声明的算法中选择，请求本身不压缩
+enum class CompressionAlgorithm {
+    NONE,
+    DEFLATE,
+    GZIP,
+};
+
+struct MethodPolicy {
+    int deadlineMs = 0;             // 单次尝试的超时，0 表示不限
+    int maxAttempts = 1;            // 含首次请求
+    int initialBackoffMs = 10;      // 第 n 次重试前等待 [0, min(maxBackoffMs, initialBackoffMs * multiplier^(n-1))) 内的随机时间
+    int maxBackoffMs = 1000;
+    double backoffMultiplier = 2.0;
+    bool hedge = false;             // 仅用于幂等的查询类方法
+    int hedgeDelayMs = 0;           // 0 表示取最近延迟的 p95，样本不足时不对冲
+    // 不为 NONE 时该方法改走声明接受该算法的 channel；图像等已压缩的负载不应开启
+    CompressionAlgorithm compression = CompressionAlgorithm::NONE;
+    size_t compressAboveBytes = 0;  // 大于 0 时自适应：平均响应大小超过该值才改走接受压缩的 channel
+};
+
+// 按方法统计的成功响应，字节数为序列化后的消息大小
+// 压缩后的传输字节数在客户端拿不到，需在服务端或链路上测量
+struct PayloadCounters {
+    std::string method;
+    uint64_t calls = 0;
+    uint64_t compressedCalls = 0;   // 在接受压缩的 channel 上完成的调用，是否压缩由服务端决定
+    uint64_t responseBytes = 0;
+};
+
+struct CallPolicy {
+    MethodPolicy defaults;
+    std::map<std::string, MethodPolicy, std::less<>> methods;    // 方法名同客户端的接口名，如 getResultByImageId
+
+    const MethodPolicy& get(const char* method) const {
+        auto it = methods.find(method);
+        return it == methods.end() ? defaults : it->second;
+    }
+};
+
+#endif /* _CALL_POLICY_H_ */
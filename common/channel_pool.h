@@ -0,0 +1,83 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     channel_pool.h                                                  *
+*  @brief    进程内共享的 gRPC channel 注册表                                *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 同一地址、序号和接受算法的 channel 在各客户端实例间共享，       *
+*            不同序号使用独立的子通道池，即各自建立 TCP/HTTP2 连接。         *
+*            注册表只持有弱引用，没有客户端使用时连接随之释放。              *
+*            channel 都带 RpcRecorder 的录制拦截器，未录制时不生效。         *
+*            响应压缩由服务端的默认压缩级别决定，channel 只以                *
+*            grpc-accept-encoding 声明 identity 及 accept 指定的算法；       *
+*            accept 为 NONE 时服务端不会压缩响应，用于 JPEG 等已压缩的负载。 *
+*****************************************************************************/
+
+#ifndef _CHANNEL_POOL_H_
+#define _CHANNEL_POOL_H_
+
+#include "call_policy.h"
+#include "rpc_log.h"
+#include <grpc++/grpc++.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+class ChannelPool {
+public:
+    static ChannelPool& instance() {
+        static ChannelPool pool;
+        return pool;
+    }
+
+    // target 形如 ip:port，index 区分同一地址上的多条连接
+    std::shared_ptr<grpc::Channel> get(const std::string& target, int index = 0, CompressionAlgorithm accept = CompressionAlgorithm::NONE) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::tuple<std::string, int, CompressionAlgorithm> key(target, index, accept);
+        std::shared_ptr<grpc::Channel> channel = channels[key].lock();
+        if (channel) {
+            return channel;
+        }
+        grpc::ChannelArguments args;
+        if (index > 0) {
+            // 不同的参数使 gRPC 不复用已有子通道
+            args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+            args.SetInt("dai.channel_index", index);
+        }
+        // 以 grpc-accept-encoding 声明可接受的算法，服务端按其默认压缩级别从中选择；请求本身不压缩
+        uint32_t accepted = 1 << GRPC_COMPRESS_NONE;
+        if (CompressionAlgorithm::DEFLATE == accept) {
+            accepted |= 1 << GRPC_COMPRESS_DEFLATE;
+        } else if (CompressionAlgorithm::GZIP == accept) {
+            accepted |= 1 << GRPC_COMPRESS_GZIP;
+        }
+        args.SetInt(GRPC_COMPRESSION_CHANNEL_ENABLED_ALGORITHMS_BITSET, static_cast<int>(accepted));
+        channel = grpc::experimental::CreateCustomChannelWithInterceptors(target, grpc::InsecureChannelCredentials(), args, RpcRecorder::interceptors());
+        channels[key] = channel;
+        return channel;
+    }
+
+    // 清理已释放的条目
+    void prune() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = channels.begin(); it != channels.end();) {
+            if (it->second.expired()) {
+                it = channels.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+private:
+    ChannelPool() = default;
+
+    std::mutex mutex;
+    std::map<std::tuple<std::string, int, CompressionAlgorithm>, std::weak_ptr<grpc::Channel>> channels;
+};
+
+#endif /* _CHANNEL_POOL_H_ */
@@ -0,0 +1,252 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     grpc_client_base.h                                              *
+*  @brief    各服务客户端共用的连接、调用与统计流程                          *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 各客户端的 Impl 继承 GrpcClientBase<Service>，stub 的替换、     *
+*            调用策略、异步请求的跟踪、状态与响应码的检查、指标都在这里。    *
+*            服务与方法的差异以编译期特征给出，见 ServiceTraits、RpcMethod。 *
+*            响应码不为 200 时输出服务端消息，parse 只处理成功的响应。       *
+*****************************************************************************/
+
+#ifndef _GRPC_CLIENT_BASE_H_
+#define _GRPC_CLIENT_BASE_H_
+
+#include "async_rpc.h"
+#include "call_executor.h"
+#include "call_policy.h"
+#include "rpc_metrics.h"
+#include "stub_holder.h"
+#include "thread_arena.h"
+#include <grpc++/grpc++.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// 服务级特征，各客户端在自己的 cpp 中特化：
+//   template <> struct ServiceTraits<targetDetection::Communicate> {
+//       static constexpr const char* NAME = "target_detection";    // 指标中的客户端名
+//       static constexpr bool ACCEPT_COMPRESSION = true;           // 为 false 时忽略策略中的 compression
+//   };
+template <typename Service>
+struct ServiceTraits;
+
+// 方法级特征，各客户端为每个方法派生一个类型并给出 NAME：
+//   struct LoadModel: RpcMethod<Stub, LoadModelRequest, LoadModelResponse, &Stub::loadModel, &Stub::PrepareAsyncloadModel> {
+//       static constexpr const char* NAME = "loadModel";           // 调用策略与负载统计的键
+//       static constexpr bool IDEMPOTENT = false;
+//   };
+// 同一个 RPC 按不同用途配置策略时可派生多个类型
+template <typename Stub, typename RequestType, typename ResponseType,
+          grpc::Status (Stub::*CALL)(grpc::ClientContext*, const RequestType&, ResponseType*),
+          std::unique_ptr<grpc::ClientAsyncResponseReader<ResponseType>> (Stub::*PREPARE)(grpc::ClientContext*, const RequestType&, grpc::CompletionQueue*)>
+struct RpcMethod {
+    using Request = RequestType;
+    using Response = ResponseType;
+    // 非幂等的方法即使策略开启也不对冲
+    static constexpr bool IDEMPOTENT = true;
+
+    static grpc::Status call(Stub& stub, grpc::ClientContext* context, const Request& request, Response* response) {
+        return (stub.*CALL)(context, request, response);
+    }
+
+    static std::unique_ptr<grpc::ClientAsyncResponseReader<Response>> prepare(Stub& stub, grpc::ClientContext* context, const Request& request, grpc::CompletionQueue* cq) {
+        return (stub.*PREPARE)(context, request, cq);
+    }
+};
+
+template <typename Service>
+class GrpcClientBase {
+public:
+    using Stub = typename Service::Stub;
+    using Traits = ServiceTraits<Service>;
+
+    StubHolder<Stub> stub;
+    CallPolicyState policy;
+    StopSignal shouldStop;
+    AsyncCallTracker asyncCalls;
+
+    // 调用方以函数内 static 变量保存返回值，只注册一次
+    static int metric(const char* method) {
+        return RpcMetrics::method(Traits::NAME, method);
+    }
+
+    // 原子替换，在途请求持有旧 stub 继续在旧连接上完成，之后旧连接随最后一个引用释放
+    bool connect(const std::string& ip, int port) {
+        if (shouldStop.load()) return false;
+        return stub.template connect<Service>({ip + ":" + std::to_string(port)}, 1, LoadBalancePolicy::ROUND_ROBIN, Traits::ACCEPT_COMPRESSION);
+    }
+
+    bool connect(const std::vector<std::string>& addresses, int channelsPerAddress, bool leastOutstanding) {
+        if (shouldStop.load()) return false;
+        LoadBalancePolicy balance = leastOutstanding ? LoadBalancePolicy::LEAST_OUTSTANDING : LoadBalancePolicy::ROUND_ROBIN;
+        return stub.template connect<Service>(addresses, channelsPerAddress, balance, Traits::ACCEPT_COMPRESSION);
+    }
+
+    bool setCallPolicy(CallPolicy callPolicy) {
+        if (shouldStop.load()) return false;
+        policy.set(std::move(callPolicy));
+        return true;
+    }
+
+    bool getPayloadCounters(std::vector<PayloadCounters>& counters) {
+        policy.payloadCounters(counters);
+        return true;
+    }
+
+    // 拒绝新请求，取消并等待在途的异步请求，之后释放连接
+    void stop() {
+        shouldStop.store(true);
+        asyncCalls.cancelAndWait();
+        stub.reset();
+    }
+
+    static void printStatus(const grpc::Status& status) {
+        // TODO 以后改成日志
+        std::cout << "Error: " << status.error_code() << ": " << status.error_message() << std::endl;
+    }
+
+    // 各服务的响应都带 CustomResponse
+    template <typename Response>
+    static bool checkResponse(const Response& response) {
+        if (200 != response.response().code()) {
+            // TODO 以后改成日志
+            std::cout << response.response().message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // 每个方法类型的状态按槽位缓存，不在每次调用时查找
+    template <typename Method>
+    MethodState& stateOf() {
+        static const size_t slot = CallPolicyState::nextSlot();
+        return policy.method(slot, Method::NAME);
+    }
+
+    template <typename Method>
+    static MethodPolicy policyOf(const MethodState& state) {
+        MethodPolicy methodPolicy = *state.policy.load(std::memory_order_acquire);
+        if (!Method::IDEMPOTENT) {
+            methodPolicy.hedge = false;
+        }
+        return methodPolicy;
+    }
+
+    // 按该方法的压缩策略取 stub，供自行发起异步调用的调用方使用
+    template <typename Method>
+    typename StubHolder<Stub>::Lease leaseFor() {
+        MethodState& state = stateOf<Method>();
+        return stub.load(state.payload.accept(*state.policy.load(std::memory_order_acquire)));
+    }
+
+    // 按策略同步调用，不检查状态和响应码，供需要自行划分计时阶段的调用方使用
+    template <typename Method>
+    grpc::Status invoke(const typename Method::Request& request, typename Method::Response& response) {
+        MethodState& state = stateOf<Method>();
+        return invokeWithPolicy(stub, policyOf<Method>(state), state, shouldStop,
+            [&request](Stub& stub, grpc::ClientContext* context, typename Method::Response* response) {
+                return Method::call(stub, context, request, response);
+            },
+            [&request](Stub& stub, grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+                return Method::prepare(stub, context, request, cq);
+            },
+            response);
+    }
+
+    // 同步调用，请求和响应分配在线程的 Arena 上
+    // fill(Request&) 填写请求，parse(const Response&) 只在状态和响应码都正常时调用
+    template <typename Method, typename Fill, typename Parse>
+    bool call(int metric, Fill fill, Parse parse) {
+        if (shouldStop.load()) return false;
+        RpcCallTimer timer(metric);
+        ScopedArena arena;
+        typename Method::Request& request = *arena.create<typename Method::Request>();
+        typename Method::Response& response = *arena.create<typename Method::Response>();
+        fill(request);
+        timer.request(request);
+        grpc::Status status = invoke<Method>(request, response);
+        timer.response(response);
+        if (!status.ok()) {
+            printStatus(status);
+            return timer.finish(false);
+        }
+        if (!checkResponse(response)) {
+            return timer.finish(false);
+        }
+        bool ok = parse(response);
+        timer.lap(RPC_PHASE_PARSE);
+        return timer.finish(ok);
+    }
+
+    // 异步调用，parse 在轮询线程中执行，其引用的输出须在 future 就绪前保持有效
+    template <typename Method, typename Fill, typename Parse>
+    std::future<bool> callAsync(int metric, Fill fill, Parse parse) {
+        if (shouldStop.load()) return makeReadyFuture(false);
+        return completionFuture([&](std::function<void(bool)> complete) {
+            callAsync<Method>(metric, std::move(fill), std::move(parse), std::move(complete));
+        });
+    }
+
+    // 同上，完成时调用 complete(bool)，未能发起时在调用线程中同步调用
+    template <typename Method, typename Fill, typename Parse, typename Complete>
+    void callAsync(int metric, Fill fill, Parse parse, Complete complete) {
+        if (shouldStop.load()) {
+            complete(false);
+            return;
+        }
+        typename StubHolder<Stub>::Lease current = leaseFor<Method>();
+        if (nullptr == current) {
+            complete(false);
+            return;
+        }
+        typename Method::Request request;
+        fill(request);
+        startCall<Method>(metric, current, request, std::move(parse), std::move(complete));
+    }
+
+    // 在指定的 stub 上发起一次异步调用，complete(bool) 在记录指标后调用
+    // tracker 已关闭时以 CANCELLED 状态同步完成
+    template <typename Method, typename Parse, typename Complete>
+    void startCall(int metric, typename StubHolder<Stub>::Lease current, const typename Method::Request& request, Parse parse, Complete complete) {
+        RpcCallTimer timer(metric);
+        timer.request(request);
+        MethodState& state = stateOf<Method>();
+        MethodPolicy methodPolicy = policyOf<Method>(state);
+        PayloadStats* payload = &state.payload;
+        Stub* target = current.get();
+        CompressionAlgorithm accepted = current.accepted();
+        startAsyncCall<typename Method::Response>(std::move(current),
+            [target, &request, &methodPolicy](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+                applyPolicy(context, methodPolicy);
+                return Method::prepare(*target, context, request, cq);
+            },
+            [timer, payload, accepted, parse, complete](const grpc::Status& status, typename Method::Response& response) {
+                timer.response(response);
+                if (!status.ok()) {
+                    printStatus(status);
+                    complete(timer.finish(false));
+                    return;
+                }
+                payload->record(response, accepted);
+                if (!checkResponse(response)) {
+                    complete(timer.finish(false));
+                    return;
+                }
+                bool ok = parse(response);
+                timer.lap(RPC_PHASE_PARSE);
+                complete(timer.finish(ok));
+            },
+            &asyncCalls);
+    }
+};
+
+#endif /* _GRPC_CLIENT_BASE_H_ */
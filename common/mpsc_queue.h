@@ -0,0 +1,94 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     mpsc_queue.h                                                    *
+*  @brief    多生产者单消费者无锁环形队列                                      *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 容量向上取整为 2 的幂；push 可在任意线程调用，pop 只能在一个      *
+*            线程调用。每个槽位带序号，生产者之间只竞争写入位置。               *
+*****************************************************************************/
+
+#ifndef _MPSC_QUEUE_H_
+#define _MPSC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+template <typename T>
+class MpscQueue {
+public:
+    explicit MpscQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // 队列满时返回 false
+    bool push(T value) {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[tail & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(tail);
+            if (0 == diff) {
+                if (tailIndex.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                tail = tailIndex.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 队列空或队首仍在写入时返回 false
+    bool pop(T& value) {
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        Slot& slot = slots[head & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != head + 1) {
+            return false;
+        }
+        value = std::move(slot.value);
+        slot.sequence.store(head + mask + 1, std::memory_order_release);
+        headIndex.store(head + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 近似值，仅供判断是否需要唤醒消费者
+    size_t size() const {
+        size_t tail = tailIndex.load(std::memory_order_relaxed);
+        size_t head = headIndex.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+private:
+    struct Slot {
+        std::atomic<size_t> sequence{0};
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> headIndex{0};
+    alignas(64) std::atomic<size_t> tailIndex{0};
+};
+
+#endif /* _MPSC_QUEUE_H_ */
@@ -0,0 +1,419 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     rpc_log.h                                                       *
+*  @brief    RPC 请求/响应的录制日志及客户端录制拦截器                         *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 日志以 8 字节文件头 DAIRPCv1 开始，之后每条记录为 varint32      *
+*            长度加一条 protobuf 消息，只追加不修改。消息结构等同于          *
+*              message RpcLogRecord {                                        *
+*                  string method = 1;        // /包名.服务名/方法名          *
+*                  bytes request = 2;                                        *
+*                  bytes response = 3;                                       *
+*                  int64 start_ns = 4;       // 发起时刻，system_clock       *
+*                  int64 duration_ns = 5;    // 发起到收到状态               *
+*                  int32 status_code = 6;                                    *
+*              }                                                             *
+*            ChannelPool 创建的 channel 都带录制拦截器，未录制时拦截器工厂   *
+*            返回 nullptr，请求路径上只多一次原子读。                        *
+*            写入进程崩溃时最后一条记录可能不完整，读取时忽略。              *
+*****************************************************************************/
+
+#ifndef _RPC_LOG_H_
+#define _RPC_LOG_H_
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/support/client_interceptor.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/message_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 读取时各字段指向日志内容，RpcLogReader 关闭前有效
+struct RpcLogRecord {
+    std::string_view method;
+    std::string_view request;
+    std::string_view response;
+    int64_t startNs = 0;
+    int64_t durationNs = 0;
+    int32_t statusCode = 0;
+};
+
+namespace rpc_log {
+
+static const char MAGIC[8] = {'D', 'A', 'I', 'R', 'P', 'C', 'v', '1'};
+
+enum Field {
+    FIELD_METHOD = 1,
+    FIELD_REQUEST = 2,
+    FIELD_RESPONSE = 3,
+    FIELD_START_NS = 4,
+    FIELD_DURATION_NS = 5,
+    FIELD_STATUS_CODE = 6,
+};
+
+inline void writeBytes(google::protobuf::io::CodedOutputStream& output, int field, std::string_view value) {
+    using google::protobuf::internal::WireFormatLite;
+    output.WriteTag(WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+    output.WriteVarint32(static_cast<uint32_t>(value.size()));
+    output.WriteRaw(value.data(), static_cast<int>(value.size()));
+}
+
+inline void writeVarint(google::protobuf::io::CodedOutputStream& output, int field, uint64_t value) {
+    using google::protobuf::internal::WireFormatLite;
+    if (0 == value) {
+        return;
+    }
+    output.WriteTag(WireFormatLite::MakeTag(field, WireFormatLite::WIRETYPE_VARINT));
+    output.WriteVarint64(value);
+}
+
+// 编码为长度前缀加消息体
+inline void encode(const RpcLogRecord& record, std::string& output) {
+    std::string body;
+    {
+        google::protobuf::io::StringOutputStream stream(&body);
+        google::protobuf::io::CodedOutputStream coded(&stream);
+        writeBytes(coded, FIELD_METHOD, record.method);
+        writeBytes(coded, FIELD_REQUEST, record.request);
+        writeBytes(coded, FIELD_RESPONSE, record.response);
+        writeVarint(coded, FIELD_START_NS, static_cast<uint64_t>(record.startNs));
+        writeVarint(coded, FIELD_DURATION_NS, static_cast<uint64_t>(record.durationNs));
+        writeVarint(coded, FIELD_STATUS_CODE, static_cast<uint64_t>(static_cast<int64_t>(record.statusCode)));
+    }
+    output.clear();
+    {
+        google::protobuf::io::StringOutputStream stream(&output);
+        google::protobuf::io::CodedOutputStream coded(&stream);
+        coded.WriteVarint32(static_cast<uint32_t>(body.size()));
+    }
+    output.append(body);
+}
+
+// 从 data 解码一条记录，返回消耗的字节数，0 表示数据不完整或损坏
+inline size_t decode(const char* data, size_t size, RpcLogRecord& record) {
+    using google::protobuf::internal::WireFormatLite;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    // 单条记录不超过 2GB，每条新建 CodedInputStream 以免触及总长度限制
+    google::protobuf::io::CodedInputStream prefix(bytes, static_cast<int>(std::min<size_t>(size, 10)));
+    uint32_t length = 0;
+    if (!prefix.ReadVarint32(&length)) {
+        return 0;
+    }
+    size_t headerSize = static_cast<size_t>(prefix.CurrentPosition());
+    if (size - headerSize < length) {
+        return 0;
+    }
+    record = RpcLogRecord();
+    const uint8_t* body = bytes + headerSize;
+    google::protobuf::io::CodedInputStream input(body, static_cast<int>(length));
+    while (uint32_t tag = input.ReadTag()) {
+        int field = WireFormatLite::GetTagFieldNumber(tag);
+        if (WireFormatLite::WIRETYPE_LENGTH_DELIMITED == WireFormatLite::GetTagWireType(tag) && field >= FIELD_METHOD && field <= FIELD_RESPONSE) {
+            uint32_t valueSize = 0;
+            if (!input.ReadVarint32(&valueSize)) {
+                return 0;
+            }
+            std::string_view value(reinterpret_cast<const char*>(body) + input.CurrentPosition(), valueSize);
+            if (!input.Skip(static_cast<int>(valueSize))) {
+                return 0;
+            }
+            if (FIELD_METHOD == field) record.method = value;
+            else if (FIELD_REQUEST == field) record.request = value;
+            else record.response = value;
+        } else if (WireFormatLite::WIRETYPE_VARINT == WireFormatLite::GetTagWireType(tag) && field >= FIELD_START_NS && field <= FIELD_STATUS_CODE) {
+            uint64_t value = 0;
+            if (!input.ReadVarint64(&value)) {
+                return 0;
+            }
+            if (FIELD_START_NS == field) record.startNs = static_cast<int64_t>(value);
+            else if (FIELD_DURATION_NS == field) record.durationNs = static_cast<int64_t>(value);
+            else record.statusCode = static_cast<int32_t>(value);
+        } else if (!WireFormatLite::SkipField(&input, tag)) {
+            return 0;
+        }
+    }
+    return headerSize + length;
+}
+
+} // namespace rpc_log
+
+// 多线程追加写入
+class RpcLogWriter {
+public:
+    ~RpcLogWriter() {
+        close();
+    }
+
+    // 文件已存在时在末尾追加，新文件先写文件头
+    bool open(const std::string& path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nullptr != file) {
+            return false;
+        }
+        file = std::fopen(path.c_str(), "ab");
+        if (nullptr == file) {
+            // TODO 以后改成日志
+            std::cout << "failed to open rpc log " << path << std::endl;
+            return false;
+        }
+        std::fseek(file, 0, SEEK_END);
+        if (0 == std::ftell(file)) {
+            std::fwrite(rpc_log::MAGIC, 1, sizeof(rpc_log::MAGIC), file);
+        }
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nullptr != file) {
+            std::fclose(file);
+            file = nullptr;
+        }
+    }
+
+    bool append(const RpcLogRecord& record) {
+        // 在锁外编码，锁内只做一次写入
+        static thread_local std::string buffer;
+        rpc_log::encode(record, buffer);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (nullptr == file) {
+            return false;
+        }
+        return buffer.size() == std::fwrite(buffer.data(), 1, buffer.size(), file);
+    }
+private:
+    std::mutex mutex;
+    FILE* file = nullptr;
+};
+
+// 顺序读取，useMmap 为 false 时整个文件读入内存
+class RpcLogReader {
+public:
+    ~RpcLogReader() {
+        close();
+    }
+
+    bool open(const std::string& path, bool useMmap = true) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            // TODO 以后改成日志
+            std::cout << "failed to open rpc log " << path << std::endl;
+            return false;
+        }
+        struct stat st;
+        if (0 != ::fstat(fd, &st) || static_cast<size_t>(st.st_size) < sizeof(rpc_log::MAGIC)) {
+            ::close(fd);
+            std::cout << "invalid rpc log " << path << std::endl;
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (useMmap) {
+            void* address = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED == address) {
+                ::close(fd);
+                size = 0;
+                std::cout << "failed to mmap rpc log " << path << std::endl;
+                return false;
+            }
+            ::madvise(address, size, MADV_SEQUENTIAL);
+            mapping = address;
+            data = static_cast<const char*>(address);
+        } else {
+            buffer.resize(size);
+            size_t loaded = 0;
+            while (loaded < size) {
+                ssize_t n = ::read(fd, &buffer[loaded], size - loaded);
+                if (n <= 0) {
+                    break;
+                }
+                loaded += static_cast<size_t>(n);
+            }
+            size = loaded;
+            data = buffer.data();
+        }
+        ::close(fd);
+        if (0 != std::memcmp(data, rpc_log::MAGIC, sizeof(rpc_log::MAGIC))) {
+            std::cout << "invalid rpc log " << path << std::endl;
+            close();
+            return false;
+        }
+        offset = sizeof(rpc_log::MAGIC);
+        return true;
+    }
+
+    void close() {
+        if (nullptr != mapping) {
+            ::munmap(mapping, size);
+            mapping = nullptr;
+        }
+        buffer.clear();
+        buffer.shrink_to_fit();
+        data = nullptr;
+        size = 0;
+        offset = 0;
+    }
+
+    // 返回 false 表示已读完，末尾不完整的记录被忽略
+    bool next(RpcLogRecord& record) {
+        if (nullptr == data || offset >= size) {
+            return false;
+        }
+        size_t consumed = rpc_log::decode(data + offset, size - offset, record);
+        if (0 == consumed) {
+            offset = size;
+            return false;
+        }
+        offset += consumed;
+        return true;
+    }
+
+    void rewind() {
+        offset = nullptr == data ? 0 : sizeof(rpc_log::MAGIC);
+    }
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    void* mapping = nullptr;
+    std::string buffer;
+};
+
+// 进程内的录制开关，开启后所有客户端新发起的一元请求写入同一个日志
+class RpcRecorder {
+public:
+    static RpcRecorder& instance() {
+        static RpcRecorder recorder;
+        return recorder;
+    }
+
+    bool start(const std::string& path) {
+        std::shared_ptr<RpcLogWriter> next = std::make_shared<RpcLogWriter>();
+        if (!next->open(path)) {
+            return false;
+        }
+        std::shared_ptr<RpcLogWriter> previous = std::atomic_exchange(&writer, next);
+        active.store(true);
+        if (nullptr != previous) {
+            previous->close();
+        }
+        return true;
+    }
+
+    // 在途请求完成时写入失败，不会阻塞
+    void stop() {
+        active.store(false);
+        std::shared_ptr<RpcLogWriter> previous = std::atomic_exchange(&writer, std::shared_ptr<RpcLogWriter>());
+        if (nullptr != previous) {
+            previous->close();
+        }
+    }
+
+    bool recording() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    std::shared_ptr<RpcLogWriter> currentWriter() const {
+        if (!active.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return std::atomic_load(&writer);
+    }
+
+    // ChannelPool 创建 channel 时使用
+    static std::vector<std::unique_ptr<grpc::experimental::ClientInterceptorFactoryInterface>> interceptors();
+private:
+    RpcRecorder() = default;
+
+    std::atomic<bool> active{false};
+    std::shared_ptr<RpcLogWriter> writer;
+};
+
+class RpcRecordInterceptor : public grpc::experimental::Interceptor {
+public:
+    RpcRecordInterceptor(std::shared_ptr<RpcLogWriter> writer, const char* method):
+        writer(std::move(writer)), method(method),
+        startNs(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()),
+        begin(std::chrono::steady_clock::now()) {}
+
+    void Intercept(grpc::experimental::InterceptorBatchMethods* methods) override {
+        using grpc::experimental::InterceptionHookPoints;
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::PRE_SEND_MESSAGE)) {
+            // 取序列化后的请求，gRPC 之后直接发送这份数据，不会重复序列化
+            grpc::ByteBuffer* buffer = methods->GetSerializedSendMessage();
+            std::vector<grpc::Slice> slices;
+            if (nullptr != buffer && buffer->Dump(&slices).ok()) {
+                for (const grpc::Slice& slice : slices) {
+                    request.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+                }
+            }
+        }
+        // 接收端只能取到反序列化后的消息，客户端都使用生成的 stub，消息类单继承自 MessageLite
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_MESSAGE)) {
+            const void* message = methods->GetRecvMessage();
+            if (nullptr != message) {
+                static_cast<const google::protobuf::MessageLite*>(message)->SerializeToString(&response);
+            }
+        }
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_STATUS)) {
+            RpcLogRecord record;
+            record.method = method;
+            record.request = request;
+            record.response = response;
+            record.startNs = startNs;
+            record.durationNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            record.statusCode = static_cast<int32_t>(methods->GetRecvStatus()->error_code());
+            writer->append(record);
+        }
+        methods->Proceed();
+    }
+private:
+    std::shared_ptr<RpcLogWriter> writer;
+    std::string method;
+    std::string request;
+    std::string response;
+    int64_t startNs;
+    std::chrono::steady_clock::time_point begin;
+};
+
+class RpcRecordInterceptorFactory : public grpc::experimental::ClientInterceptorFactoryInterface {
+public:
+    grpc::experimental::Interceptor* CreateClientInterceptor(grpc::experimental::ClientRpcInfo* info) override {
+        if (grpc::experimental::ClientRpcInfo::Type::UNARY != info->type()) {
+            return nullptr;
+        }
+        std::shared_ptr<RpcLogWriter> writer = RpcRecorder::instance().currentWriter();
+        if (nullptr == writer) {
+            return nullptr;
+        }
+        return new RpcRecordInterceptor(std::move(writer), info->method());
+    }
+};
+
+inline std::vector<std::unique_ptr<grpc::experimental::ClientInterceptorFactoryInterface>> RpcRecorder::interceptors() {
+    std::vector<std::unique_ptr<grpc::experimental::ClientInterceptorFactoryInterface>> factories;
+    factories.emplace_back(new RpcRecordInterceptorFactory());
+    return factories;
+}
+
+#endif /* _RPC_LOG_H_ */
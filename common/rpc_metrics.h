@@ -0,0 +1,470 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     rpc_metrics.h                                                   *
+*  @brief    各客户端 RPC 的调用次数、字节数与分阶段延迟统计                 *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 定义 DAI_GRPC_CLIENT_METRICS 时启用，否则全部接口为空实现。     *
+*            每个线程写自己的分片，不加锁、不争用缓存行，读取时汇总全部分片。*
+*            线程退出时分片并入累计后释放。                                  *
+*            延迟直方图按 2 的幂分段、每段 8 格，相对误差不超过 12.5%。      *
+*****************************************************************************/
+
+#ifndef _RPC_METRICS_H_
+#define _RPC_METRICS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#ifdef DAI_GRPC_CLIENT_METRICS
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#endif
+
+enum RpcPhase {
+    RPC_PHASE_TOTAL = 0,    // 整个方法调用
+    RPC_PHASE_NETWORK,      // 发出请求到收到响应，包含 gRPC 内部的 protobuf 反序列化
+    RPC_PHASE_PARSE,        // 响应转换为客户端的结果结构
+    RPC_PHASE_DECODE,       // 图像解码
+    RPC_PHASE_PREPROCESS,   // 解码后转换为模型输入
+    RPC_PHASE_COUNT,
+};
+
+inline const char* rpcPhaseName(int phase) {
+    static const char* names[RPC_PHASE_COUNT] = {"total", "network", "parse", "decode", "preprocess"};
+    return phase >= 0 && phase < RPC_PHASE_COUNT ? names[phase] : "unknown";
+}
+
+struct RpcHistogramSnapshot {
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;         // 超过约 18 分钟的值计入最后一格
+    static const int BUCKET_COUNT = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT;
+
+    uint64_t count = 0;
+    uint64_t sumNs = 0;
+    uint64_t maxNs = 0;
+    std::vector<uint64_t> buckets;
+
+    static int bucketOf(uint64_t ns) {
+        if (ns < static_cast<uint64_t>(SUB_COUNT)) {
+            return static_cast<int>(ns);
+        }
+        int exponent = 63 - __builtin_clzll(ns);
+        if (exponent >= MAX_BITS) {
+            return BUCKET_COUNT - 1;
+        }
+        return (exponent - SUB_BITS + 1) * SUB_COUNT + static_cast<int>((ns >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+    }
+
+    // 格的下界，单位纳秒
+    static uint64_t lowerBoundOf(int bucket) {
+        if (bucket < SUB_COUNT) {
+            return static_cast<uint64_t>(bucket);
+        }
+        int exponent = bucket / SUB_COUNT + SUB_BITS - 1;
+        uint64_t sub = static_cast<uint64_t>(bucket % SUB_COUNT);
+        return (static_cast<uint64_t>(SUB_COUNT) + sub) << (exponent - SUB_BITS);
+    }
+
+    double meanUs() const {
+        return count ? static_cast<double>(sumNs) / count / 1000.0 : 0;
+    }
+
+    // quantile 取 0 到 1，返回所在格的中点
+    double quantileUs(double quantile) const {
+        if (0 == count || buckets.empty()) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                uint64_t lower = lowerBoundOf(i);
+                uint64_t upper = i + 1 < BUCKET_COUNT ? lowerBoundOf(i + 1) : maxNs;
+                double mid = (static_cast<double>(lower) + static_cast<double>(std::max(lower, upper))) / 2.0;
+                return std::min(mid, static_cast<double>(maxNs)) / 1000.0;
+            }
+        }
+        return static_cast<double>(maxNs) / 1000.0;
+    }
+};
+
+struct RpcMethodSnapshot {
+    std::string client;
+    std::string method;
+    uint64_t calls = 0;
+    uint64_t errors = 0;
+    uint64_t requestBytes = 0;
+    uint64_t responseBytes = 0;
+    RpcHistogramSnapshot phases[RPC_PHASE_COUNT];
+};
+
+#ifdef DAI_GRPC_CLIENT_METRICS
+
+// 启用与未启用时类的定义不同，放在不同的内联命名空间中，避免混用时同名类定义不一致
+inline namespace rpc_metrics_enabled {
+
+class RpcMetrics {
+public:
+    static const int MAX_METHODS = 128;
+
+    // 不析构，进程退出时仍在运行的线程退出时还要归还分片
+    static RpcMetrics& instance() {
+        static RpcMetrics* metrics = new RpcMetrics();
+        return *metrics;
+    }
+
+    // 每个调用点注册一次，返回值作为后续记录的下标，超出上限时返回 -1
+    static int method(const char* client, const char* method) {
+        return instance().registerMethod(client, method);
+    }
+
+    void record(int method, int phase, uint64_t ns) {
+        MethodStats* stats = local(method);
+        if (nullptr == stats) {
+            return;
+        }
+        Histogram& histogram = stats->phases[phase];
+        bump(histogram.buckets[RpcHistogramSnapshot::bucketOf(ns)], 1);
+        bump(histogram.count, 1);
+        bump(histogram.sumNs, ns);
+        if (ns > histogram.maxNs.load(std::memory_order_relaxed)) {
+            histogram.maxNs.store(ns, std::memory_order_relaxed);
+        }
+    }
+
+    void recordCall(int method, bool ok, uint64_t requestBytes, uint64_t responseBytes) {
+        MethodStats* stats = local(method);
+        if (nullptr == stats) {
+            return;
+        }
+        bump(stats->calls, 1);
+        if (!ok) {
+            bump(stats->errors, 1);
+        }
+        bump(stats->requestBytes, requestBytes);
+        bump(stats->responseBytes, responseBytes);
+    }
+
+    // 汇总全部线程的分片，只包含有过调用的方法
+    std::vector<RpcMethodSnapshot> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<RpcMethodSnapshot> snapshots(names.size());
+        std::vector<bool> used(names.size(), false);
+        for (size_t m = 0; m < names.size(); ++m) {
+            snapshots[m].client = names[m].first;
+            snapshots[m].method = names[m].second;
+            for (RpcHistogramSnapshot& phase : snapshots[m].phases) {
+                phase.buckets.assign(RpcHistogramSnapshot::BUCKET_COUNT, 0);
+            }
+        }
+        for (const Shard* shard : shards) {
+            accumulate(*shard, snapshots, used);
+        }
+        accumulate(retired, snapshots, used);
+        std::vector<RpcMethodSnapshot> result;
+        for (size_t m = 0; m < snapshots.size(); ++m) {
+            if (used[m]) {
+                result.push_back(std::move(snapshots[m]));
+            }
+        }
+        return result;
+    }
+
+    // 每个方法一行，延迟单位微秒
+    std::string exportText() {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        for (const RpcMethodSnapshot& snapshot : this->snapshot()) {
+            out << snapshot.client << "." << snapshot.method
+                << " calls=" << snapshot.calls << " errors=" << snapshot.errors
+                << " req_bytes=" << snapshot.requestBytes << " resp_bytes=" << snapshot.responseBytes;
+            for (int p = 0; p < RPC_PHASE_COUNT; ++p) {
+                const RpcHistogramSnapshot& phase = snapshot.phases[p];
+                if (0 == phase.count) {
+                    continue;
+                }
+                out << " " << rpcPhaseName(p) << "{mean=" << phase.meanUs()
+                    << " p50=" << phase.quantileUs(0.5) << " p99=" << phase.quantileUs(0.99)
+                    << " p999=" << phase.quantileUs(0.999) << " max=" << phase.maxNs / 1000.0 << "}";
+            }
+            out << "\n";
+        }
+        return out.str();
+    }
+
+    // Prometheus 文本格式，延迟以 summary 输出，单位秒
+    std::string exportPrometheus() {
+        std::vector<RpcMethodSnapshot> snapshots = snapshot();
+        std::ostringstream out;
+        out << std::setprecision(9);
+        const char* counters[][2] = {
+            {"dai_grpc_client_calls_total", "RPC calls"},
+            {"dai_grpc_client_errors_total", "RPC calls that failed"},
+            {"dai_grpc_client_request_bytes_total", "Serialized request bytes"},
+            {"dai_grpc_client_response_bytes_total", "Serialized response bytes"},
+        };
+        for (int c = 0; c < 4; ++c) {
+            out << "# HELP " << counters[c][0] << " " << counters[c][1] << "\n";
+            out << "# TYPE " << counters[c][0] << " counter\n";
+            for (const RpcMethodSnapshot& snapshot : snapshots) {
+                uint64_t values[] = {snapshot.calls, snapshot.errors, snapshot.requestBytes, snapshot.responseBytes};
+                out << counters[c][0] << "{client=\"" << snapshot.client << "\",method=\"" << snapshot.method << "\"} " << values[c] << "\n";
+            }
+        }
+        const char* latency = "dai_grpc_client_latency_seconds";
+        const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+        out << "# HELP " << latency << " RPC latency by phase\n";
+        out << "# TYPE " << latency << " summary\n";
+        for (const RpcMethodSnapshot& snapshot : snapshots) {
+            for (int p = 0; p < RPC_PHASE_COUNT; ++p) {
+                const RpcHistogramSnapshot& phase = snapshot.phases[p];
+                if (0 == phase.count) {
+                    continue;
+                }
+                std::string labels = "client=\"" + snapshot.client + "\",method=\"" + snapshot.method + "\",phase=\"" + rpcPhaseName(p) + "\"";
+                for (double quantile : quantiles) {
+                    out << latency << "{" << labels << ",quantile=\"" << quantile << "\"} " << phase.quantileUs(quantile) / 1e6 << "\n";
+                }
+                out << latency << "_sum{" << labels << "} " << phase.sumNs / 1e9 << "\n";
+                out << latency << "_count{" << labels << "} " << phase.count << "\n";
+            }
+        }
+        return out.str();
+    }
+
+private:
+    struct Histogram {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sumNs{0};
+        std::atomic<uint64_t> maxNs{0};
+        std::atomic<uint64_t> buckets[RpcHistogramSnapshot::BUCKET_COUNT] = {};
+    };
+    struct MethodStats {
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> requestBytes{0};
+        std::atomic<uint64_t> responseBytes{0};
+        Histogram phases[RPC_PHASE_COUNT];
+    };
+    // 线程退出时分片并入 retired 后释放，计数不丢失，内存不随线程的创建销毁增长
+    struct Shard {
+        std::atomic<MethodStats*> methods[MAX_METHODS] = {};
+        ~Shard() {
+            for (std::atomic<MethodStats*>& stats : methods) {
+                delete stats.load();
+            }
+        }
+    };
+
+    struct ShardOwner {
+        Shard* shard = nullptr;
+        ~ShardOwner() {
+            if (shard) {
+                RpcMetrics::instance().retire(shard);
+            }
+        }
+    };
+
+    std::mutex mutex;
+    std::vector<std::pair<std::string, std::string>> names;
+    std::vector<Shard*> shards;
+    Shard retired;      // 已退出线程的累计，只在持有 mutex 时读写
+
+    RpcMetrics() = default;
+
+    int registerMethod(const char* client, const char* method) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (names[i].first == client && names[i].second == method) {
+                return static_cast<int>(i);
+            }
+        }
+        if (names.size() >= static_cast<size_t>(MAX_METHODS)) {
+            return -1;
+        }
+        names.emplace_back(client, method);
+        return static_cast<int>(names.size() - 1);
+    }
+
+    // 只有所属线程写入（retired 只在持有 mutex 时写入），读改写不需要原子指令
+    static void bump(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static void accumulate(const Shard& shard, std::vector<RpcMethodSnapshot>& snapshots, std::vector<bool>& used) {
+        for (size_t m = 0; m < snapshots.size(); ++m) {
+            const MethodStats* stats = shard.methods[m].load(std::memory_order_acquire);
+            if (nullptr == stats) {
+                continue;
+            }
+            used[m] = true;
+            RpcMethodSnapshot& snapshot = snapshots[m];
+            snapshot.calls += stats->calls.load(std::memory_order_relaxed);
+            snapshot.errors += stats->errors.load(std::memory_order_relaxed);
+            snapshot.requestBytes += stats->requestBytes.load(std::memory_order_relaxed);
+            snapshot.responseBytes += stats->responseBytes.load(std::memory_order_relaxed);
+            for (int p = 0; p < RPC_PHASE_COUNT; ++p) {
+                const Histogram& histogram = stats->phases[p];
+                RpcHistogramSnapshot& phase = snapshot.phases[p];
+                phase.count += histogram.count.load(std::memory_order_relaxed);
+                phase.sumNs += histogram.sumNs.load(std::memory_order_relaxed);
+                phase.maxNs = std::max(phase.maxNs, histogram.maxNs.load(std::memory_order_relaxed));
+                for (int b = 0; b < RpcHistogramSnapshot::BUCKET_COUNT; ++b) {
+                    phase.buckets[b] += histogram.buckets[b].load(std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    // 所属线程退出时调用，此后不会再有写入
+    void retire(Shard* shard) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int m = 0; m < MAX_METHODS; ++m) {
+            const MethodStats* stats = shard->methods[m].load(std::memory_order_relaxed);
+            if (nullptr == stats) {
+                continue;
+            }
+            MethodStats* total = retired.methods[m].load(std::memory_order_relaxed);
+            if (nullptr == total) {
+                total = new MethodStats();
+                retired.methods[m].store(total, std::memory_order_release);
+            }
+            bump(total->calls, stats->calls.load(std::memory_order_relaxed));
+            bump(total->errors, stats->errors.load(std::memory_order_relaxed));
+            bump(total->requestBytes, stats->requestBytes.load(std::memory_order_relaxed));
+            bump(total->responseBytes, stats->responseBytes.load(std::memory_order_relaxed));
+            for (int p = 0; p < RPC_PHASE_COUNT; ++p) {
+                const Histogram& from = stats->phases[p];
+                Histogram& to = total->phases[p];
+                bump(to.count, from.count.load(std::memory_order_relaxed));
+                bump(to.sumNs, from.sumNs.load(std::memory_order_relaxed));
+                to.maxNs.store(std::max(to.maxNs.load(std::memory_order_relaxed), from.maxNs.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+                for (int b = 0; b < RpcHistogramSnapshot::BUCKET_COUNT; ++b) {
+                    bump(to.buckets[b], from.buckets[b].load(std::memory_order_relaxed));
+                }
+            }
+        }
+        shards.erase(std::remove(shards.begin(), shards.end(), shard), shards.end());
+        delete shard;
+    }
+
+    // 当前线程的分片，方法的统计在首次记录时分配
+    MethodStats* local(int method) {
+        if (method < 0 || method >= MAX_METHODS) {
+            return nullptr;
+        }
+        thread_local ShardOwner owner;
+        Shard* shard = owner.shard;
+        if (nullptr == shard) {
+            shard = new Shard();
+            std::lock_guard<std::mutex> lock(mutex);
+            shards.push_back(shard);
+            owner.shard = shard;
+        }
+        MethodStats* stats = shard->methods[method].load(std::memory_order_relaxed);
+        if (nullptr == stats) {
+            stats = new MethodStats();
+            shard->methods[method].store(stats, std::memory_order_release);
+        }
+        return stats;
+    }
+};
+
+// 一次调用的计时，按值捕获进异步回调，记录接口为 const 以便在回调中使用
+class RpcCallTimer {
+public:
+    explicit RpcCallTimer(int method): method(method), start(now()), mark(start) {}
+
+    // 记录请求大小，并作为网络阶段的起点
+    template <typename Request>
+    void request(const Request& request) const {
+        requestBytes = request.ByteSizeLong();
+        mark = now();
+    }
+
+    // 收到响应，结束网络阶段
+    template <typename Response>
+    void response(const Response& response) const {
+        lap(RPC_PHASE_NETWORK);
+        responseBytes = response.ByteSizeLong();
+        mark = now();
+    }
+
+    // 开始新的阶段，此前的等待（如排队）不计入任何阶段
+    void begin() const {
+        mark = now();
+    }
+
+    // 记录从上一个阶段结束到现在的耗时
+    void lap(int phase) const {
+        int64_t current = now();
+        RpcMetrics::instance().record(method, phase, static_cast<uint64_t>(current - mark));
+        mark = current;
+    }
+
+    bool finish(bool ok) const {
+        RpcMetrics::instance().record(method, RPC_PHASE_TOTAL, static_cast<uint64_t>(now() - start));
+        RpcMetrics::instance().recordCall(method, ok, requestBytes, responseBytes);
+        return ok;
+    }
+
+private:
+    int method;
+    int64_t start;
+    mutable int64_t mark;
+    mutable uint64_t requestBytes = 0;
+    mutable uint64_t responseBytes = 0;
+
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+} // namespace rpc_metrics_enabled
+
+#else
+
+inline namespace rpc_metrics_disabled {
+
+class RpcMetrics {
+public:
+    static RpcMetrics& instance() {
+        static RpcMetrics metrics;
+        return metrics;
+    }
+    static constexpr int method(const char*, const char*) { return -1; }
+    void record(int, int, uint64_t) {}
+    void recordCall(int, bool, uint64_t, uint64_t) {}
+    std::vector<RpcMethodSnapshot> snapshot() { return std::vector<RpcMethodSnapshot>(); }
+    std::string exportText() { return std::string(); }
+    std::string exportPrometheus() { return std::string(); }
+};
+
+class RpcCallTimer {
+public:
+    explicit constexpr RpcCallTimer(int) {}
+    template <typename Request>
+    void request(const Request&) const {}
+    template <typename Response>
+    void response(const Response&) const {}
+    void begin() const {}
+    void lap(int) const {}
+    bool finish(bool ok) const { return ok; }
+};
+
+} // namespace rpc_metrics_disabled
+
+#endif
+
+#endif /* _RPC_METRICS_H_ */
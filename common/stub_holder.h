@@ -0,0 +1,279 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     stub_holder.h                                                   *
+*  @brief    可在运行中原子替换、可在多个连接间分摊请求的 gRPC stub          *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 调用方先 load 取得 Lease 再发起请求，请求期间旧 stub 及其       *
+*            channel 保持有效；替换后最后一个在途请求结束时旧连接随之释放。  *
+*            多个连接时按轮询或最少在途请求选择，在途数在 Lease 析构时减一， *
+*            选择过程不分配内存。                                            *
+*            每种接受的压缩算法各有一组连接，首次按该算法 load 时建立。      *
+*****************************************************************************/
+
+#ifndef _STUB_HOLDER_H_
+#define _STUB_HOLDER_H_
+
+#include "channel_pool.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class LoadBalancePolicy {
+    ROUND_ROBIN,
+    LEAST_OUTSTANDING,
+};
+
+template <typename Stub>
+class StubHolder {
+private:
+    struct Entry;
+    struct StubSet;
+public:
+    // 取得的 stub，持有期间所在的连接集合保持有效
+    // 最少在途请求策略下每个副本各计一次在途请求，析构时减一；复制只增减引用计数，不分配内存
+    class Lease {
+    public:
+        Lease() = default;
+
+        Lease(std::nullptr_t) {
+
+        }
+
+        Lease(const Lease& other): set(other.set), entry(other.entry), counted(other.counted) {
+            if (counted) {
+                entry->outstanding.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Lease(Lease&& other) noexcept: set(std::move(other.set)), entry(other.entry), counted(other.counted) {
+            other.entry = nullptr;
+            other.counted = false;
+        }
+
+        Lease& operator=(Lease other) noexcept {
+            std::swap(set, other.set);
+            std::swap(entry, other.entry);
+            std::swap(counted, other.counted);
+            return *this;
+        }
+
+        ~Lease() {
+            if (counted) {
+                entry->outstanding.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        Stub* get() const {
+            return nullptr == entry ? nullptr : entry->stub.get();
+        }
+
+        // 所在 channel 声明接受的响应压缩算法
+        CompressionAlgorithm accepted() const {
+            return nullptr == set ? CompressionAlgorithm::NONE : set->accept;
+        }
+
+        Stub* operator->() const {
+            return get();
+        }
+
+        Stub& operator*() const {
+            return *get();
+        }
+
+        explicit operator bool() const {
+            return nullptr != entry;
+        }
+
+        friend bool operator==(const Lease& lease, std::nullptr_t) {
+            return nullptr == lease.entry;
+        }
+
+        friend bool operator==(std::nullptr_t, const Lease& lease) {
+            return nullptr == lease.entry;
+        }
+
+        friend bool operator!=(const Lease& lease, std::nullptr_t) {
+            return nullptr != lease.entry;
+        }
+
+        friend bool operator!=(std::nullptr_t, const Lease& lease) {
+            return nullptr != lease.entry;
+        }
+    private:
+        friend class StubHolder;
+
+        Lease(std::shared_ptr<StubSet> set, Entry* entry, bool counted): set(std::move(set)), entry(entry), counted(counted) {
+            if (counted) {
+                this->entry->outstanding.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        std::shared_ptr<StubSet> set;
+        Entry* entry = nullptr;
+        bool counted = false;
+    };
+
+    // accept 不为 NONE 时从声明接受该算法的连接中选择，这组连接首次使用时建立
+    // connect 时不允许压缩或经 store 设置的 stub 忽略 accept
+    Lease load(CompressionAlgorithm accept = CompressionAlgorithm::NONE) const {
+        return pick(setFor(accept));
+    }
+
+    // 取一个与 current 不同地址的 stub，用于对冲请求；只有一个地址时退化为 load
+    Lease loadOther(const Stub* current, CompressionAlgorithm accept = CompressionAlgorithm::NONE) const {
+        std::shared_ptr<StubSet> set = setFor(accept);
+        if (nullptr == set || set->entries.empty()) {
+            return nullptr;
+        }
+        int currentTarget = -1;
+        for (const std::unique_ptr<Entry>& entry : set->entries) {
+            if (entry->stub.get() == current) {
+                currentTarget = entry->target;
+                break;
+            }
+        }
+        size_t start = set->next.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = 0; i < set->entries.size(); ++i) {
+            Entry* entry = set->entries[(start + i) % set->entries.size()].get();
+            if (entry->target != currentTarget) {
+                bool counted = LoadBalancePolicy::LEAST_OUTSTANDING == set->policy;
+                return Lease(std::move(set), entry, counted);
+            }
+        }
+        return pick(std::move(set));
+    }
+
+    void store(std::shared_ptr<Stub> next) {
+        std::shared_ptr<StubSet> set;
+        if (next) {
+            set = std::make_shared<StubSet>();
+            set->entries.emplace_back(new Entry());
+            set->entries[0]->stub = std::move(next);
+        }
+        std::atomic_store(&stubs, set);
+    }
+
+    // Service 为 protoc 生成的服务类，targets 形如 ip:port
+    // 每个地址建立 channelsPerTarget 条连接，连接由各客户端实例共享
+    // allowCompression 为 false 时 load 忽略 accept，始终不接受压缩的响应
+    template <typename Service>
+    bool connect(const std::vector<std::string>& targets, int channelsPerTarget, LoadBalancePolicy policy, bool allowCompression = true) {
+        if (targets.empty() || channelsPerTarget <= 0) {
+            return false;
+        }
+        ChannelPool::instance().prune();
+        std::shared_ptr<StubSet> set = std::make_shared<StubSet>();
+        set->policy = policy;
+        set->targets = targets;
+        set->channelsPerTarget = channelsPerTarget;
+        set->newStub = [](std::shared_ptr<grpc::Channel> channel) {
+            return std::shared_ptr<Stub>(Service::NewStub(std::move(channel)));
+        };
+        set->allowCompression = allowCompression;
+        set->build(CompressionAlgorithm::NONE);
+        std::atomic_store(&stubs, set);
+        return true;
+    }
+
+    void reset() {
+        store(nullptr);
+    }
+private:
+    struct Entry {
+        std::shared_ptr<Stub> stub;
+        int target = 0;                 // 所属地址在 targets 中的序号
+        std::atomic<int> outstanding{0};
+    };
+    struct StubSet {
+        std::vector<std::unique_ptr<Entry>> entries;
+        LoadBalancePolicy policy = LoadBalancePolicy::ROUND_ROBIN;
+        std::atomic<size_t> next{0};
+        CompressionAlgorithm accept = CompressionAlgorithm::NONE;
+        // 以下只在 connect 建立的 NONE 集合上设置，用于按需建立接受压缩的连接
+        std::vector<std::string> targets;
+        int channelsPerTarget = 0;
+        std::shared_ptr<Stub> (*newStub)(std::shared_ptr<grpc::Channel>) = nullptr;
+        bool allowCompression = false;
+        std::mutex variantsMutex;
+        std::shared_ptr<StubSet> variants[2];   // DEFLATE、GZIP
+
+        void build(CompressionAlgorithm algorithm) {
+            ChannelPool& pool = ChannelPool::instance();
+            accept = algorithm;
+            for (size_t t = 0; t < targets.size(); ++t) {
+                for (int i = 0; i < channelsPerTarget; ++i) {
+                    entries.emplace_back(new Entry());
+                    entries.back()->stub = newStub(pool.get(targets[t], i, algorithm));
+                    entries.back()->target = static_cast<int>(t);
+                }
+            }
+        }
+
+        // 首次使用时建立，之后不加锁
+        std::shared_ptr<StubSet> variant(CompressionAlgorithm algorithm) {
+            std::shared_ptr<StubSet>& slot = variants[CompressionAlgorithm::GZIP == algorithm ? 1 : 0];
+            std::shared_ptr<StubSet> existing = std::atomic_load(&slot);
+            if (nullptr != existing) {
+                return existing;
+            }
+            std::lock_guard<std::mutex> lock(variantsMutex);
+            existing = std::atomic_load(&slot);
+            if (nullptr != existing) {
+                return existing;
+            }
+            std::shared_ptr<StubSet> built = std::make_shared<StubSet>();
+            built->policy = policy;
+            built->targets = targets;
+            built->channelsPerTarget = channelsPerTarget;
+            built->newStub = newStub;
+            built->build(algorithm);
+            std::atomic_store(&slot, built);
+            return built;
+        }
+    };
+
+    std::shared_ptr<StubSet> setFor(CompressionAlgorithm accept) const {
+        std::shared_ptr<StubSet> set = std::atomic_load(&stubs);
+        if (nullptr == set || CompressionAlgorithm::NONE == accept || !set->allowCompression) {
+            return set;
+        }
+        return set->variant(accept);
+    }
+
+    static Lease pick(std::shared_ptr<StubSet> set) {
+        if (nullptr == set || set->entries.empty()) {
+            return nullptr;
+        }
+        if (1 == set->entries.size()) {
+            Entry* entry = set->entries[0].get();
+            return Lease(std::move(set), entry, false);
+        }
+        if (LoadBalancePolicy::ROUND_ROBIN == set->policy) {
+            size_t index = set->next.fetch_add(1, std::memory_order_relaxed) % set->entries.size();
+            Entry* entry = set->entries[index].get();
+            return Lease(std::move(set), entry, false);
+        }
+        // 从轮询位置开始找在途请求最少的连接，在途数相同时依次分摊
+        size_t start = set->next.fetch_add(1, std::memory_order_relaxed);
+        Entry* best = nullptr;
+        for (size_t i = 0; i < set->entries.size(); ++i) {
+            Entry* entry = set->entries[(start + i) % set->entries.size()].get();
+            if (nullptr == best || entry->outstanding.load(std::memory_order_relaxed) < best->outstanding.load(std::memory_order_relaxed)) {
+                best = entry;
+            }
+        }
+        return Lease(std::move(set), best, true);
+    }
+
+    std::shared_ptr<StubSet> stubs;
+};
+
+#endif /* _STUB_HOLDER_H_ */
@@ -0,0 +1,66 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     thread_arena.h                                                  *
+*  @brief    每线程复用的 protobuf Arena                                     *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 同步调用的请求与响应分配在本线程的 Arena 上，最外层作用域结束时 *
+*            Reset。Arena 以线程首次使用时在堆上分配的缓冲区为首块，消息不   *
+*            超过首块时稳态下不再向堆申请内存。                              *
+*            作用域内创建的消息在作用域结束后失效，不得保存其引用。          *
+*****************************************************************************/
+
+#ifndef _THREAD_ARENA_H_
+#define _THREAD_ARENA_H_
+
+#include <google/protobuf/arena.h>
+#include <cstddef>
+#include <memory>
+
+class ScopedArena {
+public:
+    // 首块大小，可容纳典型的检测/跟踪结果
+    static const size_t INITIAL_BLOCK_SIZE = 64 * 1024;
+
+    ScopedArena(): state(threadState()) {
+        ++state.depth;
+    }
+
+    ~ScopedArena() {
+        // 嵌套使用时只在最外层 Reset，避免释放外层仍在使用的消息
+        if (0 == --state.depth) {
+            state.arena.Reset();
+        }
+    }
+
+    ScopedArena(const ScopedArena&) = delete;
+    ScopedArena& operator=(const ScopedArena&) = delete;
+
+    template <typename Message>
+    Message* create() {
+        return google::protobuf::Arena::CreateMessage<Message>(&state.arena);
+    }
+private:
+    // 首块在堆上，TLS 中只有一个指针，不使用 Arena 的线程不占这 64 KiB
+    struct State {
+        std::unique_ptr<char[]> initialBlock;
+        google::protobuf::Arena arena;
+        int depth = 0;
+        State(): initialBlock(new char[INITIAL_BLOCK_SIZE]), arena(initialBlock.get(), INITIAL_BLOCK_SIZE) {}
+    };
+
+    static State& threadState() {
+        static thread_local std::unique_ptr<State> state;
+        if (nullptr == state) {
+            state.reset(new State());
+        }
+        return *state;
+    }
+
+    State& state;
+};
+
+#endif /* _THREAD_ARENA_H_ */
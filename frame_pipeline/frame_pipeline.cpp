@@ -0,0 +1,290 @@
+#include "frame_pipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+struct FramePipeline::Impl {
+    struct Frame {
+        uint64_t seq = 0;
+        int remaining = 0;
+        std::chrono::steady_clock::time_point pushedAt;
+        std::chrono::steady_clock::time_point stageBegin[STAGE_COUNT];
+        FrameRecord record;
+    };
+    using Dispatch = std::vector<std::pair<int, std::shared_ptr<Frame>>>;
+
+    ImageHarmonyClient* imageHarmonyClient = nullptr;
+    TargetDetectionClient* targetDetectionClient = nullptr;
+    TargetTrackingClient* targetTrackingClient = nullptr;
+    BehaviorRecognitionClient* behaviorRecognitionClient = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable doneCv;
+    std::condition_variable drained;
+    Options options;
+    RecordCallback callback;
+    bool running = false;
+    bool accepting = false;
+    uint64_t nextSeq = 0;
+    uint64_t nextEmit = 0;
+    size_t inFlight = 0;
+    // 已出队、正在锁外发起请求的批次数，stop 等其归零后才释放
+    int dispatching = 0;
+    Stats stats;
+    // 等待发起的帧与各阶段在途的请求数
+    std::deque<std::shared_ptr<Frame>> stageQueues[STAGE_COUNT];
+    int stageInFlight[STAGE_COUNT] = {};
+    // 全部阶段完成、等待输出的帧，按序号排列
+    std::map<uint64_t, std::shared_ptr<Frame>> done;
+    std::thread emitter;
+
+    bool enabled(int stage) const {
+        switch (stage) {
+        case FETCH: return nullptr != imageHarmonyClient;
+        case DETECT: return nullptr != targetDetectionClient;
+        case TRACK: return nullptr != targetTrackingClient;
+        case BEHAVIOR: return nullptr != behaviorRecognitionClient;
+        default: return false;
+        }
+    }
+
+    // 发起一个阶段的异步请求，完成时在轮询线程或解码线程中调用 onStageDone
+    // 各阶段只写 record 中属于自己的字段，无需加锁
+    void execute(int stage, const std::shared_ptr<Frame>& frame) {
+        FrameRecord& record = frame->record;
+        auto complete = [this, stage, frame](bool ok) {
+            onStageDone(stage, frame, ok);
+        };
+        switch (stage) {
+        case FETCH: {
+            ImageHarmonyClient::ImageInfo imageInfo = options.imageInfo;
+            imageInfo.imageId = record.imageId;
+            // 返回的 imageId 与请求的相同，写入临时变量后丢弃
+            std::shared_ptr<int64_t> imageId = std::make_shared<int64_t>(0);
+            imageHarmonyClient->getImageByImageIdAsync(imageInfo, *imageId, record.image, [imageId, complete](bool ok) {
+                complete(ok);
+            });
+            return;
+        }
+        case DETECT:
+            targetDetectionClient->getResultByImageIdAsync(record.imageId, record.detections, complete);
+            return;
+        case TRACK:
+            targetTrackingClient->getResultByImageIdAsync(record.imageId, record.tracks, complete);
+            return;
+        case BEHAVIOR: {
+            BehaviorRecognitionClient* client = behaviorRecognitionClient;
+            if (!options.informBehavior) {
+                client->getResultByImageIdAsync(record.imageId, record.behaviors, complete);
+                return;
+            }
+            client->informImageIdAsync(record.imageId, [client, frame, complete](bool ok) {
+                if (!ok) {
+                    complete(false);
+                    return;
+                }
+                client->getResultByImageIdAsync(frame->record.imageId, frame->record.behaviors, complete);
+            });
+            return;
+        }
+        default:
+            complete(false);
+            return;
+        }
+    }
+
+    static void account(StageStats& stageStats, bool ok, int64_t latencyUs) {
+        if (ok) {
+            ++stageStats.completed;
+        } else {
+            ++stageStats.failed;
+        }
+        stageStats.totalLatencyUs += latencyUs;
+        stageStats.maxLatencyUs = std::max(stageStats.maxLatencyUs, latencyUs);
+    }
+
+    // 调用方需持有 mutex
+    void finishStageLocked(const std::shared_ptr<Frame>& frame) {
+        if (--frame->remaining > 0) {
+            return;
+        }
+        frame->record.totalLatencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - frame->pushedAt).count();
+        bool ok = std::all_of(std::begin(frame->record.ok), std::end(frame->record.ok), [](bool stageOk) { return stageOk; });
+        account(stats.frames, ok, frame->record.totalLatencyUs);
+        done[frame->seq] = frame;
+        doneCv.notify_one();
+    }
+
+    // 在途请求数未达上限的阶段依次出队，调用方需持有 mutex，返回非空时须在锁外调用 dispatch
+    Dispatch takeReadyLocked(int stage) {
+        Dispatch ready;
+        while (stageInFlight[stage] < options.maxInFlightPerStage && !stageQueues[stage].empty()) {
+            ++stageInFlight[stage];
+            std::shared_ptr<Frame> frame = stageQueues[stage].front();
+            stageQueues[stage].pop_front();
+            frame->stageBegin[stage] = std::chrono::steady_clock::now();
+            ready.emplace_back(stage, std::move(frame));
+        }
+        if (!ready.empty()) {
+            ++dispatching;
+        }
+        return ready;
+    }
+
+    // 请求可能同步完成并重新进入 onStageDone，因此在锁外发起
+    void dispatch(Dispatch ready) {
+        for (auto& item : ready) {
+            execute(item.first, item.second);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (0 == --dispatching) {
+            drained.notify_all();
+        }
+    }
+
+    void onStageDone(int stage, const std::shared_ptr<Frame>& frame, bool ok) {
+        int64_t latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - frame->stageBegin[stage]).count();
+        frame->record.ok[stage] = ok;
+        frame->record.latencyUs[stage] = latencyUs;
+        Dispatch ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            account(stats.stages[stage], ok, latencyUs);
+            --stageInFlight[stage];
+            ready = takeReadyLocked(stage);
+            finishStageLocked(frame);
+        }
+        if (!ready.empty()) {
+            dispatch(std::move(ready));
+        }
+    }
+
+    void runEmitter() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            doneCv.wait(lock, [this]() {
+                if (done.empty()) {
+                    return !running;
+                }
+                return !options.ordered || done.begin()->first == nextEmit;
+            });
+            if (done.empty()) {
+                return;
+            }
+            auto it = done.begin();
+            std::shared_ptr<Frame> frame = it->second;
+            done.erase(it);
+            nextEmit = frame->seq + 1;
+            lock.unlock();
+
+            if (callback) {
+                callback(frame->record);
+            }
+
+            lock.lock();
+            --inFlight;
+            notFull.notify_one();
+            if (0 == inFlight) {
+                drained.notify_all();
+            }
+        }
+    }
+};
+
+FramePipeline::FramePipeline(ImageHarmonyClient* imageHarmonyClient, TargetDetectionClient* targetDetectionClient,
+                             TargetTrackingClient* targetTrackingClient, BehaviorRecognitionClient* behaviorRecognitionClient): pImpl(new Impl()) {
+    pImpl->imageHarmonyClient = imageHarmonyClient;
+    pImpl->targetDetectionClient = targetDetectionClient;
+    pImpl->targetTrackingClient = targetTrackingClient;
+    pImpl->behaviorRecognitionClient = behaviorRecognitionClient;
+}
+
+FramePipeline::~FramePipeline() {
+    stop();
+}
+
+bool FramePipeline::start(FramePipeline::Options options, FramePipeline::RecordCallback callback) {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    if (pImpl->running) {
+        return false;
+    }
+    if (options.maxInFlightPerStage <= 0 || options.maxInFlightFrames <= 0) {
+        return false;
+    }
+    pImpl->options = options;
+    pImpl->callback = callback;
+    pImpl->running = true;
+    pImpl->accepting = true;
+    pImpl->nextSeq = 0;
+    pImpl->nextEmit = 0;
+    pImpl->stats = Stats();
+    pImpl->emitter = std::thread(&Impl::runEmitter, pImpl.get());
+    return true;
+}
+
+bool FramePipeline::push(int64_t imageId) {
+    std::unique_lock<std::mutex> lock(pImpl->mutex);
+    pImpl->notFull.wait(lock, [this]() {
+        return !pImpl->accepting || pImpl->inFlight < static_cast<size_t>(pImpl->options.maxInFlightFrames);
+    });
+    if (!pImpl->accepting) {
+        return false;
+    }
+    std::shared_ptr<Impl::Frame> frame = std::make_shared<Impl::Frame>();
+    frame->seq = pImpl->nextSeq++;
+    frame->pushedAt = std::chrono::steady_clock::now();
+    frame->record.imageId = imageId;
+    ++pImpl->inFlight;
+    // 先计数再入队，避免某个阶段过早完成时误判整帧完成
+    frame->remaining = 1;
+    std::vector<Impl::Dispatch> ready;
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        if (!pImpl->enabled(stage)) {
+            frame->record.ok[stage] = true;
+            continue;
+        }
+        ++frame->remaining;
+        pImpl->stageQueues[stage].push_back(frame);
+        Impl::Dispatch stageReady = pImpl->takeReadyLocked(stage);
+        if (!stageReady.empty()) {
+            ready.push_back(std::move(stageReady));
+        }
+    }
+    pImpl->finishStageLocked(frame);
+    lock.unlock();
+    for (Impl::Dispatch& stageReady : ready) {
+        pImpl->dispatch(std::move(stageReady));
+    }
+    return true;
+}
+
+void FramePipeline::stop() {
+    {
+        std::unique_lock<std::mutex> lock(pImpl->mutex);
+        if (!pImpl->running) {
+            return;
+        }
+        pImpl->accepting = false;
+        pImpl->notFull.notify_all();
+        // 帧全部输出后各阶段已无在途请求，再等仍在锁外发起请求的线程返回
+        pImpl->drained.wait(lock, [this]() { return 0 == pImpl->inFlight && 0 == pImpl->dispatching; });
+        pImpl->running = false;
+    }
+    pImpl->doneCv.notify_all();
+    pImpl->emitter.join();
+}
+
+FramePipeline::Stats FramePipeline::getStats() {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    Stats snapshot = pImpl->stats;
+    snapshot.inFlightFrames = pImpl->inFlight;
+    return snapshot;
+}
@@ -0,0 +1,86 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     frame_pipeline.h                                                *
+*  @brief    串联取图、检测、跟踪、行为识别四个客户端的逐帧流水线            *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 同一帧的各阶段请求并发发出，每个阶段的在途请求数有上限。        *
+*            请求经各客户端的回调式异步接口发出，按阶段计数限流，            *
+*            不为在途请求占用线程；异步接口只受同名方法的超时约束，          *
+*            不重试、不对冲，取图不经过共享内存、帧缓存与预取。              *
+*            一帧的各阶段全部完成后合并为一条 FrameRecord 回调，             *
+*            可按 push 顺序或完成顺序输出。                                  *
+*****************************************************************************/
+
+#ifndef _FRAME_PIPELINE_H_
+#define _FRAME_PIPELINE_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "image_harmony_client.h"
+#include "target_detection_client.h"
+#include "target_tracking_client.h"
+#include "behavior_recognition_client.h"
+
+class FramePipeline {
+public:
+    enum Stage {
+        FETCH = 0,      // ImageHarmonyClient::getImageByImageId
+        DETECT,         // TargetDetectionClient::getResultByImageId
+        TRACK,          // TargetTrackingClient::getResultByImageId
+        BEHAVIOR,       // BehaviorRecognitionClient::informImageId + getResultByImageId
+        STAGE_COUNT,
+    };
+    struct Options {
+        ImageHarmonyClient::ImageInfo imageInfo;    // 取图参数，imageId 字段不使用
+        int maxInFlightPerStage = 4;                // 每个阶段同时在途的请求数
+        int maxInFlightFrames = 16;                 // 超过时 push 阻塞
+        bool ordered = true;                        // 按 push 顺序输出，否则按完成顺序
+        bool informBehavior = true;                 // 行为识别前先 informImageId
+    };
+    struct FrameRecord {
+        int64_t imageId = 0;
+        bool ok[STAGE_COUNT] = {};                  // 未启用的阶段视为成功
+        int64_t latencyUs[STAGE_COUNT] = {};
+        int64_t totalLatencyUs = 0;                 // 从 push 到全部阶段完成
+        cv::Mat image;
+        std::vector<TargetDetectionClient::Result> detections;
+        std::vector<TargetTrackingClient::Result> tracks;
+        std::vector<BehaviorRecognitionClient::Result> behaviors;
+    };
+    struct StageStats {
+        uint64_t completed = 0;
+        uint64_t failed = 0;
+        int64_t totalLatencyUs = 0;
+        int64_t maxLatencyUs = 0;
+        double meanLatencyUs() const { return completed + failed ? static_cast<double>(totalLatencyUs) / (completed + failed) : 0; }
+    };
+    struct Stats {
+        StageStats stages[STAGE_COUNT];
+        StageStats frames;                          // 整帧延迟
+        size_t inFlightFrames = 0;
+    };
+    using RecordCallback = std::function<void(FramePipeline::FrameRecord&)>;
+
+    // 传入 nullptr 的客户端对应阶段不执行，客户端须比流水线存活更久
+    FramePipeline(ImageHarmonyClient* imageHarmonyClient, TargetDetectionClient* targetDetectionClient,
+                  TargetTrackingClient* targetTrackingClient, BehaviorRecognitionClient* behaviorRecognitionClient);
+    ~FramePipeline();
+
+    // 回调在流水线的输出线程中执行，各阶段的请求在客户端共享的轮询线程上完成
+    bool start(FramePipeline::Options options, FramePipeline::RecordCallback callback);
+    // 在途帧数达到上限时阻塞，未启动或已停止时返回 false
+    bool push(int64_t imageId);
+    // 等待已 push 的帧全部输出后停止
+    void stop();
+    FramePipeline::Stats getStats();
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _FRAME_PIPELINE_H_ */
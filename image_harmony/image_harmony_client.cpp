@@ -1,175 +1,1053 @@
 #include "image_harmony_client.h"
+#include "image_harmony_shm.h"
+#include "image_harmony_frame_cache.h"
+#include "image_harmony_decode_pool.h"
+#include "image_harmony_preprocess.h"
+#include "spsc_queue.h"
+#include "grpc_client_base.h"
 #include <grpc++/grpc++.h>
 #include "image_harmony.grpc.pb.h"
 #include "image_harmony.pb.h"
 #include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-struct ImageHarmonyClient::Impl {
-    std::mutex stubMutex;
-    imageHarmony::Communicate::Stub* stub = nullptr;
+template <>
+struct ServiceTraits<imageHarmony::Communicate> {
+    static constexpr const char* NAME = "image_harmony";
+    // 图像已是 JPEG，不让服务端再压缩
+    static constexpr bool ACCEPT_COMPRESSION = false;
+};
+
+namespace {
+
+using Stub = imageHarmony::Communicate::Stub;
+
+struct ConnectImageLoader: RpcMethod<Stub, imageHarmony::ConnectImageLoaderRequest, imageHarmony::ConnectImageLoaderResponse, &Stub::connectImageLoader, &Stub::PrepareAsyncconnectImageLoader> {
+    static constexpr const char* NAME = "connectImageLoader";
+    static constexpr bool IDEMPOTENT = false;
+};
+
+struct DisconnectImageLoader: RpcMethod<Stub, imageHarmony::DisconnectImageLoaderRequest, imageHarmony::DisconnectImageLoaderResponse, &Stub::disconnectImageLoader, &Stub::PrepareAsyncdisconnectImageLoader> {
+    static constexpr const char* NAME = "disconnectImageLoader";
+    static constexpr bool IDEMPOTENT = false;
+};
+
+struct GetImage: RpcMethod<Stub, imageHarmony::GetImageByImageIdRequest, imageHarmony::GetImageByImageIdResponse, &Stub::getImageByImageId, &Stub::PrepareAsyncgetImageByImageId> {
+    static constexpr const char* NAME = "getImageByImageId";
+};
+
+// 同一个 RPC，只取元数据
+struct GetImageSize: GetImage {
+    static constexpr const char* NAME = "getImageSize";
+};
+
+} // namespace
+
+struct ImageHarmonyClient::Impl: GrpcClientBase<imageHarmony::Communicate> {
     int64_t connectionId = 0;
-    std::atomic<bool> shouldStop{false};
+    // 取图线程只读，setTransferPolicy 时整体替换
+    std::shared_ptr<const TransferPolicy> transferPolicy{std::make_shared<const TransferPolicy>()};
+    // 服务端与客户端是否在同一台机器上，setAddress 时更新
+    std::atomic<bool> colocated{false};
+    // 取图线程只读，setSharedMemory 时整体替换；已租出的帧持有旧映射直到释放
+    std::shared_ptr<ImageHarmonyShmRing> shmRing;
+    ImageHarmonyFrameCache frameCache;
+
+    // 预取：按请求序列提前发出后续帧的异步请求，解码在工作线程完成
+    struct PrefetchedFrame {
+        bool ready = false;
+        bool ok = false;
+        int64_t imageId = 0;
+        cv::Mat frame;
+        bool hasDeadline = false;   // 按 getImageByImageId 的超时发出时，取用方最多等到同一时刻
+        std::chrono::system_clock::time_point deadline;
+    };
+    struct PrefetchCall {
+        explicit PrefetchCall(int metric): timer(metric) {}
+        RpcCallTimer timer;
+        std::shared_ptr<PrefetchedFrame> target;
+        StubHolder<imageHarmony::Communicate::Stub>::Lease stub;
+        grpc::ClientContext context;
+        imageHarmony::GetImageByImageIdResponse response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<imageHarmony::GetImageByImageIdResponse>> reader;
+    };
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchCv;
+    PrefetchOptions prefetchOptions;
+    std::atomic<int> prefetchDepth{0};  // prefetchOptions.depth 的副本，取图时不加锁判断是否预取
+    PrefetchStats prefetchStats;
+    bool prefetchStarted = false;
+    int64_t lastImageId = 0;
+    std::unordered_map<ImageHarmonyFrameCache::Key, std::shared_ptr<PrefetchedFrame>, ImageHarmonyFrameCache::KeyHash> prefetched;
+    std::unordered_set<PrefetchCall*> prefetchCalls;
+    grpc::CompletionQueue prefetchQueue;
+    std::thread prefetchPoller;
+    ImageHarmonyDecodePool prefetchDecoder;
+    // decodeImageByImageId 使用的解码线程池，未启动时在调用线程解码
+    ImageHarmonyDecodePool decodePool;
+    // decodePool 未启动时 getImageByImageIdAsync 使用的解码线程，首次使用时启动
+    std::mutex asyncDecoderMutex;
+    ImageHarmonyDecodePool asyncDecoder;
+    bool asyncDecoderStarted = false;
+    // 取图线程只读，设置时整体替换
+    std::shared_ptr<const ImageHarmonyPreprocessor> preprocessor;
+
+    // 订阅：后台线程发现新帧后推送给回调或队列
+    std::mutex subscribeMutex;
+    std::thread subscriber;
+    std::atomic<bool> subscribing{false};
+    SubscribeOptions subscribeOptions;
+    DecodeCallback subscribeCallback;
+    // 订阅时整体替换，取帧方与订阅线程各自持有快照
+    std::shared_ptr<SpscQueue<DecodedImage>> subscribeQueue;
+    std::atomic<uint64_t> subscribedFrames{0};
+    std::atomic<uint64_t> subscribeDropped{0};
+    std::atomic<uint64_t> subscribePolls{0};
+
+    void runSubscriber();
+    void stopSubscriber();
+
+    void buildImageRequest(const ImageInfo& imageInfo, imageHarmony::GetImageByImageIdRequest& request);
+    // 解析与解码分别计入 timer 的 PARSE、DECODE 阶段
+    bool decodeImageResponse(const imageHarmony::GetImageByImageIdResponse& response, int64_t& imageIdOutput, cv::Mat& imageOutput, const RpcCallTimer& timer);
+    // 请求并解码一帧，knownId 非 0 且返回的 imageId 与之相同时不再解码
+    bool fetchImage(const ImageInfo& imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput, int64_t knownId = 0);
+
+    void startPrefetch(int workers);
+    void stopPrefetch();
+    void schedulePrefetch(const ImageInfo& imageInfo);
+    bool takePrefetched(const ImageInfo& imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput);
+    void finishPrefetch(PrefetchedFrame& target, bool ok, int64_t imageId, const cv::Mat& frame);
+    void pollPrefetch();
+    // 异步取图的解码交给 decodePool 或 asyncDecoder，不占用共享的轮询线程
+    bool submitAsyncDecode(ImageHarmonyDecodePool::Task task, ImageHarmonyDecodePool::Callback done);
+
+    static void buildMetaRequest(int64_t connectionId, const ImageInfo& imageInfo, imageHarmony::GetImageByImageIdRequest& request) {
+        request.set_connectionid(connectionId);
+        request.mutable_imagerequest()->set_imageid(imageInfo.imageId);
+        request.mutable_imagerequest()->set_noimagebuffer(true);
+        request.mutable_imagerequest()->set_expectedw(imageInfo.width);
+        request.mutable_imagerequest()->set_expectedh(imageInfo.height);
+    }
+
+    static bool parseMeta(const imageHarmony::GetImageByImageIdResponse& response, int64_t& imageIdOutput, int& width, int& height) {
+        if (!response.imageresponse().imageid()) {
+            std::cout << "image ID is 0" << std::endl;
+            return false;
+        }
+        imageIdOutput = response.imageresponse().imageid();
+        width = response.imageresponse().width();
+        height = response.imageresponse().height();
+        return true;
+    }
+
+    // 只请求图像元数据，不传输图像数据
+    bool getImageMeta(const ImageInfo& imageInfo, int64_t& imageIdOutput, int& width, int& height) {
+        static const int metric = Impl::metric("getImageSize");
+        int64_t connectionId = this->connectionId;
+        return call<GetImageSize>(metric,
+            [connectionId, &imageInfo](imageHarmony::GetImageByImageIdRequest& request) {
+                buildMetaRequest(connectionId, imageInfo, request);
+            },
+            [&imageIdOutput, &width, &height](const imageHarmony::GetImageByImageIdResponse& response) {
+                return parseMeta(response, imageIdOutput, width, height);
+            });
+    }
+
+    // 租用共享内存中的帧，尺寸或类型不符时放弃
+    static bool leaseSharedImage(ImageHarmonyShmRing& ring, int64_t imageId, int width, int height, cv::Mat& imageOutput) {
+        cv::Mat leased;
+        if (!ring.lease(imageId, leased)) {
+            return false;
+        }
+        if (leased.cols != width || leased.rows != height || CV_8UC3 != leased.type()) {
+            return false;
+        }
+        imageOutput = leased;
+        return true;
+    }
 };
 
-ImageHarmonyClient::ImageHarmonyClient(): pImpl(new Impl()) {
+// 无压缩传输使用的格式，服务端 imencode 仅做像素拷贝
+static const char* RAW_FORMAT = ".bmp";
 
+// 仅当 Mat 独占一块自行分配的连续内存时才允许复用，避免覆盖调用方仍在使用的帧或共享内存
+static void detachIfShared(cv::Mat& mat) {
+    if (mat.empty()) {
+        return;
+    }
+    if (nullptr == mat.u || nullptr != mat.allocator || mat.u->refcount > 1 || !mat.isContinuous()) {
+        mat.release();
+    }
 }
 
-ImageHarmonyClient::~ImageHarmonyClient() {
-    pImpl->shouldStop.store(true);
-    std::lock_guard<std::mutex> lock(pImpl->stubMutex);
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
+static ImageHarmonyFrameCache::Key cacheKeyOf(const ImageHarmonyClient::ImageInfo& imageInfo) {
+    ImageHarmonyFrameCache::Key key;
+    key.imageId = imageInfo.imageId;
+    key.width = imageInfo.width;
+    key.height = imageInfo.height;
+    key.format = imageInfo.format;
+    key.quality = imageInfo.quality;
+    return key;
+}
+
+static bool isLoopbackAddress(const std::string& ip) {
+    return "localhost" == ip || "::1" == ip || "[::1]" == ip || 0 == ip.compare(0, 4, "127.");
+}
+
+static bool shouldUseRawTransfer(const ImageHarmonyClient::TransferPolicy& policy, bool colocated) {
+    switch (policy.mode) {
+    case ImageHarmonyClient::TransferMode::RAW:
+        return true;
+    case ImageHarmonyClient::TransferMode::ENCODED:
+        return false;
+    case ImageHarmonyClient::TransferMode::AUTO:
+        break;
+    }
+    if (colocated) {
+        return true;
+    }
+    if (policy.bandwidthMbps <= 0 || policy.codecNsPerPixel <= 0 || policy.compressionRatio <= 1) {
+        return false;
     }
+    // 每像素 24 bit，带宽单位 Mbps 即 bit/us
+    double rawNsPerPixel = 24.0 * 1000.0 / policy.bandwidthMbps;
+    double encodedNsPerPixel = rawNsPerPixel / policy.compressionRatio + policy.codecNsPerPixel;
+    return rawNsPerPixel <= encodedNsPerPixel;
 }
 
-bool ImageHarmonyClient::setAddress(std::string ip, int port) {
-    if (pImpl->shouldStop.load()) return false;
-    // TODO 重置时未考虑线程安全
-    std::shared_ptr<grpc::ChannelInterface> channel = grpc::CreateChannel(ip + ":" + std::to_string(port), grpc::InsecureChannelCredentials());
-    std::unique_ptr<imageHarmony::Communicate::Stub> stubTmp = imageHarmony::Communicate::NewStub(channel);
-    // 重置
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
-    }
-    // unique_ptr 转为 普通指针
-    pImpl->stub = stubTmp.get();
-    stubTmp.release();
+template <typename T>
+static T readLittleEndian(const uint8_t* p) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(static_cast<T>(p[i]) << (8 * i));
+    }
+    return value;
+}
+
+// 解析无压缩的 BMP，直接按行跨度包装像素并翻转/转换为 BGR
+// 不是可识别的无压缩 BMP 时返回 false，由调用方回退到 imdecode
+static bool wrapRawBitmap(const std::string& buffer, cv::Mat& imageOutput) {
+    const size_t FILE_HEADER_SIZE = 14;
+    const size_t INFO_HEADER_SIZE = 40;
+    if (buffer.size() < FILE_HEADER_SIZE + INFO_HEADER_SIZE || 'B' != buffer[0] || 'M' != buffer[1]) {
+        return false;
+    }
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+    uint32_t pixelOffset = readLittleEndian<uint32_t>(bytes + 10);
+    uint32_t infoSize = readLittleEndian<uint32_t>(bytes + 14);
+    int32_t width = static_cast<int32_t>(readLittleEndian<uint32_t>(bytes + 18));
+    int32_t height = static_cast<int32_t>(readLittleEndian<uint32_t>(bytes + 22));
+    uint16_t bitCount = readLittleEndian<uint16_t>(bytes + 28);
+    uint32_t compression = readLittleEndian<uint32_t>(bytes + 30);
+    if (infoSize < INFO_HEADER_SIZE || 0 != compression || width <= 0 || 0 == height) {
+        return false;
+    }
+    int type = 0;
+    switch (bitCount) {
+    case 8: type = CV_8UC1; break;  // 仅接受灰度调色板，见下方检查
+    case 24: type = CV_8UC3; break;
+    case 32: type = CV_8UC4; break;
+    default: return false;
+    }
+    // BMP 高度为正表示自底向上存储
+    bool bottomUp = height > 0;
+    int rows = bottomUp ? height : -height;
+    size_t step = ((static_cast<size_t>(width) * bitCount + 31) / 32) * 4;
+    if (pixelOffset > buffer.size() || buffer.size() - pixelOffset < step * rows) {
+        return false;
+    }
+    if (CV_8UC1 == type) {
+        const uint8_t* palette = bytes + FILE_HEADER_SIZE + infoSize;
+        if (pixelOffset < FILE_HEADER_SIZE + infoSize + 256 * 4) {
+            return false;
+        }
+        for (int i = 0; i < 256; ++i) {
+            if (palette[i * 4] != i || palette[i * 4 + 1] != i || palette[i * 4 + 2] != i) {
+                return false;
+            }
+        }
+    }
+    cv::Mat pixels(rows, width, type, const_cast<uint8_t*>(bytes + pixelOffset), step);
+
+    if (CV_8UC3 == type) {
+        if (bottomUp) {
+            cv::flip(pixels, imageOutput, 0);
+        } else {
+            pixels.copyTo(imageOutput);
+        }
+    } else {
+        cv::cvtColor(pixels, imageOutput, CV_8UC1 == type ? cv::COLOR_GRAY2BGR : cv::COLOR_BGRA2BGR);
+        if (bottomUp) {
+            cv::flip(imageOutput, imageOutput, 0);
+        }
+    }
     return true;
 }
 
-bool ImageHarmonyClient::connectImageLoader(int64_t loaderArgsHash) {
-    if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
-        return false;
-    }
-    imageHarmony::ConnectImageLoaderRequest request;
-    imageHarmony::ConnectImageLoaderResponse response;
-    grpc::ClientContext context;
-    request.set_loaderargshash(loaderArgsHash);
-    grpc::Status status = pImpl->stub->connectImageLoader(&context, request, &response);
-    imageHarmony::CustomResponse customresponse = response.response();
-    int32_t code = customresponse.code();
-    if (200 != code) {
-        auto message = customresponse.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
+void ImageHarmonyClient::Impl::buildImageRequest(const ImageInfo& imageInfo, imageHarmony::GetImageByImageIdRequest& request) {
+    request.set_connectionid(connectionId);
+    request.mutable_imagerequest()->set_imageid(imageInfo.imageId);
+    if (shouldUseRawTransfer(*std::atomic_load(&transferPolicy), colocated.load())) {
+        request.mutable_imagerequest()->set_format(RAW_FORMAT);
+    } else {
+        request.mutable_imagerequest()->set_format(imageInfo.format);
+        request.mutable_imagerequest()->mutable_params()->Add(cv::IMWRITE_JPEG_QUALITY);
+        request.mutable_imagerequest()->mutable_params()->Add(imageInfo.quality);
+    }
+    request.mutable_imagerequest()->set_expectedw(imageInfo.width);
+    request.mutable_imagerequest()->set_expectedh(imageInfo.height);
+}
+
+bool ImageHarmonyClient::Impl::decodeImageResponse(const imageHarmony::GetImageByImageIdResponse& response, int64_t& imageIdOutput, cv::Mat& imageOutput, const RpcCallTimer& timer) {
+    timer.begin();
+    if (!checkResponse(response)) {
         return false;
     }
-    pImpl->connectionId = response.connectionid();
-    if (0 == pImpl->connectionId) {
+    
+    imageIdOutput = response.imageresponse().imageid();
+
+    if (!imageIdOutput) {
+        std::cout << "image ID is 0" << std::endl;
+        return false;
+    }
+
+    // 直接引用 protobuf 持有的字节，不做拷贝
+    const std::string& buffer = response.imageresponse().buffer();
+    if (buffer.empty()) {
+        std::cout << "image buffer is empty" << std::endl;
+        return false;
+    }
+
+    // 解码到调用方的 Mat 中，尺寸和类型不变时复用其内存
+    timer.lap(RPC_PHASE_PARSE);
+    detachIfShared(imageOutput);
+    if (!wrapRawBitmap(buffer, imageOutput)) {
+        cv::Mat encoded(1, static_cast<int>(buffer.size()), CV_8UC1, const_cast<char*>(buffer.data()));
+        cv::imdecode(encoded, cv::IMREAD_COLOR, &imageOutput);
+    }
+    timer.lap(RPC_PHASE_DECODE);
+    if (imageOutput.empty()) {
+        std::cout << "failed to decode image " << imageIdOutput << std::endl;
         return false;
     }
+
     return true;
 }
 
-bool ImageHarmonyClient::disconnectImageLoader() {
-    if (pImpl->shouldStop.load()) return false;
-    if (0 == pImpl->connectionId) {
+bool ImageHarmonyClient::Impl::fetchImage(const ImageInfo& imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput, int64_t knownId) {
+    static const int metric = Impl::metric("getImageByImageId");
+    RpcCallTimer timer(metric);
+    ScopedArena arena;
+    imageHarmony::GetImageByImageIdRequest& request = *arena.create<imageHarmony::GetImageByImageIdRequest>();
+    imageHarmony::GetImageByImageIdResponse& response = *arena.create<imageHarmony::GetImageByImageIdResponse>();
+
+    buildImageRequest(imageInfo, request);
+    timer.request(request);
+    // 解析与解码分阶段计时，不经过 call
+    grpc::Status status = invoke<GetImage>(request, response);
+    timer.response(response);
+    
+    if (!status.ok()) {
+        printStatus(status);
+        return timer.finish(false);
+    }
+    if (0 != knownId && knownId == response.imageresponse().imageid()) {
+        imageIdOutput = knownId;
+        return timer.finish(true);
+    }
+    return timer.finish(decodeImageResponse(response, imageIdOutput, imageOutput, timer));
+}
+
+void ImageHarmonyClient::Impl::startPrefetch(int workers) {
+    ImageHarmonyDecodePool::Options options;
+    options.workers = std::max(1, workers);
+    // 预取请求数不超过 depth，队列满时让轮询线程等待即可
+    options.queueCapacity = static_cast<size_t>(std::max(1, prefetchOptions.depth));
+    options.overflow = ImageHarmonyDecodePool::OverflowPolicy::BLOCK;
+    prefetchDecoder.start(options);
+    prefetchPoller = std::thread(&Impl::pollPrefetch, this);
+    prefetchStarted = true;
+}
+
+void ImageHarmonyClient::Impl::stopPrefetch() {
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        if (!prefetchStarted) {
+            return;
+        }
+        for (PrefetchCall* call : prefetchCalls) {
+            call->context.TryCancel();
+        }
+    }
+    // 取消的请求仍会从队列中返回，Next 返回 false 后轮询线程退出
+    prefetchQueue.Shutdown();
+    prefetchPoller.join();
+    prefetchDecoder.stop();
+    prefetchCv.notify_all();
+}
+
+void ImageHarmonyClient::Impl::schedulePrefetch(const ImageInfo& imageInfo) {
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    StubHolder<imageHarmony::Communicate::Stub>::Lease stub = this->stub.load();
+    if (shouldStop.load() || nullptr == stub) {
+        return;
+    }
+    // 从连续两次请求推断 imageId 的间隔
+    int64_t stride = imageInfo.imageId - lastImageId;
+    if (0 == lastImageId || stride <= 0) {
+        stride = std::max<int64_t>(1, prefetchOptions.step);
+    }
+    lastImageId = imageInfo.imageId;
+
+    // 已经越过的帧不会再被取用
+    for (auto it = prefetched.begin(); it != prefetched.end();) {
+        if (it->first.imageId < imageInfo.imageId) {
+            ++prefetchStats.wasted;
+            it = prefetched.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    static const int metric = Impl::metric("prefetch");
+    // 预取的帧会替代 getImageByImageId 的请求，沿用其超时
+    MethodPolicy policy = policyOf<GetImage>(stateOf<GetImage>());
+    ImageInfo next = imageInfo;
+    for (int i = 1; i <= prefetchOptions.depth; ++i) {
+        next.imageId = imageInfo.imageId + stride * i;
+        ImageHarmonyFrameCache::Key key = cacheKeyOf(next);
+        if (prefetched.count(key)) {
+            continue;
+        }
+        PrefetchCall* call = new PrefetchCall(metric);
+        call->stub = stub;
+        call->target = std::make_shared<PrefetchedFrame>();
+        applyPolicy(&call->context, policy);
+        if (policy.deadlineMs > 0) {
+            call->target->hasDeadline = true;
+            call->target->deadline = call->context.deadline();
+        }
+        prefetched[key] = call->target;
+        imageHarmony::GetImageByImageIdRequest request;
+        buildImageRequest(next, request);
+        call->timer.request(request);
+        call->reader = stub->PrepareAsyncgetImageByImageId(&call->context, request, &prefetchQueue);
+        call->reader->StartCall();
+        call->reader->Finish(&call->response, &call->status, call);
+        prefetchCalls.insert(call);
+        ++prefetchStats.issued;
+    }
+}
+
+bool ImageHarmonyClient::Impl::takePrefetched(const ImageInfo& imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput) {
+    std::unique_lock<std::mutex> lock(prefetchMutex);
+    auto it = prefetched.find(cacheKeyOf(imageInfo));
+    if (it == prefetched.end()) {
+        ++prefetchStats.misses;
+        return false;
+    }
+    std::shared_ptr<PrefetchedFrame> frame = it->second;
+    // 已发出但尚未完成时等待，仍比重新请求快；服务端停滞时最多等到请求的超时
+    auto done = [this, &frame]() { return frame->ready || shouldStop.load(); };
+    if (frame->hasDeadline) {
+        prefetchCv.wait_until(lock, frame->deadline, done);
+    } else {
+        prefetchCv.wait(lock, done);
+    }
+    prefetched.erase(cacheKeyOf(imageInfo));
+    if (!frame->ready || !frame->ok) {
+        ++prefetchStats.misses;
+        return false;
+    }
+    ++prefetchStats.hits;
+    imageIdOutput = frame->imageId;
+    imageOutput = frame->frame;
+    return true;
+}
+
+void ImageHarmonyClient::Impl::finishPrefetch(PrefetchedFrame& target, bool ok, int64_t imageId, const cv::Mat& frame) {
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        if (!ok) {
+            ++prefetchStats.failed;
+        }
+        target.ready = true;
+        target.ok = ok;
+        target.imageId = imageId;
+        target.frame = frame;
+    }
+    prefetchCv.notify_all();
+}
+
+void ImageHarmonyClient::Impl::pollPrefetch() {
+    void* tag = nullptr;
+    bool ok = false;
+    while (prefetchQueue.Next(&tag, &ok)) {
+        PrefetchCall* call = static_cast<PrefetchCall*>(tag);
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            prefetchCalls.erase(call);
+        }
+        call->timer.response(call->response);
+        if (!ok || !call->status.ok() || shouldStop.load()) {
+            call->timer.finish(false);
+            finishPrefetch(*call->target, false, 0, cv::Mat());
+            delete call;
+            continue;
+        }
+        // 解码放到工作线程，轮询线程只负责收包
+        std::shared_ptr<PrefetchCall> pending(call);
+        bool submitted = prefetchDecoder.submit(
+            [this, pending](int64_t& imageId, cv::Mat& frame) {
+                return pending->timer.finish(!shouldStop.load() && decodeImageResponse(pending->response, imageId, frame, pending->timer));
+            },
+            [this, pending](bool decoded, int64_t imageId, cv::Mat frame) {
+                finishPrefetch(*pending->target, decoded, imageId, frame);
+            });
+        if (!submitted) {
+            pending->timer.finish(false);
+            finishPrefetch(*pending->target, false, 0, cv::Mat());
+        }
+    }
+}
+
+bool ImageHarmonyClient::Impl::submitAsyncDecode(ImageHarmonyDecodePool::Task task, ImageHarmonyDecodePool::Callback done) {
+    if (decodePool.submit(task, done)) {
         return true;
     }
-    if (nullptr == pImpl->stub) {
+    {
+        std::lock_guard<std::mutex> lock(asyncDecoderMutex);
+        if (shouldStop.load()) {
+            return false;
+        }
+        if (!asyncDecoderStarted) {
+            ImageHarmonyDecodePool::Options options;
+            options.workers = 2;
+            options.queueCapacity = 64;
+            options.overflow = ImageHarmonyDecodePool::OverflowPolicy::BLOCK;
+            asyncDecoderStarted = asyncDecoder.start(options);
+        }
+    }
+    return asyncDecoder.submit(std::move(task), std::move(done));
+}
+
+void ImageHarmonyClient::Impl::runSubscriber() {
+    std::shared_ptr<SpscQueue<DecodedImage>> queue = std::atomic_load(&subscribeQueue);
+    int64_t lastId = 0;
+    ImageInfo latest = subscribeOptions.imageInfo;
+    latest.imageId = 0;
+    std::chrono::milliseconds interval(std::max(0, subscribeOptions.pollIntervalMs));
+    while (subscribing.load() && !shouldStop.load()) {
+        DecodedImage frame;
+        int width = 0;
+        int height = 0;
+        ++subscribePolls;
+        // imageId 为 0 时服务端返回最新一帧，需要图像时一次请求同时取回 imageId 与图像
+        bool ok = subscribeOptions.withImage ? fetchImage(latest, frame.imageId, frame.image, lastId) : getImageMeta(latest, frame.imageId, width, height);
+        if (!ok || frame.imageId == lastId) {
+            std::this_thread::sleep_for(interval);
+            continue;
+        }
+        lastId = frame.imageId;
+        frame.ok = true;
+        ++subscribedFrames;
+        if (subscribeCallback) {
+            subscribeCallback(frame);
+        } else if (!queue->push(frame)) {
+            // 消费方跟不上时丢弃最新帧，队列中的帧保持顺序
+            ++subscribeDropped;
+        }
+    }
+}
+
+void ImageHarmonyClient::Impl::stopSubscriber() {
+    std::lock_guard<std::mutex> lock(subscribeMutex);
+    subscribing.store(false);
+    if (subscriber.joinable()) {
+        subscriber.join();
+    }
+}
+
+ImageHarmonyClient::ImageHarmonyClient(): pImpl(new Impl()) {
+
+}
+
+ImageHarmonyClient::~ImageHarmonyClient() {
+    pImpl->stop();
+    pImpl->stopPrefetch();
+    pImpl->decodePool.stop();
+    pImpl->asyncDecoder.stop();
+    pImpl->stopSubscriber();
+}
+
+bool ImageHarmonyClient::setAddress(std::string ip, int port) {
+    if (!pImpl->connect(ip, port)) {
         return false;
     }
-    imageHarmony::DisconnectImageLoaderRequest request;
-    imageHarmony::DisconnectImageLoaderResponse response;
-    grpc::ClientContext context;
-    request.set_connectionid(pImpl->connectionId);
-    grpc::Status status = pImpl->stub->disconnectImageLoader(&context, request, &response);
-    imageHarmony::CustomResponse customResponse = response.response();
-    int32_t code = customResponse.code();
-    if (200 != code) {
-        auto message = customResponse.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
+    pImpl->colocated.store(isLoopbackAddress(ip));
+    return true;
+}
+
+bool ImageHarmonyClient::setAddresses(std::vector<std::string> addresses, int channelsPerAddress, bool leastOutstanding) {
+    if (!pImpl->connect(addresses, channelsPerAddress, leastOutstanding)) {
         return false;
     }
+    bool colocated = true;
+    for (const std::string& address : addresses) {
+        colocated = colocated && isLoopbackAddress(address.substr(0, address.rfind(':')));
+    }
+    pImpl->colocated.store(colocated);
+    return true;
+}
+
+bool ImageHarmonyClient::setCallPolicy(CallPolicy policy) {
+    return pImpl->setCallPolicy(std::move(policy));
+}
+
+bool ImageHarmonyClient::getPayloadCounters(std::vector<PayloadCounters>& counters) {
+    return pImpl->getPayloadCounters(counters);
+}
+
+bool ImageHarmonyClient::setTransferPolicy(ImageHarmonyClient::TransferPolicy policy) {
+    if (pImpl->shouldStop.load()) return false;
+    std::atomic_store(&pImpl->transferPolicy, std::make_shared<const TransferPolicy>(policy));
+    return true;
+}
+
+bool ImageHarmonyClient::setSharedMemory(std::string name) {
+    if (pImpl->shouldStop.load()) return false;
+    std::shared_ptr<ImageHarmonyShmRing> ring;
+    if (!name.empty()) {
+        ring = std::make_shared<ImageHarmonyShmRing>();
+        if (!ring->open(name)) {
+            return false;
+        }
+    }
+    std::atomic_store(&pImpl->shmRing, ring);
     return true;
 }
 
+bool ImageHarmonyClient::connectImageLoader(int64_t loaderArgsHash) {
+    if (pImpl->shouldStop.load()) return false;
+    static const int metric = Impl::metric("connectImageLoader");
+    Impl* impl = pImpl.get();
+    return pImpl->call<ConnectImageLoader>(metric,
+        [loaderArgsHash](imageHarmony::ConnectImageLoaderRequest& request) {
+            request.set_loaderargshash(loaderArgsHash);
+        },
+        [impl](const imageHarmony::ConnectImageLoaderResponse& response) {
+            impl->connectionId = response.connectionid();
+            return 0 != impl->connectionId;
+        });
+}
+
+bool ImageHarmonyClient::disconnectImageLoader() {
+    if (pImpl->shouldStop.load()) return false;
+    if (0 == pImpl->connectionId) {
+        return true;
+    }
+    static const int metric = Impl::metric("disconnectImageLoader");
+    int64_t connectionId = pImpl->connectionId;
+    return pImpl->call<DisconnectImageLoader>(metric,
+        [connectionId](imageHarmony::DisconnectImageLoaderRequest& request) {
+            request.set_connectionid(connectionId);
+        },
+        [](const imageHarmony::DisconnectImageLoaderResponse&) {
+            return true;
+        });
+}
+
 bool ImageHarmonyClient::getImageByImageId(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput) {
     if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
-    imageHarmony::GetImageByImageIdRequest request;
-    imageHarmony::GetImageByImageIdResponse response;
-    grpc::ClientContext context;
+    std::shared_ptr<ImageHarmonyShmRing> ring = std::atomic_load(&pImpl->shmRing);
+    if (nullptr != ring) {
+        // 共享内存模式：gRPC 只确认 imageId 和尺寸，图像直接引用映射内存
+        int64_t imageId = 0;
+        int width = 0;
+        int height = 0;
+        if (!pImpl->getImageMeta(imageInfo, imageId, width, height)) {
+            return false;
+        }
+        if (Impl::leaseSharedImage(*ring, imageId, width, height, imageOutput)) {
+            imageIdOutput = imageId;
+            return true;
+        }
+        // 槽位已被覆盖或尺寸不符，按已确认的 imageId 回退到 gRPC 传输
+        imageInfo.imageId = imageId;
+    }
+    if (0 != imageInfo.imageId && pImpl->prefetchDepth.load() > 0) {
+        cv::Mat frame;
+        // 先发出后续帧的请求，再取用本帧，避免等待本帧时流水线断流
+        pImpl->schedulePrefetch(imageInfo);
+        bool hit = pImpl->takePrefetched(imageInfo, imageIdOutput, frame);
+        if (hit) {
+            if (pImpl->frameCache.enabled()) {
+                pImpl->frameCache.put(cacheKeyOf(imageInfo), imageIdOutput, frame);
+                detachIfShared(imageOutput);
+                frame.copyTo(imageOutput);
+            } else {
+                imageOutput = frame;
+            }
+            return true;
+        }
+    }
+    if (0 != imageInfo.imageId && pImpl->frameCache.enabled()) {
+        cv::Mat frame;
+        bool ok = pImpl->frameCache.getOrLoad(cacheKeyOf(imageInfo), imageIdOutput, frame,
+            [this, &imageInfo](int64_t& imageId, cv::Mat& decoded) {
+                return pImpl->fetchImage(imageInfo, imageId, decoded);
+            });
+        if (!ok) {
+            return false;
+        }
+        // 缓存中的帧被多处共享，拷贝给调用方
+        detachIfShared(imageOutput);
+        frame.copyTo(imageOutput);
+        return true;
+    }
+    return pImpl->fetchImage(imageInfo, imageIdOutput, imageOutput);
+}
 
-    request.set_connectionid(pImpl->connectionId);
-    request.mutable_imagerequest()->set_imageid(imageInfo.imageId);
-    request.mutable_imagerequest()->set_format(imageInfo.format);
-    request.mutable_imagerequest()->mutable_params()->Add(cv::IMWRITE_JPEG_QUALITY);
-    request.mutable_imagerequest()->mutable_params()->Add(imageInfo.quality);
-    request.mutable_imagerequest()->set_expectedw(imageInfo.width);
-    request.mutable_imagerequest()->set_expectedh(imageInfo.height);
-    grpc::Status status = pImpl->stub->getImageByImageId(&context, request, &response);
-    
-    if (!status.ok()) {
-        std::cout << "Error: " << status.error_code() << ": " << status.error_message() << std::endl;
+bool ImageHarmonyClient::setDecodePool(ImageHarmonyClient::DecodePoolOptions options) {
+    if (pImpl->shouldStop.load()) return false;
+    pImpl->decodePool.stop();
+    if (options.workers <= 0) {
+        return true;
+    }
+    ImageHarmonyDecodePool::Options poolOptions;
+    poolOptions.workers = options.workers;
+    poolOptions.queueCapacity = options.queueCapacity;
+    poolOptions.overflow = options.dropOldest ? ImageHarmonyDecodePool::OverflowPolicy::DROP_OLDEST : ImageHarmonyDecodePool::OverflowPolicy::BLOCK;
+    return pImpl->decodePool.start(poolOptions);
+}
+
+bool ImageHarmonyClient::decodeImageByImageId(ImageHarmonyClient::ImageInfo imageInfo, ImageHarmonyClient::DecodeCallback callback) {
+    if (pImpl->shouldStop.load()) return false;
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
-    
-    auto customResponse = response.response();
-    if (200 != customResponse.code()) {
-        std::cout << customResponse.message() << std::endl;
+    static const int metric = Impl::metric("decodeImageByImageId");
+    RpcCallTimer timer(metric);
+    std::shared_ptr<imageHarmony::GetImageByImageIdResponse> response = std::make_shared<imageHarmony::GetImageByImageIdResponse>();
+    {
+        imageHarmony::GetImageByImageIdRequest request;
+        pImpl->buildImageRequest(imageInfo, request);
+        timer.request(request);
+        grpc::Status status = pImpl->invoke<GetImage>(request, *response);
+        timer.response(*response);
+        if (!status.ok()) {
+            Impl::printStatus(status);
+            return timer.finish(false);
+        }
+    }
+
+    Impl* impl = pImpl.get();
+    ImageHarmonyDecodePool::Task task = [impl, response, timer](int64_t& imageId, cv::Mat& image) {
+        return timer.finish(impl->decodeImageResponse(*response, imageId, image, timer));
+    };
+    ImageHarmonyDecodePool::Callback done = [callback](bool ok, int64_t imageId, cv::Mat image) {
+        DecodedImage decoded;
+        decoded.ok = ok;
+        decoded.imageId = imageId;
+        decoded.image = image;
+        callback(decoded);
+    };
+    if (pImpl->decodePool.submit(task, done)) {
+        return true;
+    }
+    // 未启用解码线程池时在调用线程解码
+    int64_t imageId = 0;
+    cv::Mat image;
+    bool ok = task(imageId, image);
+    done(ok, imageId, image);
+    return true;
+}
+
+std::future<ImageHarmonyClient::DecodedImage> ImageHarmonyClient::decodeImageByImageId(ImageHarmonyClient::ImageInfo imageInfo) {
+    std::shared_ptr<std::promise<DecodedImage>> promise = std::make_shared<std::promise<DecodedImage>>();
+    std::future<DecodedImage> future = promise->get_future();
+    bool submitted = decodeImageByImageId(imageInfo, [promise](DecodedImage decoded) {
+        promise->set_value(decoded);
+    });
+    if (!submitted) {
+        promise->set_value(DecodedImage());
+    }
+    return future;
+}
+
+ImageHarmonyClient::DecodePoolStats ImageHarmonyClient::getDecodePoolStats() {
+    ImageHarmonyDecodePool::Stats stats = pImpl->decodePool.getStats();
+    DecodePoolStats decodePoolStats;
+    decodePoolStats.submitted = stats.submitted;
+    decodePoolStats.decoded = stats.decoded;
+    decodePoolStats.failed = stats.failed;
+    decodePoolStats.dropped = stats.dropped;
+    decodePoolStats.queued = stats.queued;
+    return decodePoolStats;
+}
+
+bool ImageHarmonyClient::subscribe(ImageHarmonyClient::SubscribeOptions options, ImageHarmonyClient::DecodeCallback callback) {
+    if (pImpl->shouldStop.load()) return false;
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
-    
-    imageIdOutput = response.imageresponse().imageid();
+    pImpl->stopSubscriber();
+    std::lock_guard<std::mutex> lock(pImpl->subscribeMutex);
+    pImpl->subscribeOptions = options;
+    pImpl->subscribeCallback = callback;
+    std::atomic_store(&pImpl->subscribeQueue, std::make_shared<SpscQueue<DecodedImage>>(std::max<size_t>(1, options.queueCapacity)));
+    pImpl->subscribing.store(true);
+    pImpl->subscriber = std::thread(&Impl::runSubscriber, pImpl.get());
+    return true;
+}
 
-    if (!imageIdOutput) {
-        std::cout << "image ID is 0" << std::endl;
+bool ImageHarmonyClient::popSubscribedFrame(ImageHarmonyClient::DecodedImage& frame) {
+    std::shared_ptr<SpscQueue<DecodedImage>> queue = std::atomic_load(&pImpl->subscribeQueue);
+    if (nullptr == queue) {
         return false;
     }
+    return queue->pop(frame);
+}
 
-    std::string buffer = response.imageresponse().buffer();
-    std::vector<uint8_t> vecBuffer(buffer.begin(), buffer.end());
-    cv::Mat image = cv::imdecode(vecBuffer, cv::IMREAD_COLOR);
-    
-    imageOutput = image.clone();
-    
-    return true;
+void ImageHarmonyClient::unsubscribe() {
+    pImpl->stopSubscriber();
+}
+
+ImageHarmonyClient::SubscribeStats ImageHarmonyClient::getSubscribeStats() {
+    SubscribeStats stats;
+    stats.frames = pImpl->subscribedFrames.load();
+    stats.dropped = pImpl->subscribeDropped.load();
+    stats.polls = pImpl->subscribePolls.load();
+    return stats;
 }
 
 bool ImageHarmonyClient::getImageSize(ImageHarmonyClient::ImageInfo imageInfo, int64_t &imageIdOutput, int& width, int& height) {
     if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
-    imageHarmony::GetImageByImageIdRequest request;
-    imageHarmony::GetImageByImageIdResponse response;
-    grpc::ClientContext context;
+    bool cacheable = 0 != imageInfo.imageId && pImpl->frameCache.enabled();
+    if (cacheable && pImpl->frameCache.getSize(cacheKeyOf(imageInfo), imageIdOutput, width, height)) {
+        return true;
+    }
+    if (!pImpl->getImageMeta(imageInfo, imageIdOutput, width, height)) {
+        return false;
+    }
+    if (cacheable) {
+        pImpl->frameCache.putSize(cacheKeyOf(imageInfo), imageIdOutput, width, height);
+    }
+    return true;
+}
 
-    request.set_connectionid(pImpl->connectionId);
-    request.mutable_imagerequest()->set_imageid(imageInfo.imageId);
-    request.mutable_imagerequest()->set_noimagebuffer(true);
-    request.mutable_imagerequest()->set_expectedw(imageInfo.width);
-    request.mutable_imagerequest()->set_expectedh(imageInfo.height);
-    grpc::Status status = pImpl->stub->getImageByImageId(&context, request, &response);
-    
-    if (!status.ok()) {
-        std::cout << "Error: " << status.error_code() << ": " << status.error_message() << std::endl;
+bool ImageHarmonyClient::setPreprocess(ImageHarmonyClient::PreprocessOptions options) {
+    if (pImpl->shouldStop.load()) return false;
+    std::shared_ptr<const ImageHarmonyPreprocessor> preprocessor;
+    if (options.width > 0 && options.height > 0) {
+        ImageHarmonyPreprocessor::Options preprocessOptions;
+        preprocessOptions.width = options.width;
+        preprocessOptions.height = options.height;
+        preprocessOptions.letterbox = options.letterbox;
+        preprocessOptions.padValue = options.padValue;
+        preprocessOptions.swapRB = options.swapRB;
+        preprocessOptions.scale = options.scale;
+        for (int c = 0; c < 3; ++c) {
+            if (0 == options.std[c]) {
+                // TODO 以后改成日志
+                std::cout << "preprocess std must not be 0" << std::endl;
+                return false;
+            }
+            preprocessOptions.mean[c] = options.mean[c];
+            preprocessOptions.std[c] = options.std[c];
+        }
+        preprocessor = std::make_shared<ImageHarmonyPreprocessor>(preprocessOptions);
+    }
+    std::atomic_store(&pImpl->preprocessor, preprocessor);
+    return true;
+}
+
+bool ImageHarmonyClient::getTensorByImageId(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, ImageHarmonyClient::PreprocessedImage& output) {
+    if (pImpl->shouldStop.load()) return false;
+    std::shared_ptr<const ImageHarmonyPreprocessor> preprocessor = std::atomic_load(&pImpl->preprocessor);
+    if (nullptr == preprocessor) {
+        // TODO 以后改成日志
+        std::cout << "preprocess is not set" << std::endl;
         return false;
     }
-    
-    auto customResponse = response.response();
-    if (200 != customResponse.code()) {
-        std::cout << customResponse.message() << std::endl;
+    // 解码结果只作中间输入，按线程复用其内存
+    thread_local cv::Mat frame;
+    if (!getImageByImageId(imageInfo, imageIdOutput, frame)) {
         return false;
     }
-    
-    imageIdOutput = response.imageresponse().imageid();
+    static const int metric = Impl::metric("getTensorByImageId");
+    RpcCallTimer timer(metric);
+    ImageHarmonyPreprocessor::Layout layout;
+    bool ok = preprocessor->run(frame, output.tensor, layout);
+    timer.lap(RPC_PHASE_PREPROCESS);
+    if (nullptr != std::atomic_load(&pImpl->shmRing)) {
+        // 不长期占用共享内存槽位
+        frame.release();
+    }
+    output.scaleX = layout.scaleX;
+    output.scaleY = layout.scaleY;
+    output.padLeft = layout.padLeft;
+    output.padTop = layout.padTop;
+    return timer.finish(ok);
+}
 
-    if (!imageIdOutput) {
-        std::cout << "image ID is 0" << std::endl;
-        return false;
+bool ImageHarmonyClient::setPrefetch(ImageHarmonyClient::PrefetchOptions options) {
+    if (pImpl->shouldStop.load()) return false;
+    std::lock_guard<std::mutex> lock(pImpl->prefetchMutex);
+    pImpl->prefetchOptions = options;
+    pImpl->prefetchDepth.store(options.depth);
+    if (options.depth > 0 && !pImpl->prefetchStarted) {
+        pImpl->startPrefetch(options.workers);
     }
+    return true;
+}
 
-    width = response.imageresponse().width();
-    height = response.imageresponse().height();
+ImageHarmonyClient::PrefetchStats ImageHarmonyClient::getPrefetchStats() {
+    std::lock_guard<std::mutex> lock(pImpl->prefetchMutex);
+    return pImpl->prefetchStats;
+}
 
+bool ImageHarmonyClient::setCacheBudget(size_t bytes) {
+    if (pImpl->shouldStop.load()) return false;
+    pImpl->frameCache.setBudget(bytes);
     return true;
 }
+
+ImageHarmonyClient::CacheStats ImageHarmonyClient::getCacheStats() {
+    ImageHarmonyFrameCache::Stats stats = pImpl->frameCache.getStats();
+    CacheStats cacheStats;
+    cacheStats.hits = stats.hits;
+    cacheStats.misses = stats.misses;
+    cacheStats.evictions = stats.evictions;
+    cacheStats.coalesced = stats.coalesced;
+    cacheStats.sizeHits = stats.sizeHits;
+    cacheStats.sizeMisses = stats.sizeMisses;
+    cacheStats.bytes = stats.bytes;
+    cacheStats.entries = stats.entries;
+    return cacheStats;
+}
+
+std::future<bool> ImageHarmonyClient::connectImageLoaderAsync(int64_t loaderArgsHash) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    static const int metric = Impl::metric("connectImageLoaderAsync");
+    Impl* impl = pImpl.get();
+    return pImpl->callAsync<ConnectImageLoader>(metric,
+        [loaderArgsHash](imageHarmony::ConnectImageLoaderRequest& request) {
+            request.set_loaderargshash(loaderArgsHash);
+        },
+        [impl](const imageHarmony::ConnectImageLoaderResponse& response) {
+            impl->connectionId = response.connectionid();
+            return 0 != impl->connectionId;
+        });
+}
+
+std::future<bool> ImageHarmonyClient::disconnectImageLoaderAsync() {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    if (0 == pImpl->connectionId) {
+        return makeReadyFuture(true);
+    }
+    static const int metric = Impl::metric("disconnectImageLoaderAsync");
+    int64_t connectionId = pImpl->connectionId;
+    return pImpl->callAsync<DisconnectImageLoader>(metric,
+        [connectionId](imageHarmony::DisconnectImageLoaderRequest& request) {
+            request.set_connectionid(connectionId);
+        },
+        [](const imageHarmony::DisconnectImageLoaderResponse&) {
+            return true;
+        });
+}
+
+std::future<bool> ImageHarmonyClient::getImageByImageIdAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    return completionFuture([&](ImageHarmonyClient::CompletionCallback callback) {
+        getImageByImageIdAsync(imageInfo, imageIdOutput, imageOutput, std::move(callback));
+    });
+}
+
+void ImageHarmonyClient::getImageByImageIdAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput, ImageHarmonyClient::CompletionCallback callback) {
+    if (pImpl->shouldStop.load()) {
+        callback(false);
+        return;
+    }
+    StubHolder<imageHarmony::Communicate::Stub>::Lease stub = pImpl->stub.load();
+    if (nullptr == stub) {
+        callback(false);
+        return;
+    }
+    static const int metric = Impl::metric("getImageByImageIdAsync");
+    RpcCallTimer timer(metric);
+    imageHarmony::GetImageByImageIdRequest request;
+    pImpl->buildImageRequest(imageInfo, request);
+    Impl* impl = pImpl.get();
+    int64_t* imageId = &imageIdOutput;
+    cv::Mat* image = &imageOutput;
+    timer.request(request);
+    imageHarmony::Communicate::Stub* target = stub.get();
+    startAsyncCall<imageHarmony::GetImageByImageIdResponse>(std::move(stub),
+        [target, &request](grpc::ClientContext* context, grpc::CompletionQueue* cq) {
+            return target->PrepareAsyncgetImageByImageId(context, request, cq);
+        },
+        [callback, impl, imageId, image, timer](const grpc::Status& status, imageHarmony::GetImageByImageIdResponse& response) {
+            timer.response(response);
+            if (!status.ok()) {
+                Impl::printStatus(status);
+                callback(timer.finish(false));
+                return;
+            }
+            // 轮询线程由各客户端共享，解码交给解码线程，直接写入调用方的输出
+            std::shared_ptr<imageHarmony::GetImageByImageIdResponse> pending = std::make_shared<imageHarmony::GetImageByImageIdResponse>(std::move(response));
+            bool submitted = impl->submitAsyncDecode(
+                [impl, pending, imageId, image, timer](int64_t&, cv::Mat&) {
+                    return timer.finish(impl->decodeImageResponse(*pending, *imageId, *image, timer));
+                },
+                [callback](bool ok, int64_t, cv::Mat) {
+                    callback(ok);
+                });
+            if (!submitted) {
+                callback(timer.finish(false));
+            }
+        },
+        &pImpl->asyncCalls);
+}
+
+std::future<bool> ImageHarmonyClient::getImageSizeAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, int& width, int& height) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    bool cacheable = 0 != imageInfo.imageId && pImpl->frameCache.enabled();
+    if (cacheable && pImpl->frameCache.getSize(cacheKeyOf(imageInfo), imageIdOutput, width, height)) {
+        return makeReadyFuture(true);
+    }
+    static const int metric = Impl::metric("getImageSizeAsync");
+    int64_t connectionId = pImpl->connectionId;
+    Impl* impl = pImpl.get();
+    ImageHarmonyFrameCache::Key key = cacheKeyOf(imageInfo);
+    int64_t* imageId = &imageIdOutput;
+    int* widthOutput = &width;
+    int* heightOutput = &height;
+    return pImpl->callAsync<GetImageSize>(metric,
+        [connectionId, &imageInfo](imageHarmony::GetImageByImageIdRequest& request) {
+            Impl::buildMetaRequest(connectionId, imageInfo, request);
+        },
+        [impl, cacheable, key, imageId, widthOutput, heightOutput](const imageHarmony::GetImageByImageIdResponse& response) {
+            if (!Impl::parseMeta(response, *imageId, *widthOutput, *heightOutput)) {
+                return false;
+            }
+            if (cacheable) {
+                impl->frameCache.putSize(key, *imageId, *widthOutput, *heightOutput);
+            }
+            return true;
+        });
+}
@@ -15,7 +15,11 @@
 
 #include <string>
 #include <memory>
+#include <vector>
+#include <functional>
+#include <future>
 #include <opencv2/opencv.hpp>
+#include "call_policy.h"
 
 class ImageHarmonyClient {
 public:
@@ -28,12 +32,141 @@ public:
         std::string format = ".jpg";
         int quality = 90;
     };
+    enum class TransferMode {
+        ENCODED,    // 按 ImageInfo 的 format/quality 编码传输
+        RAW,        // 传输无压缩像素，省去编解码
+        AUTO,       // 按 TransferPolicy 的代价估计选择
+    };
+    struct TransferPolicy {
+        TransferMode mode = TransferMode::ENCODED;
+        // 以下参数仅用于 AUTO，服务端在本机时总是选择 RAW
+        double bandwidthMbps = 0;       // 链路带宽，0 表示未知，此时选择 ENCODED
+        double compressionRatio = 10;   // 编码后相对原始像素的压缩比
+        double codecNsPerPixel = 8;     // 编码加解码每像素的 CPU 耗时
+    };
+    struct CacheStats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t coalesced = 0;     // 并发未命中合并到同一次请求的次数
+        uint64_t sizeHits = 0;
+        uint64_t sizeMisses = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+    struct PrefetchOptions {
+        int depth = 0;          // 提前请求的帧数，0 表示关闭
+        int64_t step = 1;       // 无法从请求序列推断 imageId 间隔时使用
+        int workers = 2;        // 解码线程数，仅首次开启时生效
+    };
+    struct PrefetchStats {
+        uint64_t issued = 0;    // 发出的预取请求
+        uint64_t hits = 0;      // 请求由预取结果满足
+        uint64_t misses = 0;
+        uint64_t wasted = 0;    // 预取后未被取用即丢弃
+        uint64_t failed = 0;
+    };
+    struct DecodePoolOptions {
+        int workers = 0;            // 0 表示不使用线程池，在调用线程解码
+        size_t queueCapacity = 8;
+        bool dropOldest = false;    // 队列满时丢弃最旧的帧，否则阻塞调用方
+    };
+    struct DecodePoolStats {
+        uint64_t submitted = 0;
+        uint64_t decoded = 0;
+        uint64_t failed = 0;
+        uint64_t dropped = 0;
+        size_t queued = 0;
+    };
+    struct DecodedImage {
+        bool ok = false;
+        int64_t imageId = 0;
+        cv::Mat image;
+    };
+    using DecodeCallback = std::function<void(ImageHarmonyClient::DecodedImage)>;
+    // 异步请求完成时调用，未能发起时在调用线程中同步调用
+    using CompletionCallback = std::function<void(bool)>;
+    struct SubscribeOptions {
+        ImageInfo imageInfo;            // 取图参数，imageId 字段不使用
+        bool withImage = true;          // false 时只推送 imageId
+        int pollIntervalMs = 5;         // 没有新帧时的等待间隔
+        size_t queueCapacity = 64;      // 未设置回调时使用的队列容量
+    };
+    struct SubscribeStats {
+        uint64_t frames = 0;
+        uint64_t dropped = 0;           // 队列满时丢弃的帧
+        uint64_t polls = 0;
+    };
+    struct PreprocessOptions {
+        int width = 0;                  // 模型输入尺寸，0 表示关闭
+        int height = 0;
+        bool letterbox = true;          // 保持宽高比缩放后居中填充，否则拉伸
+        int padValue = 114;
+        bool swapRB = true;             // 输出 RGB
+        float scale = 1.0f / 255;
+        float mean[3] = {0, 0, 0};      // 按输出通道顺序，输出为 (像素 * scale - mean) / std
+        float std[3] = {1, 1, 1};
+    };
+    struct PreprocessedImage {
+        cv::Mat tensor;                 // 1x3xHxW 的 CV_32F
+        // 还原到原图坐标：x = (tx - padLeft) / scaleX
+        float scaleX = 1;
+        float scaleY = 1;
+        int padLeft = 0;
+        int padTop = 0;
+    };
 
     bool setAddress(std::string ip, int port);
+    // 地址形如 ip:port，请求在全部地址的全部连接间按轮询或最少在途请求分摊
+    // 连接在同一进程的客户端实例间共享
+    // connectionId 由服务端分配，多个地址须指向共享加载器状态的服务端
+    bool setAddresses(std::vector<std::string> addresses, int channelsPerAddress = 1, bool leastOutstanding = false);
+    // 各方法的超时、重试与对冲策略，方法名为 connectImageLoader、disconnectImageLoader、getImageByImageId、getImageSize
+    // 预取与 getImageByImageIdAsync 不受策略约束；connect/disconnect 不幂等，不对冲；图像响应始终不压缩
+    bool setCallPolicy(CallPolicy policy);
+    // 各方法成功响应的次数与序列化字节数，不含传输层压缩
+    bool getPayloadCounters(std::vector<PayloadCounters>& counters);
+    bool setTransferPolicy(ImageHarmonyClient::TransferPolicy policy);
+    // 服务端在本机时使用共享内存帧环，name 为空表示关闭
+    // 此模式下 getImageByImageId 输出的 Mat 直接引用共享内存，持有期间该槽位不会被覆盖
+    // 可在取图过程中切换，打开失败时保持原来的设置
+    bool setSharedMemory(std::string name);
     bool connectImageLoader(int64_t loaderArgsHash);
     bool disconnectImageLoader();
     bool getImageByImageId(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput);
     bool getImageSize(ImageHarmonyClient::ImageInfo imageInfo, int64_t &imageIdOutput, int& width, int& height);
+    // 解码后一次完成缩放、填充、通道转换与归一化，输出模型输入
+    // 由客户端缩放时 ImageInfo 的 width/height 宜为 0，避免服务端先缩放一次
+    bool setPreprocess(ImageHarmonyClient::PreprocessOptions options);
+    // 经 getImageByImageId 取图后转换，tensor 尺寸不变时复用其内存；未设置 setPreprocess 时返回 false
+    bool getTensorByImageId(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, ImageHarmonyClient::PreprocessedImage& output);
+    // 帧缓存的内存预算，0 表示关闭；imageId 为 0 的请求不缓存
+    bool setCacheBudget(size_t bytes);
+    ImageHarmonyClient::CacheStats getCacheStats();
+    // 按最近请求的 imageId 及其间隔预取后续帧
+    // 预取请求沿用 setCallPolicy 中 getImageByImageId 的超时，取用时最多等到该超时
+    bool setPrefetch(ImageHarmonyClient::PrefetchOptions options);
+    ImageHarmonyClient::PrefetchStats getPrefetchStats();
+    // 在调用线程完成请求，解码交给解码线程池，不经过帧缓存与预取
+    // 返回 false 表示请求失败，此时不会回调；被丢弃的帧以 ok = false 回调
+    bool setDecodePool(ImageHarmonyClient::DecodePoolOptions options);
+    bool decodeImageByImageId(ImageHarmonyClient::ImageInfo imageInfo, ImageHarmonyClient::DecodeCallback callback);
+    std::future<ImageHarmonyClient::DecodedImage> decodeImageByImageId(ImageHarmonyClient::ImageInfo imageInfo);
+    ImageHarmonyClient::DecodePoolStats getDecodePoolStats();
+    // 订阅 connectImageLoader 之后产生的新帧，在后台线程中推送
+    // callback 为空时写入单消费者队列，由 popSubscribedFrame 读取
+    bool subscribe(ImageHarmonyClient::SubscribeOptions options, ImageHarmonyClient::DecodeCallback callback = nullptr);
+    bool popSubscribedFrame(ImageHarmonyClient::DecodedImage& frame);
+    void unsubscribe();
+    ImageHarmonyClient::SubscribeStats getSubscribeStats();
+    // 异步版本，由共享的 CompletionQueue 驱动，输出参数须在 future 就绪前保持有效
+    // getImageByImageIdAsync 不经过共享内存、帧缓存与预取，解码在解码线程池中进行，未启用时使用内部的解码线程
+    std::future<bool> connectImageLoaderAsync(int64_t loaderArgsHash);
+    std::future<bool> disconnectImageLoaderAsync();
+    std::future<bool> getImageByImageIdAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput);
+    // 回调版本，在解码线程中回调，输出参数须在回调前保持有效
+    void getImageByImageIdAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, cv::Mat& imageOutput, ImageHarmonyClient::CompletionCallback callback);
+    std::future<bool> getImageSizeAsync(ImageHarmonyClient::ImageInfo imageInfo, int64_t& imageIdOutput, int& width, int& height);
 private:
     struct Impl;
     std::unique_ptr<Impl> pImpl;
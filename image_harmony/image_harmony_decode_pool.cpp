@@ -0,0 +1,144 @@
+#include "image_harmony_decode_pool.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ImageHarmonyDecodePool::Impl {
+    struct Job {
+        Task task;
+        Callback callback;
+    };
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    Options options;
+    Stats stats;
+    bool running = false;
+    std::deque<Job> jobs;
+    std::vector<std::thread> workers;
+
+    void runWorker() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                notEmpty.wait(lock, [this]() { return !jobs.empty() || !running; });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            notFull.notify_one();
+
+            int64_t imageId = 0;
+            cv::Mat image;
+            bool ok = job.task(imageId, image);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ok) {
+                    ++stats.decoded;
+                } else {
+                    ++stats.failed;
+                }
+            }
+            job.callback(ok, imageId, image);
+        }
+    }
+};
+
+ImageHarmonyDecodePool::ImageHarmonyDecodePool(): pImpl(new Impl()) {
+
+}
+
+ImageHarmonyDecodePool::~ImageHarmonyDecodePool() {
+    stop();
+}
+
+bool ImageHarmonyDecodePool::start(ImageHarmonyDecodePool::Options options) {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    if (pImpl->running) {
+        return false;
+    }
+    if (options.workers <= 0 || 0 == options.queueCapacity) {
+        return false;
+    }
+    pImpl->options = options;
+    pImpl->running = true;
+    for (int i = 0; i < options.workers; ++i) {
+        pImpl->workers.emplace_back(&Impl::runWorker, pImpl.get());
+    }
+    return true;
+}
+
+void ImageHarmonyDecodePool::stop() {
+    std::deque<Impl::Job> pending;
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(pImpl->mutex);
+        if (!pImpl->running) {
+            return;
+        }
+        pImpl->running = false;
+        pending.swap(pImpl->jobs);
+        workers.swap(pImpl->workers);
+        pImpl->stats.dropped += pending.size();
+    }
+    pImpl->notEmpty.notify_all();
+    pImpl->notFull.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (Impl::Job& job : pending) {
+        job.callback(false, 0, cv::Mat());
+    }
+}
+
+bool ImageHarmonyDecodePool::running() {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    return pImpl->running;
+}
+
+bool ImageHarmonyDecodePool::submit(ImageHarmonyDecodePool::Task task, ImageHarmonyDecodePool::Callback callback) {
+    Impl::Job dropped;
+    bool hasDropped = false;
+    {
+        std::unique_lock<std::mutex> lock(pImpl->mutex);
+        if (!pImpl->running) {
+            return false;
+        }
+        if (pImpl->jobs.size() >= pImpl->options.queueCapacity) {
+            if (OverflowPolicy::DROP_OLDEST == pImpl->options.overflow) {
+                dropped = std::move(pImpl->jobs.front());
+                pImpl->jobs.pop_front();
+                hasDropped = true;
+                ++pImpl->stats.dropped;
+            } else {
+                pImpl->notFull.wait(lock, [this]() {
+                    return pImpl->jobs.size() < pImpl->options.queueCapacity || !pImpl->running;
+                });
+                if (!pImpl->running) {
+                    return false;
+                }
+            }
+        }
+        pImpl->jobs.push_back(Impl::Job{std::move(task), std::move(callback)});
+        ++pImpl->stats.submitted;
+    }
+    pImpl->notEmpty.notify_one();
+    // 在锁外回调，避免回调中再次提交造成死锁
+    if (hasDropped) {
+        dropped.callback(false, 0, cv::Mat());
+    }
+    return true;
+}
+
+ImageHarmonyDecodePool::Stats ImageHarmonyDecodePool::getStats() {
+    std::lock_guard<std::mutex> lock(pImpl->mutex);
+    Stats snapshot = pImpl->stats;
+    snapshot.queued = pImpl->jobs.size();
+    return snapshot;
+}
@@ -0,0 +1,58 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     image_harmony_decode_pool.h                                     *
+*  @brief    有界队列的图像解码线程池                                          *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 队列满时按策略阻塞提交方或丢弃最旧的任务，                        *
+*            被丢弃的任务同样会以失败回调，保证每个任务恰好回调一次。           *
+*****************************************************************************/
+
+#ifndef _IMAGE_HARMONY_DECODE_POOL_H_
+#define _IMAGE_HARMONY_DECODE_POOL_H_
+
+#include <functional>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+class ImageHarmonyDecodePool {
+public:
+    enum class OverflowPolicy {
+        BLOCK,          // 阻塞提交方直到队列有空位
+        DROP_OLDEST,    // 丢弃队列中最旧的任务
+    };
+    struct Options {
+        int workers = 2;
+        size_t queueCapacity = 8;
+        OverflowPolicy overflow = OverflowPolicy::BLOCK;
+    };
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t decoded = 0;
+        uint64_t failed = 0;
+        uint64_t dropped = 0;
+        size_t queued = 0;
+    };
+    // 在工作线程执行的解码，输出 imageId 与解码后的帧
+    using Task = std::function<bool(int64_t&, cv::Mat&)>;
+    using Callback = std::function<void(bool ok, int64_t imageId, cv::Mat image)>;
+
+    ImageHarmonyDecodePool();
+    ~ImageHarmonyDecodePool();
+
+    bool start(Options options);
+    // 等待工作线程退出，队列中未执行的任务以失败回调
+    void stop();
+    bool running();
+    // 已停止时返回 false 且不回调
+    bool submit(Task task, Callback callback);
+    Stats getStats();
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _IMAGE_HARMONY_DECODE_POOL_H_ */
@@ -0,0 +1,175 @@
+#include "image_harmony_frame_cache.h"
+
+// 元数据条目很小，只按条目数限制
+static const size_t MAX_SIZE_ENTRIES = 4096;
+
+static ImageHarmonyFrameCache::Key sizeKeyOf(const ImageHarmonyFrameCache::Key& key) {
+    ImageHarmonyFrameCache::Key sizeKey;
+    sizeKey.imageId = key.imageId;
+    sizeKey.width = key.width;
+    sizeKey.height = key.height;
+    return sizeKey;
+}
+
+bool ImageHarmonyFrameCache::Key::operator==(const Key& other) const {
+    return imageId == other.imageId && width == other.width && height == other.height
+        && quality == other.quality && format == other.format;
+}
+
+size_t ImageHarmonyFrameCache::KeyHash::operator()(const Key& key) const {
+    size_t h = std::hash<int64_t>()(key.imageId);
+    h = h * 31 + std::hash<int>()(key.width);
+    h = h * 31 + std::hash<int>()(key.height);
+    h = h * 31 + std::hash<int>()(key.quality);
+    h = h * 31 + std::hash<std::string>()(key.format);
+    return h;
+}
+
+void ImageHarmonyFrameCache::setBudget(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    evictLocked();
+    if (0 == budget) {
+        sizes.clear();
+    }
+}
+
+bool ImageHarmonyFrameCache::enabled() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget > 0;
+}
+
+bool ImageHarmonyFrameCache::getOrLoad(const Key& key, int64_t& imageIdOutput, cv::Mat& frameOutput, const Loader& loader) {
+    std::shared_ptr<Flight> flight;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            ++stats.hits;
+            imageIdOutput = it->second->imageId;
+            frameOutput = it->second->frame;
+            return true;
+        }
+        auto flightIt = flights.find(key);
+        if (flightIt != flights.end()) {
+            // 已有线程在加载同一帧，等待其结果
+            flight = flightIt->second;
+            ++stats.coalesced;
+            flight->cv.wait(lock, [&flight]() { return flight->done; });
+            if (!flight->ok) {
+                return false;
+            }
+            imageIdOutput = flight->imageId;
+            frameOutput = flight->frame;
+            return true;
+        }
+        ++stats.misses;
+        flight = std::make_shared<Flight>();
+        flights[key] = flight;
+    }
+
+    int64_t imageId = 0;
+    cv::Mat frame;
+    bool ok = false;
+    try {
+        ok = loader(imageId, frame);
+    } catch (...) {
+        // 加载抛出异常时也要结束这次加载，否则等待的线程永远阻塞，该帧也无法再加载
+        finishFlight(key, flight, false, imageId, frame);
+        throw;
+    }
+    finishFlight(key, flight, ok, imageId, frame);
+    if (!ok) {
+        return false;
+    }
+    imageIdOutput = imageId;
+    frameOutput = frame;
+    return true;
+}
+
+void ImageHarmonyFrameCache::finishFlight(const Key& key, const std::shared_ptr<Flight>& flight, bool ok, int64_t imageId, const cv::Mat& frame) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        flight->done = true;
+        flight->ok = ok;
+        flight->imageId = imageId;
+        flight->frame = frame;
+        flights.erase(key);
+        if (ok) {
+            insertLocked(key, imageId, frame);
+        }
+    }
+    flight->cv.notify_all();
+}
+
+void ImageHarmonyFrameCache::put(const Key& key, int64_t imageId, const cv::Mat& frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    insertLocked(key, imageId, frame);
+}
+
+bool ImageHarmonyFrameCache::getSize(const Key& key, int64_t& imageIdOutput, int& width, int& height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = sizes.find(sizeKeyOf(key));
+    if (it == sizes.end()) {
+        ++stats.sizeMisses;
+        return false;
+    }
+    ++stats.sizeHits;
+    imageIdOutput = it->second.imageId;
+    width = it->second.width;
+    height = it->second.height;
+    return true;
+}
+
+void ImageHarmonyFrameCache::putSize(const Key& key, int64_t imageId, int width, int height) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (0 == budget) {
+        return;
+    }
+    if (sizes.size() >= MAX_SIZE_ENTRIES) {
+        sizes.clear();
+    }
+    sizes[sizeKeyOf(key)] = SizeEntry{imageId, width, height};
+}
+
+ImageHarmonyFrameCache::Stats ImageHarmonyFrameCache::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Stats snapshot = stats;
+    snapshot.entries = lru.size();
+    return snapshot;
+}
+
+void ImageHarmonyFrameCache::insertLocked(const Key& key, int64_t imageId, const cv::Mat& frame) {
+    if (0 == budget || frame.empty()) {
+        return;
+    }
+    size_t bytes = frame.total() * frame.elemSize();
+    if (bytes > budget) {
+        return;
+    }
+    auto it = index.find(key);
+    if (it != index.end()) {
+        stats.bytes -= it->second->bytes;
+        lru.erase(it->second);
+        index.erase(it);
+    }
+    lru.push_front(Entry{key, imageId, frame, bytes});
+    index[key] = lru.begin();
+    stats.bytes += bytes;
+    if (sizes.size() >= MAX_SIZE_ENTRIES) {
+        sizes.clear();
+    }
+    sizes[sizeKeyOf(key)] = SizeEntry{imageId, frame.cols, frame.rows};
+    evictLocked();
+}
+
+void ImageHarmonyFrameCache::evictLocked() {
+    while (!lru.empty() && stats.bytes > budget) {
+        Entry& last = lru.back();
+        stats.bytes -= last.bytes;
+        index.erase(last.key);
+        lru.pop_back();
+        ++stats.evictions;
+    }
+}
@@ -0,0 +1,94 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     image_harmony_frame_cache.h                                     *
+*  @brief    ImageHarmonyClient 使用的 LRU 帧缓存                              *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 以完整的 ImageInfo 为键，按内存预算淘汰；                          *
+*            同一个键的并发未命中合并为一次加载。                               *
+*****************************************************************************/
+
+#ifndef _IMAGE_HARMONY_FRAME_CACHE_H_
+#define _IMAGE_HARMONY_FRAME_CACHE_H_
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+class ImageHarmonyFrameCache {
+public:
+    struct Key {
+        int64_t imageId = 0;
+        int width = 0;
+        int height = 0;
+        std::string format;
+        int quality = 0;
+        bool operator==(const Key& other) const;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t coalesced = 0;     // 等待其他线程加载结果的次数
+        uint64_t sizeHits = 0;      // getImageSize 命中元数据
+        uint64_t sizeMisses = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+    // 未命中时调用，输出实际的 imageId 与解码后的帧
+    using Loader = std::function<bool(int64_t&, cv::Mat&)>;
+
+    // 0 表示关闭缓存
+    void setBudget(size_t bytes);
+    bool enabled();
+    // 命中时 frameOutput 为缓存帧的共享引用，调用方不得修改
+    bool getOrLoad(const Key& key, int64_t& imageIdOutput, cv::Mat& frameOutput, const Loader& loader);
+    void put(const Key& key, int64_t imageId, const cv::Mat& frame);
+    bool getSize(const Key& key, int64_t& imageIdOutput, int& width, int& height);
+    void putSize(const Key& key, int64_t imageId, int width, int height);
+    Stats getStats();
+private:
+    struct Entry {
+        Key key;
+        int64_t imageId;
+        cv::Mat frame;
+        size_t bytes;
+    };
+    struct SizeEntry {
+        int64_t imageId;
+        int width;
+        int height;
+    };
+    struct Flight {
+        bool done = false;
+        bool ok = false;
+        int64_t imageId = 0;
+        cv::Mat frame;
+        std::condition_variable cv;
+    };
+
+    void insertLocked(const Key& key, int64_t imageId, const cv::Mat& frame);
+    void finishFlight(const Key& key, const std::shared_ptr<Flight>& flight, bool ok, int64_t imageId, const cv::Mat& frame);
+    void evictLocked();
+
+    std::mutex mutex;
+    size_t budget = 0;
+    Stats stats;
+    std::list<Entry> lru;   // 头部为最近使用
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    std::unordered_map<Key, SizeEntry, KeyHash> sizes;
+    std::unordered_map<Key, std::shared_ptr<Flight>, KeyHash> flights;
+};
+
+#endif /* _IMAGE_HARMONY_FRAME_CACHE_H_ */
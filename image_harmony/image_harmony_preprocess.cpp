@@ -0,0 +1,205 @@
+#include "image_harmony_preprocess.h"
+#include <opencv2/core/hal/intrin.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+// 每个线程复用的中间结果，源图尺寸不变时不再分配
+struct Scratch {
+    std::vector<int> xofs;          // 每个输出列左右两个源像素的字节偏移
+    std::vector<float> xalpha;      // 右侧源像素的权重
+    std::vector<float> rows[2];     // 水平插值后的源行，按源图的通道顺序交错存放
+    int rowY[2] = {-1, -1};
+};
+
+// 与 cv::resize 的 INTER_LINEAR 相同：像素中心对齐，越界时取边缘像素
+void mapCoordinate(int dst, double scale, int srcSize, int& src0, int& src1, float& weight) {
+    double f = (dst + 0.5) * scale - 0.5;
+    int s = static_cast<int>(std::floor(f));
+    double w = f - s;
+    if (s < 0) {
+        s = 0;
+        w = 0;
+    }
+    if (s >= srcSize - 1) {
+        s = srcSize - 1;
+        w = 0;
+    }
+    src0 = s;
+    src1 = std::min(s + 1, srcSize - 1);
+    weight = static_cast<float>(w);
+}
+
+} // namespace
+
+struct ImageHarmonyPreprocessor::Impl {
+    Options options;
+    // 以下按源图的 BGR 通道给出，输出值 = 像素 * alpha + beta
+    float alpha[3];
+    float beta[3];
+    float pad[3];
+    int plane[3];   // 写入的输出平面
+
+    void prepare(Scratch& scratch, const cv::Mat& image, int width) const {
+        scratch.xofs.resize(2 * width);
+        scratch.xalpha.resize(width);
+        double scale = static_cast<double>(image.cols) / width;
+        for (int x = 0; x < width; ++x) {
+            int sx0 = 0;
+            int sx1 = 0;
+            mapCoordinate(x, scale, image.cols, sx0, sx1, scratch.xalpha[x]);
+            scratch.xofs[2 * x] = sx0 * 3;
+            scratch.xofs[2 * x + 1] = sx1 * 3;
+        }
+        for (int i = 0; i < 2; ++i) {
+            scratch.rows[i].resize(3 * width);
+            scratch.rowY[i] = -1;
+        }
+    }
+
+    // 取水平插值后的源行 y，不覆盖同时需要的另一行 other
+    const float* sourceRow(Scratch& scratch, const cv::Mat& image, int y, int other, int width) const {
+        for (int i = 0; i < 2; ++i) {
+            if (scratch.rowY[i] == y) {
+                return scratch.rows[i].data();
+            }
+        }
+        int slot = scratch.rowY[0] == other ? 1 : 0;
+        float* row = scratch.rows[slot].data();
+        const uchar* src = image.ptr<uchar>(y);
+        const int* xofs = scratch.xofs.data();
+        const float* xalpha = scratch.xalpha.data();
+        for (int x = 0; x < width; ++x) {
+            const uchar* p0 = src + xofs[2 * x];
+            const uchar* p1 = src + xofs[2 * x + 1];
+            float a = xalpha[x];
+            row[3 * x] = p0[0] + (p1[0] - p0[0]) * a;
+            row[3 * x + 1] = p0[1] + (p1[1] - p0[1]) * a;
+            row[3 * x + 2] = p0[2] + (p1[2] - p0[2]) * a;
+        }
+        scratch.rowY[slot] = y;
+        return row;
+    }
+
+    // 竖直插值、拆分通道并归一化，out 按源图的通道顺序给出
+    void blendRow(const float* row0, const float* row1, float weight, float* const out[3], int width) const {
+        float w0[3];
+        float w1[3];
+        for (int c = 0; c < 3; ++c) {
+            w0[c] = (1 - weight) * alpha[c];
+            w1[c] = weight * alpha[c];
+        }
+        int x = 0;
+#if CV_SIMD128
+        const int lanes = cv::v_float32x4::nlanes;
+        cv::v_float32x4 vw0[3];
+        cv::v_float32x4 vw1[3];
+        cv::v_float32x4 vbeta[3];
+        for (int c = 0; c < 3; ++c) {
+            vw0[c] = cv::v_setall_f32(w0[c]);
+            vw1[c] = cv::v_setall_f32(w1[c]);
+            vbeta[c] = cv::v_setall_f32(beta[c]);
+        }
+        for (; x + lanes <= width; x += lanes) {
+            cv::v_float32x4 a[3];
+            cv::v_float32x4 b[3];
+            cv::v_load_deinterleave(row0 + 3 * x, a[0], a[1], a[2]);
+            cv::v_load_deinterleave(row1 + 3 * x, b[0], b[1], b[2]);
+            for (int c = 0; c < 3; ++c) {
+                cv::v_store(out[c] + x, cv::v_muladd(b[c], vw1[c], cv::v_muladd(a[c], vw0[c], vbeta[c])));
+            }
+        }
+#endif
+        for (; x < width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                out[c][x] = row0[3 * x + c] * w0[c] + row1[3 * x + c] * w1[c] + beta[c];
+            }
+        }
+    }
+};
+
+ImageHarmonyPreprocessor::ImageHarmonyPreprocessor(Options options): pImpl(new Impl()) {
+    pImpl->options = options;
+    for (int c = 0; c < 3; ++c) {
+        int target = options.swapRB ? 2 - c : c;
+        pImpl->plane[c] = target;
+        pImpl->alpha[c] = options.scale / options.std[target];
+        pImpl->beta[c] = -options.mean[target] / options.std[target];
+        pImpl->pad[c] = options.padValue * pImpl->alpha[c] + pImpl->beta[c];
+    }
+}
+
+ImageHarmonyPreprocessor::~ImageHarmonyPreprocessor() {
+
+}
+
+const ImageHarmonyPreprocessor::Options& ImageHarmonyPreprocessor::options() const {
+    return pImpl->options;
+}
+
+bool ImageHarmonyPreprocessor::run(const cv::Mat& image, cv::Mat& tensor, Layout& layout) const {
+    const Options& options = pImpl->options;
+    if (image.empty() || CV_8UC3 != image.type()) {
+        // TODO 以后改成日志
+        std::cout << "preprocess expects a CV_8UC3 image" << std::endl;
+        return false;
+    }
+    int width = options.width;
+    int height = options.height;
+    if (width <= 0 || height <= 0) {
+        std::cout << "invalid preprocess size " << width << "x" << height << std::endl;
+        return false;
+    }
+
+    int contentWidth = width;
+    int contentHeight = height;
+    if (options.letterbox) {
+        double ratio = std::min(static_cast<double>(width) / image.cols, static_cast<double>(height) / image.rows);
+        contentWidth = std::max(1, std::min(width, static_cast<int>(std::lround(image.cols * ratio))));
+        contentHeight = std::max(1, std::min(height, static_cast<int>(std::lround(image.rows * ratio))));
+    }
+    layout.scaleX = static_cast<float>(contentWidth) / image.cols;
+    layout.scaleY = static_cast<float>(contentHeight) / image.rows;
+    layout.padLeft = (width - contentWidth) / 2;
+    layout.padTop = (height - contentHeight) / 2;
+    int padRight = width - contentWidth - layout.padLeft;
+    int padBottom = height - contentHeight - layout.padTop;
+
+    // cv::Mat 的内存按 64 字节对齐，尺寸不变时不重新分配
+    int sizes[] = {1, 3, height, width};
+    tensor.create(4, sizes, CV_32F);
+    float* data = tensor.ptr<float>();
+    size_t planeSize = static_cast<size_t>(width) * height;
+    float* planes[3];
+    for (int c = 0; c < 3; ++c) {
+        planes[c] = data + pImpl->plane[c] * planeSize;
+        std::fill_n(planes[c], static_cast<size_t>(layout.padTop) * width, pImpl->pad[c]);
+        std::fill_n(planes[c] + static_cast<size_t>(layout.padTop + contentHeight) * width, static_cast<size_t>(padBottom) * width, pImpl->pad[c]);
+    }
+
+    thread_local Scratch scratch;
+    pImpl->prepare(scratch, image, contentWidth);
+    double scaleY = static_cast<double>(image.rows) / contentHeight;
+    for (int y = 0; y < contentHeight; ++y) {
+        int sy0 = 0;
+        int sy1 = 0;
+        float weight = 0;
+        mapCoordinate(y, scaleY, image.rows, sy0, sy1, weight);
+        const float* row0 = pImpl->sourceRow(scratch, image, sy0, sy1, contentWidth);
+        const float* row1 = pImpl->sourceRow(scratch, image, sy1, sy0, contentWidth);
+
+        size_t offset = static_cast<size_t>(layout.padTop + y) * width;
+        float* out[3];
+        for (int c = 0; c < 3; ++c) {
+            float* line = planes[c] + offset;
+            std::fill_n(line, layout.padLeft, pImpl->pad[c]);
+            std::fill_n(line + layout.padLeft + contentWidth, padRight, pImpl->pad[c]);
+            out[c] = line + layout.padLeft;
+        }
+        pImpl->blendRow(row0, row1, weight, out, contentWidth);
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     image_harmony_preprocess.h                                      *
+*  @brief    解码后的缩放、填充、通道转换与归一化                            *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 一次遍历完成等比缩放、居中填充、BGR 转 RGB 与 HWC 转 CHW 浮点， *
+*            水平方向按预先计算的下标和权重插值，每个源行只插值一次；        *
+*            竖直插值、拆分通道与归一化用 OpenCV 通用向量指令完成。          *
+*****************************************************************************/
+
+#ifndef _IMAGE_HARMONY_PREPROCESS_H_
+#define _IMAGE_HARMONY_PREPROCESS_H_
+
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+class ImageHarmonyPreprocessor {
+public:
+    struct Options {
+        int width = 640;
+        int height = 640;
+        bool letterbox = true;          // 保持宽高比缩放后居中填充，否则拉伸到目标尺寸
+        int padValue = 114;
+        bool swapRB = true;             // 输出 RGB 通道顺序
+        float scale = 1.0f / 255;
+        float mean[3] = {0, 0, 0};      // 按输出通道顺序，输出为 (像素 * scale - mean) / std
+        float std[3] = {1, 1, 1};
+    };
+    // 输出坐标还原到原图：x = (tx - padLeft) / scaleX
+    struct Layout {
+        float scaleX = 1;
+        float scaleY = 1;
+        int padLeft = 0;
+        int padTop = 0;
+    };
+
+    explicit ImageHarmonyPreprocessor(Options options);
+    ~ImageHarmonyPreprocessor();
+
+    const Options& options() const;
+    // image 为 CV_8UC3，tensor 输出 1x3xHxW 的 CV_32F，尺寸不变时复用其内存
+    // 可在多个线程中同时调用，中间结果保存在线程局部的缓冲区中
+    bool run(const cv::Mat& image, cv::Mat& tensor, Layout& layout) const;
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _IMAGE_HARMONY_PREPROCESS_H_ */
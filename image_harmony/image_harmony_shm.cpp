@@ -0,0 +1,275 @@
+#include "image_harmony_shm.h"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t RING_MAGIC = 0x44414953; // "DAIS"
+const uint32_t RING_VERSION = 1;
+const size_t ALIGNMENT = 64;
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t reserved;
+    uint64_t slotBytes;
+};
+
+struct SlotHeader {
+    std::atomic<uint64_t> sequence;    // 奇数表示写入中
+    std::atomic<uint32_t> readers;     // 读端租约计数
+    int32_t type;
+    int64_t imageId;
+    int32_t width;
+    int32_t height;
+    uint64_t step;
+};
+
+size_t alignUp(size_t n) {
+    return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+size_t headerSize() {
+    return alignUp(sizeof(RingHeader));
+}
+
+size_t slotStride(size_t slotBytes) {
+    return alignUp(sizeof(SlotHeader)) + alignUp(slotBytes);
+}
+
+} // namespace
+
+struct ImageHarmonyShmRing::Impl {
+    std::string name;
+    bool owner = false;
+    int fd = -1;
+    uint8_t* base = nullptr;
+    size_t mappedSize = 0;
+    uint32_t slotCount = 0;
+    size_t slotBytes = 0;
+
+    ~Impl() {
+        if (base) {
+            munmap(base, mappedSize);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    SlotHeader* slotFor(int64_t imageId) const {
+        size_t index = static_cast<uint64_t>(imageId) % slotCount;
+        return reinterpret_cast<SlotHeader*>(base + headerSize() + index * slotStride(slotBytes));
+    }
+
+    static uint8_t* pixelsOf(SlotHeader* slot) {
+        return reinterpret_cast<uint8_t*>(slot) + alignUp(sizeof(SlotHeader));
+    }
+};
+
+// 最后一个引用槽位内存的 Mat 释放时归还租约
+class ShmLeaseAllocator : public cv::MatAllocator {
+public:
+    struct Lease {
+        std::shared_ptr<void> ring;    // 保持映射存活
+        SlotHeader* slot;
+    };
+
+    cv::UMatData* allocate(int, const int*, int, void*, size_t*, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return nullptr;
+    }
+
+    bool allocate(cv::UMatData*, cv::AccessFlag, cv::UMatUsageFlags) const override {
+        return false;
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        if (nullptr == u) {
+            return;
+        }
+        Lease* lease = static_cast<Lease*>(u->userdata);
+        if (lease) {
+            lease->slot->readers.fetch_sub(1);
+            delete lease;
+        }
+        delete u;
+    }
+
+    static ShmLeaseAllocator* instance() {
+        static ShmLeaseAllocator allocator;
+        return &allocator;
+    }
+};
+
+ImageHarmonyShmRing::ImageHarmonyShmRing() {
+
+}
+
+ImageHarmonyShmRing::~ImageHarmonyShmRing() {
+    close();
+}
+
+bool ImageHarmonyShmRing::create(std::string name, int slotCount, size_t slotBytes) {
+    close();
+    if (slotCount <= 0 || 0 == slotBytes) {
+        return false;
+    }
+    std::shared_ptr<Impl> impl = std::make_shared<Impl>();
+    impl->name = name;
+    impl->slotCount = static_cast<uint32_t>(slotCount);
+    impl->slotBytes = slotBytes;
+    impl->mappedSize = headerSize() + slotCount * slotStride(slotBytes);
+    impl->fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0666);
+    if (impl->fd < 0) {
+        std::cout << "shm_open failed: " << name << std::endl;
+        return false;
+    }
+    impl->owner = true;
+    if (0 != ftruncate(impl->fd, static_cast<off_t>(impl->mappedSize))) {
+        std::cout << "ftruncate failed: " << name << std::endl;
+        return false;
+    }
+    void* addr = mmap(nullptr, impl->mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, impl->fd, 0);
+    if (MAP_FAILED == addr) {
+        std::cout << "mmap failed: " << name << std::endl;
+        return false;
+    }
+    impl->base = static_cast<uint8_t*>(addr);
+
+    for (int i = 0; i < slotCount; ++i) {
+        SlotHeader* slot = impl->slotFor(i);
+        new (&slot->sequence) std::atomic<uint64_t>(0);
+        new (&slot->readers) std::atomic<uint32_t>(0);
+        slot->imageId = 0;
+    }
+    RingHeader* header = reinterpret_cast<RingHeader*>(impl->base);
+    header->version = RING_VERSION;
+    header->slotCount = impl->slotCount;
+    header->slotBytes = slotBytes;
+    // magic 最后写入，读端据此判断初始化完成
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = RING_MAGIC;
+    pImpl = impl;
+    return true;
+}
+
+bool ImageHarmonyShmRing::open(std::string name) {
+    close();
+    std::shared_ptr<Impl> impl = std::make_shared<Impl>();
+    impl->name = name;
+    impl->fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (impl->fd < 0) {
+        std::cout << "shm_open failed: " << name << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (0 != fstat(impl->fd, &st) || static_cast<size_t>(st.st_size) < headerSize()) {
+        return false;
+    }
+    impl->mappedSize = static_cast<size_t>(st.st_size);
+    // 读端也需要写权限以更新租约计数
+    void* addr = mmap(nullptr, impl->mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, impl->fd, 0);
+    if (MAP_FAILED == addr) {
+        std::cout << "mmap failed: " << name << std::endl;
+        return false;
+    }
+    impl->base = static_cast<uint8_t*>(addr);
+
+    const RingHeader* header = reinterpret_cast<const RingHeader*>(impl->base);
+    if (RING_MAGIC != header->magic || RING_VERSION != header->version || 0 == header->slotCount) {
+        std::cout << "invalid shared memory ring: " << name << std::endl;
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    impl->slotCount = header->slotCount;
+    impl->slotBytes = header->slotBytes;
+    if (impl->mappedSize < headerSize() + impl->slotCount * slotStride(impl->slotBytes)) {
+        std::cout << "truncated shared memory ring: " << name << std::endl;
+        return false;
+    }
+    pImpl = impl;
+    return true;
+}
+
+void ImageHarmonyShmRing::close() {
+    // 未归还的租约持有 Impl，映射在其全部释放后才解除
+    pImpl.reset();
+}
+
+bool ImageHarmonyShmRing::isOpen() const {
+    return nullptr != pImpl;
+}
+
+int ImageHarmonyShmRing::slotCount() const {
+    return pImpl ? static_cast<int>(pImpl->slotCount) : 0;
+}
+
+bool ImageHarmonyShmRing::write(int64_t imageId, const cv::Mat& image) {
+    if (!pImpl || image.empty() || 0 == imageId) {
+        return false;
+    }
+    size_t rowBytes = image.cols * image.elemSize();
+    if (rowBytes * image.rows > pImpl->slotBytes) {
+        return false;
+    }
+    SlotHeader* slot = pImpl->slotFor(imageId);
+    uint64_t sequence = slot->sequence.load();
+    // 先置为写入中再检查租约，与读端的 先加租约再检查序号 配对
+    slot->sequence.store(sequence + 1);
+    if (slot->readers.load() > 0) {
+        slot->sequence.store(sequence);
+        return false;
+    }
+    uint8_t* pixels = Impl::pixelsOf(slot);
+    if (image.isContinuous()) {
+        std::memcpy(pixels, image.data, rowBytes * image.rows);
+    } else {
+        for (int r = 0; r < image.rows; ++r) {
+            std::memcpy(pixels + r * rowBytes, image.ptr(r), rowBytes);
+        }
+    }
+    slot->imageId = imageId;
+    slot->width = image.cols;
+    slot->height = image.rows;
+    slot->type = image.type();
+    slot->step = rowBytes;
+    slot->sequence.store(sequence + 2);
+    return true;
+}
+
+bool ImageHarmonyShmRing::lease(int64_t imageId, cv::Mat& imageOutput) {
+    if (!pImpl || 0 == imageId) {
+        return false;
+    }
+    SlotHeader* slot = pImpl->slotFor(imageId);
+    slot->readers.fetch_add(1);
+    uint64_t sequence = slot->sequence.load();
+    if ((sequence & 1) || slot->imageId != imageId || slot->height <= 0 || slot->width <= 0
+        || slot->step * slot->height > pImpl->slotBytes) {
+        slot->readers.fetch_sub(1);
+        return false;
+    }
+
+    uint8_t* pixels = Impl::pixelsOf(slot);
+    cv::UMatData* u = new cv::UMatData(ShmLeaseAllocator::instance());
+    u->data = u->origdata = pixels;
+    u->size = slot->step * slot->height;
+    u->refcount = 1;
+    u->userdata = new ShmLeaseAllocator::Lease{pImpl, slot};
+
+    cv::Mat image(slot->height, slot->width, slot->type, pixels, slot->step);
+    image.allocator = ShmLeaseAllocator::instance();
+    image.u = u;
+    imageOutput = image;
+    return true;
+}
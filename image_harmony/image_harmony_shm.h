@@ -0,0 +1,45 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     image_harmony_shm.h                                             *
+*  @brief    image harmony 同机部署时使用的 POSIX 共享内存帧环                  *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 写端为图像服务(或本地替身)，读端为 ImageHarmonyClient。           *
+*            imageId 对 slotCount 取模得到槽位，gRPC 只需确认 imageId。        *
+*            每个槽位带 seqlock 序号和读端租约计数，被租用的槽位不会被覆盖。   *
+*****************************************************************************/
+
+#ifndef _IMAGE_HARMONY_SHM_H_
+#define _IMAGE_HARMONY_SHM_H_
+
+#include <string>
+#include <memory>
+#include <opencv2/opencv.hpp>
+
+class ImageHarmonyShmRing {
+public:
+    ImageHarmonyShmRing();
+    ~ImageHarmonyShmRing();
+
+    // 写端：创建共享内存并初始化槽位，slotBytes 为单帧像素的最大字节数
+    bool create(std::string name, int slotCount, size_t slotBytes);
+    // 读端：映射已存在的共享内存
+    bool open(std::string name);
+    void close();
+    bool isOpen() const;
+    int slotCount() const;
+
+    // 写端：写入一帧，槽位正被读端租用或帧过大时返回 false
+    bool write(int64_t imageId, const cv::Mat& image);
+    // 读端：租用 imageId 所在的槽位，imageOutput 直接引用共享内存
+    // 引用该内存的所有 Mat 释放后归还租约，期间写端不会覆盖该槽位
+    bool lease(int64_t imageId, cv::Mat& imageOutput);
+private:
+    struct Impl;
+    std::shared_ptr<Impl> pImpl;
+};
+
+#endif /* _IMAGE_HARMONY_SHM_H_ */
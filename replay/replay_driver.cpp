@@ -0,0 +1,187 @@
+#include "replay_driver.h"
+#include "rpc_log.h"
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/generic_stub.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct ReplayDriver::Impl {
+    std::atomic<bool> cancelled{false};
+    std::mutex cancelMutex;
+    std::condition_variable cancelCondition;
+
+    // 完成回调在轮询线程上汇总
+    std::mutex resultMutex;
+    ReplayDriver::Result result;
+    std::vector<double> latencies;
+
+    class Call;
+    static void poll(grpc::CompletionQueue* queue);
+    // 等到 due 或被取消，返回 false 表示已取消
+    bool waitUntil(std::chrono::steady_clock::time_point due) {
+        std::unique_lock<std::mutex> lock(cancelMutex);
+        return !cancelCondition.wait_until(lock, due, [this] { return cancelled.load(); });
+    }
+};
+
+// 一次重发的请求，完成后自行删除
+class ReplayDriver::Impl::Call {
+public:
+    Call(ReplayDriver::Impl* impl, const RpcLogRecord* record): impl(impl), record(record) {}
+
+    void start(grpc::GenericStub& stub, grpc::CompletionQueue* queue) {
+        // 日志在 run 返回前保持映射，请求直接引用
+        grpc::Slice slice(record->request.data(), record->request.size(), grpc::Slice::STATIC_SLICE);
+        grpc::ByteBuffer request(&slice, 1);
+        begin = std::chrono::steady_clock::now();
+        reader = stub.PrepareUnaryCall(&context, std::string(record->method), request, queue);
+        reader->StartCall();
+        reader->Finish(&responseBuffer, &status, this);
+    }
+
+    void complete() {
+        double latencyUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+        bool responseMatched = true;
+        if (status.ok() && grpc::StatusCode::OK == record->statusCode) {
+            std::vector<grpc::Slice> slices;
+            std::string response;
+            if (responseBuffer.Dump(&slices).ok()) {
+                for (const grpc::Slice& slice : slices) {
+                    response.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+                }
+            }
+            responseMatched = record->response == response;
+        }
+        std::lock_guard<std::mutex> lock(impl->resultMutex);
+        impl->latencies.push_back(latencyUs);
+        if (!status.ok()) {
+            impl->result.failures++;
+        }
+        if (static_cast<int32_t>(status.error_code()) != record->statusCode) {
+            impl->result.statusMismatches++;
+        }
+        if (!responseMatched) {
+            impl->result.responseMismatches++;
+        }
+    }
+private:
+    ReplayDriver::Impl* impl;
+    const RpcLogRecord* record;
+    grpc::ClientContext context;
+    std::unique_ptr<grpc::GenericClientAsyncResponseReader> reader;
+    grpc::ByteBuffer responseBuffer;
+    grpc::Status status;
+    std::chrono::steady_clock::time_point begin;
+};
+
+void ReplayDriver::Impl::poll(grpc::CompletionQueue* queue) {
+    void* tag = nullptr;
+    bool ok = false;
+    while (queue->Next(&tag, &ok)) {
+        Call* call = static_cast<Call*>(tag);
+        call->complete();
+        delete call;
+    }
+}
+
+ReplayDriver::ReplayDriver(): pImpl(new Impl()) {
+
+}
+
+ReplayDriver::~ReplayDriver() {
+
+}
+
+bool ReplayDriver::run(const std::string& logPath, ReplayDriver::Options options, ReplayDriver::Result& result) {
+    RpcLogReader reader;
+    if (!reader.open(logPath, options.useMmap)) {
+        return false;
+    }
+    std::vector<RpcLogRecord> records;
+    RpcLogRecord record;
+    while (reader.next(record)) {
+        // 对冲请求中被取消的一方不重发
+        if (grpc::StatusCode::CANCELLED == record.statusCode) {
+            continue;
+        }
+        records.push_back(record);
+    }
+    if (records.empty()) {
+        // TODO 以后改成日志
+        std::cout << "no records in " << logPath << std::endl;
+        return false;
+    }
+    // 日志按完成顺序写入，重发按发起顺序
+    std::stable_sort(records.begin(), records.end(), [](const RpcLogRecord& a, const RpcLogRecord& b) {
+        return a.startNs < b.startNs;
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(pImpl->resultMutex);
+        pImpl->result = ReplayDriver::Result();
+        pImpl->latencies.clear();
+        pImpl->latencies.reserve(records.size());
+    }
+    grpc::ChannelArguments args;
+    args.SetMaxReceiveMessageSize(-1);
+    args.SetMaxSendMessageSize(-1);
+    grpc::GenericStub stub(grpc::CreateCustomChannel(options.target, grpc::InsecureChannelCredentials(), args));
+    grpc::CompletionQueue queue;
+    std::vector<std::thread> pollers;
+    for (int i = 0; i < std::max(1, options.threads); ++i) {
+        pollers.emplace_back(&Impl::poll, &queue);
+    }
+
+    size_t issued = 0;
+    double maxLagUs = 0;
+    int64_t firstStartNs = records.front().startNs;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (const RpcLogRecord& next : records) {
+        if (pImpl->cancelled.load()) {
+            break;
+        }
+        if (options.speed > 0) {
+            std::chrono::steady_clock::time_point due =
+                begin + std::chrono::nanoseconds(static_cast<int64_t>((next.startNs - firstStartNs) / options.speed));
+            if (!pImpl->waitUntil(due)) {
+                break;
+            }
+            maxLagUs = std::max(maxLagUs, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - due).count());
+        }
+        (new Impl::Call(pImpl.get(), &next))->start(stub, &queue);
+        issued++;
+    }
+    // 已发起的请求完成后轮询线程退出
+    queue.Shutdown();
+    for (std::thread& poller : pollers) {
+        poller.join();
+    }
+
+    std::lock_guard<std::mutex> lock(pImpl->resultMutex);
+    result = pImpl->result;
+    result.calls = issued;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.maxLagUs = maxLagUs;
+    std::vector<double>& latencies = pImpl->latencies;
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        result.p50Us = latencies[static_cast<size_t>(0.5 * static_cast<double>(latencies.size() - 1))];
+        result.p99Us = latencies[static_cast<size_t>(0.99 * static_cast<double>(latencies.size() - 1))];
+    }
+    return true;
+}
+
+void ReplayDriver::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(pImpl->cancelMutex);
+        pImpl->cancelled.store(true);
+    }
+    pImpl->cancelCondition.notify_all();
+}
@@ -0,0 +1,56 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     replay_driver.h                                                 *
+*  @brief    按录制日志的发起时刻重新发起请求的客户端                        *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 以通用 stub 发送日志中的原始请求字节，不依赖生成的客户端代码。  *
+*            日志按完成顺序写入，先按 startNs 排序，再按与第一条记录的       *
+*            间隔除以 speed 在调度线程上依次发起，不等待前一个完成，         *
+*            完成由 CompletionQueue 轮询线程处理；speed 为 0 时连续发起。    *
+*            状态码、响应字节与录制不同的请求分别计数，                      *
+*            对冲中被取消的一方不重发。                                      *
+*****************************************************************************/
+
+#ifndef _REPLAY_DRIVER_H_
+#define _REPLAY_DRIVER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+class ReplayDriver {
+public:
+    struct Options {
+        std::string target = "127.0.0.1:50051";
+        double speed = 1.0;                         // 2 表示请求间隔减半，0 表示不等待
+        bool useMmap = true;
+        int threads = 2;                            // CompletionQueue 轮询线程数
+    };
+
+    struct Result {
+        size_t calls = 0;
+        size_t failures = 0;                        // 状态码不是 OK
+        size_t statusMismatches = 0;                // 状态码与录制不同
+        size_t responseMismatches = 0;              // 状态码都是 OK 但响应字节不同
+        double seconds = 0;
+        double p50Us = 0;
+        double p99Us = 0;
+        double maxLagUs = 0;                        // 实际发起时刻落后计划的最大值
+    };
+
+    ReplayDriver();
+    ~ReplayDriver();
+
+    // 阻塞到全部请求完成，cancel 后不再发起新的请求
+    bool run(const std::string& logPath, ReplayDriver::Options options, ReplayDriver::Result& result);
+    void cancel();
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _REPLAY_DRIVER_H_ */
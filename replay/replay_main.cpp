@@ -0,0 +1,102 @@
+#include "replay_driver.h"
+#include "replay_server.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+
+std::atomic<bool> interrupted{false};
+
+void onSignal(int) {
+    interrupted.store(true);
+}
+
+// 按录制的发起时刻向 target 重发日志中的请求
+int drive(const std::string& logPath, const ReplayDriver::Options& options) {
+    ReplayDriver driver;
+    ReplayDriver::Result result;
+    std::atomic<bool> finished{false};
+    bool ok = false;
+    std::thread runner([&] {
+        ok = driver.run(logPath, options, result);
+        finished.store(true);
+    });
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    while (!finished.load()) {
+        if (interrupted.load()) {
+            driver.cancel();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    runner.join();
+    if (!ok) {
+        return 1;
+    }
+    std::printf("replayed %zu calls to %s in %.3f s, speed %g\n"
+                "failures %zu, status mismatches %zu, response mismatches %zu\n"
+                "p50 %.1f us, p99 %.1f us, max issue lag %.1f us\n",
+                result.calls, options.target.c_str(), result.seconds, options.speed,
+                result.failures, result.statusMismatches, result.responseMismatches,
+                result.p50Us, result.p99Us, result.maxLagUs);
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string logPath;
+    std::string target;
+    ReplayServer::Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if ("--log" == arg && hasValue) logPath = argv[++i];
+        else if ("--address" == arg && hasValue) options.address = argv[++i];
+        else if ("--drive" == arg && hasValue) target = argv[++i];
+        else if ("--speed" == arg && hasValue) options.speed = std::atof(argv[++i]);
+        else if ("--threads" == arg && hasValue) options.threads = std::atoi(argv[++i]);
+        else if ("--no-mmap" == arg) options.useMmap = false;
+        else {
+            logPath.clear();
+            break;
+        }
+    }
+    if (logPath.empty()) {
+        std::cout << "usage: " << argv[0] << " --log PATH [--address IP:PORT] [--speed X] [--threads N] [--no-mmap]\n"
+                  << "       " << argv[0] << " --log PATH --drive IP:PORT [--speed X] [--threads N] [--no-mmap]\n"
+                  << "       --speed 1 replays recorded latency, 2 halves it, 0 responds immediately\n"
+                  << "       --drive re-issues the logged requests to IP:PORT at their recorded start offsets divided by --speed,\n"
+                  << "       0 issues them back to back" << std::endl;
+        return 1;
+    }
+    if (!target.empty()) {
+        ReplayDriver::Options driverOptions;
+        driverOptions.target = target;
+        driverOptions.speed = options.speed;
+        driverOptions.threads = options.threads;
+        driverOptions.useMmap = options.useMmap;
+        return drive(logPath, driverOptions);
+    }
+
+    ReplayServer server;
+    if (!server.start(logPath, options)) {
+        return 1;
+    }
+    std::cout << "replaying " << server.records() << " records on port " << server.port() << ", speed " << options.speed << "\n"
+              << server.summary() << std::flush;
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+    while (!interrupted.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    server.stop();
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include "replay_server.h"
+#include "rpc_log.h"
+#include <grpc++/grpc++.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/generic/async_generic_service.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// 一个方法的全部记录
+struct MethodTrack {
+    std::mutex mutex;
+    std::vector<size_t> order;
+    size_t next = 0;
+    // 请求字节相同的记录
+    struct Candidates {
+        std::vector<size_t> records;
+        size_t next = 0;
+    };
+    std::unordered_map<std::string_view, Candidates> byRequest;
+
+    size_t pick(std::string_view request) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = byRequest.find(request);
+        if (it != byRequest.end()) {
+            Candidates& candidates = it->second;
+            return candidates.records[candidates.next++ % candidates.records.size()];
+        }
+        return order[next++ % order.size()];
+    }
+};
+
+} // namespace
+
+struct ReplayServer::Impl {
+    ReplayServer::Options options;
+    RpcLogReader reader;
+    std::vector<RpcLogRecord> records;
+    std::unordered_map<std::string_view, std::unique_ptr<MethodTrack>> tracks;
+
+    grpc::AsyncGenericService service;
+    std::unique_ptr<grpc::Server> server;
+    std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> queues;
+    std::vector<std::thread> pollers;
+    int port = 0;
+    std::atomic<bool> stopping{false};
+
+    class Call;
+    bool load(const std::string& logPath);
+    const RpcLogRecord* match(const std::string& method, std::string_view request) {
+        auto it = tracks.find(method);
+        if (it == tracks.end()) {
+            return nullptr;
+        }
+        return &records[it->second->pick(request)];
+    }
+    static void poll(grpc::ServerCompletionQueue* queue);
+};
+
+// 一次请求的状态机，完成后自行删除
+class ReplayServer::Impl::Call {
+public:
+    Call(ReplayServer::Impl* impl, grpc::ServerCompletionQueue* queue): impl(impl), queue(queue), stream(&context) {
+        impl->service.RequestCall(&context, &stream, queue, queue, this);
+    }
+
+    void proceed(bool ok) {
+        switch (state) {
+        case State::REQUESTED:
+            if (!ok) {
+                // 服务端正在关闭
+                delete this;
+                return;
+            }
+            if (!impl->stopping.load()) {
+                new Call(impl, queue);
+            }
+            state = State::READ;
+            stream.Read(&requestBuffer, this);
+            return;
+        case State::READ:
+            if (!ok) {
+                state = State::FINISHED;
+                stream.Finish(grpc::Status(grpc::StatusCode::INTERNAL, "request not received"), this);
+                return;
+            }
+            onRequest();
+            return;
+        case State::DELAYED:
+            respond();
+            return;
+        case State::FINISHED:
+            delete this;
+            return;
+        }
+    }
+private:
+    enum class State {
+        REQUESTED,
+        READ,
+        DELAYED,
+        FINISHED,
+    };
+
+    void onRequest() {
+        std::vector<grpc::Slice> slices;
+        std::string request;
+        if (requestBuffer.Dump(&slices).ok()) {
+            for (const grpc::Slice& slice : slices) {
+                request.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+            }
+        }
+        record = impl->match(context.method(), request);
+        if (nullptr == record) {
+            state = State::FINISHED;
+            stream.Finish(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "method not recorded: " + context.method()), this);
+            return;
+        }
+        double speed = impl->options.speed;
+        if (speed > 0 && record->durationNs > 0) {
+            state = State::DELAYED;
+            std::chrono::nanoseconds delay(static_cast<int64_t>(record->durationNs / speed));
+            alarm.Set(queue, std::chrono::system_clock::now() + delay, this);
+            return;
+        }
+        respond();
+    }
+
+    void respond() {
+        state = State::FINISHED;
+        if (grpc::StatusCode::OK != record->statusCode) {
+            stream.Finish(grpc::Status(static_cast<grpc::StatusCode>(record->statusCode), "replayed status"), this);
+            return;
+        }
+        // 日志在服务端停止前保持映射，响应直接引用
+        grpc::Slice slice(record->response.data(), record->response.size(), grpc::Slice::STATIC_SLICE);
+        grpc::ByteBuffer response(&slice, 1);
+        stream.WriteAndFinish(response, grpc::WriteOptions(), grpc::Status::OK, this);
+    }
+
+    ReplayServer::Impl* impl;
+    grpc::ServerCompletionQueue* queue;
+    grpc::GenericServerContext context;
+    grpc::GenericServerAsyncReaderWriter stream;
+    grpc::ByteBuffer requestBuffer;
+    grpc::Alarm alarm;
+    const RpcLogRecord* record = nullptr;
+    State state = State::REQUESTED;
+};
+
+bool ReplayServer::Impl::load(const std::string& logPath) {
+    if (!reader.open(logPath, options.useMmap)) {
+        return false;
+    }
+    RpcLogRecord record;
+    while (reader.next(record)) {
+        // 对冲请求中被取消的一方不回放
+        if (grpc::StatusCode::CANCELLED == record.statusCode) {
+            continue;
+        }
+        records.push_back(record);
+    }
+    for (size_t i = 0; i < records.size(); ++i) {
+        std::unique_ptr<MethodTrack>& track = tracks[records[i].method];
+        if (nullptr == track) {
+            track.reset(new MethodTrack());
+        }
+        track->order.push_back(i);
+        track->byRequest[records[i].request].records.push_back(i);
+    }
+    return true;
+}
+
+void ReplayServer::Impl::poll(grpc::ServerCompletionQueue* queue) {
+    void* tag = nullptr;
+    bool ok = false;
+    while (queue->Next(&tag, &ok)) {
+        static_cast<Call*>(tag)->proceed(ok);
+    }
+}
+
+ReplayServer::ReplayServer(): pImpl(new Impl()) {
+
+}
+
+ReplayServer::~ReplayServer() {
+    stop();
+}
+
+bool ReplayServer::start(const std::string& logPath, ReplayServer::Options options) {
+    stop();
+    pImpl.reset(new Impl());
+    pImpl->options = options;
+    if (!pImpl->load(logPath)) {
+        return false;
+    }
+    if (pImpl->records.empty()) {
+        // TODO 以后改成日志
+        std::cout << "no records in " << logPath << std::endl;
+        return false;
+    }
+
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(options.address, grpc::InsecureServerCredentials(), &pImpl->port);
+    builder.SetMaxSendMessageSize(-1);
+    builder.SetMaxReceiveMessageSize(-1);
+    builder.RegisterAsyncGenericService(&pImpl->service);
+    int threads = std::max(1, options.threads);
+    for (int i = 0; i < threads; ++i) {
+        pImpl->queues.push_back(builder.AddCompletionQueue());
+    }
+    pImpl->server = builder.BuildAndStart();
+    if (nullptr == pImpl->server || 0 == pImpl->port) {
+        // TODO 以后改成日志
+        std::cout << "failed to start replay server on " << options.address << std::endl;
+        pImpl->server.reset();
+        for (auto& queue : pImpl->queues) {
+            queue->Shutdown();
+            Impl::poll(queue.get());
+        }
+        pImpl->queues.clear();
+        return false;
+    }
+    // 每个队列预先挂起多个等待中的请求，应对突发连接
+    for (auto& queue : pImpl->queues) {
+        for (int i = 0; i < 8; ++i) {
+            new Impl::Call(pImpl.get(), queue.get());
+        }
+        pImpl->pollers.emplace_back(&Impl::poll, queue.get());
+    }
+    return true;
+}
+
+void ReplayServer::stop() {
+    if (nullptr == pImpl->server) {
+        return;
+    }
+    pImpl->stopping.store(true);
+    pImpl->server->Shutdown();
+    for (auto& queue : pImpl->queues) {
+        queue->Shutdown();
+    }
+    for (std::thread& poller : pImpl->pollers) {
+        poller.join();
+    }
+    pImpl->pollers.clear();
+    pImpl->queues.clear();
+    pImpl->server.reset();
+}
+
+int ReplayServer::port() const {
+    return pImpl->port;
+}
+
+size_t ReplayServer::records() const {
+    return pImpl->records.size();
+}
+
+std::string ReplayServer::summary() const {
+    std::map<std::string_view, size_t> counts;
+    for (const auto& track : pImpl->tracks) {
+        counts[track.first] = track.second->order.size();
+    }
+    std::ostringstream output;
+    for (const auto& count : counts) {
+        output << count.first << " " << count.second << "\n";
+    }
+    return output.str();
+}
@@ -0,0 +1,47 @@
+/*****************************************************************************
+*  Copyright © 2023 - 2023 dzming.                                           *
+*                                                                            *
+*  @file     replay_server.h                                                 *
+*  @brief    按录制日志回放响应的 gRPC 服务端                                  *
+*  @author   dzming                                                          *
+*  @email    dzm_work@163.com                                                *
+*                                                                            *
+*----------------------------------------------------------------------------*
+*  Remark  : 以通用服务接收任意方法，不依赖生成的服务代码。                    *
+*            请求与某条记录的请求字节完全一致时按录制顺序轮流返回这些记录，     *
+*            否则按录制顺序轮流返回该方法的记录。                              *
+*            响应按录制延迟除以 speed 延后返回，延迟由 Alarm 实现，            *
+*            不占用轮询线程；响应直接引用日志内容，不拷贝。                    *
+*****************************************************************************/
+
+#ifndef _REPLAY_SERVER_H_
+#define _REPLAY_SERVER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+class ReplayServer {
+public:
+    struct Options {
+        std::string address = "0.0.0.0:50051";    // 端口为 0 时随机选择
+        double speed = 1.0;                         // 0 表示不等待，立即返回
+        bool useMmap = true;
+        int threads = 2;                            // CompletionQueue 轮询线程数
+    };
+
+    ReplayServer();
+    ~ReplayServer();
+
+    bool start(const std::string& logPath, ReplayServer::Options options);
+    void stop();
+    int port() const;
+    size_t records() const;
+    // 各方法的记录数
+    std::string summary() const;
+private:
+    struct Impl;
+    std::unique_ptr<Impl> pImpl;
+};
+
+#endif /* _REPLAY_SERVER_H_ */
@@ -1,150 +1,440 @@
 #include "target_detection_client.h"
 #include <grpc++/grpc++.h>
 #include <mutex>
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
 #include <opencv2/opencv.hpp>
 #include "target_detection.grpc.pb.h"
 #include "target_detection.pb.h"
+#include "grpc_client_base.h"
 
-struct TargetDetectionClient::Impl {
-    std::mutex stubMutex;
-    std::mutex labelsMutex;
-    targetDetection::Communicate::Stub* stub = nullptr;
-    int64_t taskId = 0;
-    std::vector<std::string> labels;
-    std::atomic<bool> shouldStop{false};
+template <>
+struct ServiceTraits<targetDetection::Communicate> {
+    static constexpr const char* NAME = "target_detection";
+    static constexpr bool ACCEPT_COMPRESSION = true;
 };
 
+namespace {
+
+using Stub = targetDetection::Communicate::Stub;
+
+struct GetMappingTable: RpcMethod<Stub, targetDetection::GetResultMappingTableRequest, targetDetection::GetResultMappingTableResponse, &Stub::getResultMappingTable, &Stub::PrepareAsyncgetResultMappingTable> {
+    static constexpr const char* NAME = "getMappingTable";
+};
+
+struct GetResultByImageId: RpcMethod<Stub, targetDetection::GetResultIndexByImageIdRequest, targetDetection::GetResultIndexByImageIdResponse, &Stub::getResultIndexByImageId, &Stub::PrepareAsyncgetResultIndexByImageId> {
+    static constexpr const char* NAME = "getResultByImageId";
+};
+
+struct LoadModel: RpcMethod<Stub, targetDetection::LoadModelRequest, targetDetection::LoadModelResponse, &Stub::loadModel, &Stub::PrepareAsyncloadModel> {
+    static constexpr const char* NAME = "loadModel";
+    static constexpr bool IDEMPOTENT = false;
+};
+
+} // namespace
+
+struct TargetDetectionClient::Impl: GrpcClientBase<targetDetection::Communicate> {
+    std::atomic<int64_t> taskId{0};     // setTaskId 与后台线程并发读写
+    // 映射表只整体替换不修改，读写均通过 atomic_load/atomic_store，解析结果时不加锁
+    // 已发出的 ResultColumns 仍持有旧表
+    std::shared_ptr<const std::vector<std::string>> labels = std::make_shared<const std::vector<std::string>>();
+    std::atomic<uint64_t> labelsVersion{0};
+
+    // 后台刷新映射表，按间隔或在任务切换、出现未知 labelId 时触发
+    std::mutex refreshMutex;
+    std::condition_variable refreshCv;
+    std::thread labelsRefresher;
+    bool refreshRequested = false;
+    int refreshIntervalMs = 0;
+
+    std::shared_ptr<const std::vector<std::string>> loadLabels() const {
+        return std::atomic_load(&labels);
+    }
+
+    void requestLabelsRefresh() {
+        {
+            std::lock_guard<std::mutex> lock(refreshMutex);
+            refreshRequested = true;
+        }
+        refreshCv.notify_one();
+    }
+
+    void runLabelsRefresher(TargetDetectionClient* client);
+    std::atomic<size_t> batchChunkSize{64};
+
+    bool parseMappingTable(const targetDetection::GetResultMappingTableResponse& getResultMappingTableResponse) {
+        int labelsCnt = getResultMappingTableResponse.labels_size();
+        std::shared_ptr<std::vector<std::string>> table = std::make_shared<std::vector<std::string>>(labelsCnt);
+        for (int i = 0; i < labelsCnt; ++i) {
+            (*table)[i] = getResultMappingTableResponse.labels(i);
+        }
+        // 内容未变时保留旧表，避免无谓地使读者持有的快照失效
+        if (*loadLabels() != *table) {
+            std::atomic_store(&labels, std::shared_ptr<const std::vector<std::string>>(table));
+            ++labelsVersion;
+        }
+        return true;
+    }
+
+    bool parseResults(const targetDetection::GetResultIndexByImageIdResponse& getResultIndexByImageIdResponse, std::vector<TargetDetectionClient::Result>& results) {
+        std::shared_ptr<const std::vector<std::string>> table = loadLabels();
+        int resultsCnt = getResultIndexByImageIdResponse.results_size();
+        results.resize(resultsCnt);
+        for (int i = 0; i < resultsCnt; ++i) {
+            const targetDetection::Result& result = getResultIndexByImageIdResponse.results(i);
+            int c = result.labelid();
+            if (c >= static_cast<int>(table->size())) {
+                std::cout << "Invalid label ID: " << c << std::endl;
+                results[i].label = std::to_string(c);
+                // 服务端可能已更换模型
+                requestLabelsRefresh();
+            }
+            else {
+                results[i].label = (*table)[c];
+            }
+            results[i].confidence = result.confidence();
+            results[i].x1 = result.x1();
+            results[i].y1 = result.y1();
+            results[i].x2 = result.x2();
+            results[i].y2 = result.y2();
+        }
+        return true;
+    }
+
+    bool parseResults(const targetDetection::GetResultIndexByImageIdResponse& getResultIndexByImageIdResponse, TargetDetectionClient::ResultColumns& columns) {
+        columns.clear();
+        columns.labels = loadLabels();
+        for (const targetDetection::Result& result : getResultIndexByImageIdResponse.results()) {
+            if (result.labelid() >= static_cast<int32_t>(columns.labels->size())) {
+                requestLabelsRefresh();
+            }
+            columns.x1.push_back(static_cast<float>(result.x1()));
+            columns.y1.push_back(static_cast<float>(result.y1()));
+            columns.x2.push_back(static_cast<float>(result.x2()));
+            columns.y2.push_back(static_cast<float>(result.y2()));
+            columns.confidence.push_back(static_cast<float>(result.confidence()));
+            columns.labelId.push_back(result.labelid());
+        }
+        return true;
+    }
+};
+
+void TargetDetectionClient::ResultColumns::clear() {
+    x1.clear();
+    y1.clear();
+    x2.clear();
+    y2.clear();
+    confidence.clear();
+    labelId.clear();
+}
+
+std::string_view TargetDetectionClient::ResultColumns::label(size_t i) const {
+    int32_t c = labelId[i];
+    if (!labels || c < 0 || c >= static_cast<int32_t>(labels->size())) {
+        return std::string_view();
+    }
+    return (*labels)[c];
+}
+
+void TargetDetectionClient::Impl::runLabelsRefresher(TargetDetectionClient* client) {
+    std::unique_lock<std::mutex> lock(refreshMutex);
+    while (!shouldStop.load()) {
+        if (refreshIntervalMs > 0) {
+            refreshCv.wait_for(lock, std::chrono::milliseconds(refreshIntervalMs), [this]() { return refreshRequested || shouldStop.load(); });
+        } else {
+            refreshCv.wait(lock, [this]() { return refreshRequested || shouldStop.load(); });
+        }
+        if (shouldStop.load()) {
+            break;
+        }
+        refreshRequested = false;
+        // 请求期间不持有锁，避免阻塞触发刷新的调用方
+        lock.unlock();
+        client->getMappingTable();
+        lock.lock();
+    }
+}
+
 TargetDetectionClient::TargetDetectionClient(): pImpl(new Impl()) {
 
 }
 
 TargetDetectionClient::~TargetDetectionClient() {
-    pImpl->shouldStop.store(true);
-    std::lock(pImpl->stubMutex, pImpl->labelsMutex); // 同时锁定两个互斥锁
-    std::lock_guard<std::mutex> lk1(pImpl->stubMutex, std::adopt_lock);
-    std::lock_guard<std::mutex> lk2(pImpl->labelsMutex, std::adopt_lock);
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
+    pImpl->stop();
+    {
+        // 持锁通知，避免刷新线程在检查条件与进入等待之间错过唤醒
+        std::lock_guard<std::mutex> lock(pImpl->refreshMutex);
+    }
+    pImpl->refreshCv.notify_all();
+    if (pImpl->labelsRefresher.joinable()) {
+        pImpl->labelsRefresher.join();
     }
 }
 
 bool TargetDetectionClient::setAddress(std::string ip, int port) {
+    return pImpl->connect(ip, port);
+}
+
+bool TargetDetectionClient::setAddresses(std::vector<std::string> addresses, int channelsPerAddress, bool leastOutstanding) {
+    return pImpl->connect(addresses, channelsPerAddress, leastOutstanding);
+}
+
+bool TargetDetectionClient::setTaskId(int64_t taskId) {
     if (pImpl->shouldStop.load()) return false;
-    // TODO 重置时未考虑线程安全
-    std::shared_ptr<grpc::ChannelInterface> channel = grpc::CreateChannel(ip + ":" + std::to_string(port), grpc::InsecureChannelCredentials());
-    std::unique_ptr<targetDetection::Communicate::Stub> stubTmp = targetDetection::Communicate::NewStub(channel);
-    // 重置
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
-    }
-    // unique_ptr 转为 普通指针
-    pImpl->stub = stubTmp.get();
-    stubTmp.release();
+    if (pImpl->taskId.exchange(taskId) != taskId) {
+        pImpl->requestLabelsRefresh();
+    }
     return true;
 }
 
-bool TargetDetectionClient::setTaskId(int64_t taskId) {
+bool TargetDetectionClient::setMappingTableRefresh(int intervalMs) {
     if (pImpl->shouldStop.load()) return false;
-    pImpl->taskId = taskId;
+    std::lock_guard<std::mutex> lock(pImpl->refreshMutex);
+    pImpl->refreshIntervalMs = std::max(0, intervalMs);
+    if (!pImpl->labelsRefresher.joinable()) {
+        pImpl->labelsRefresher = std::thread(&Impl::runLabelsRefresher, pImpl.get(), this);
+    }
+    pImpl->refreshCv.notify_one();
     return true;
 }
 
+bool TargetDetectionClient::setCallPolicy(CallPolicy policy) {
+    return pImpl->setCallPolicy(std::move(policy));
+}
+
+bool TargetDetectionClient::getPayloadCounters(std::vector<PayloadCounters>& counters) {
+    return pImpl->getPayloadCounters(counters);
+}
+
+uint64_t TargetDetectionClient::getMappingTableVersion() {
+    return pImpl->labelsVersion.load();
+}
+
 bool TargetDetectionClient::getMappingTable() {
     if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
+    static const int metric = Impl::metric("getMappingTable");
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    return pImpl->call<GetMappingTable>(metric,
+        [taskId](targetDetection::GetResultMappingTableRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [impl](const targetDetection::GetResultMappingTableResponse& response) {
+            return impl->parseMappingTable(response);
+        });
+}
+
+bool TargetDetectionClient::getResultByImageId(int64_t imageId, std::vector<TargetDetectionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return false;
+    if (pImpl->loadLabels()->empty()) {
+        std::cout << "labels is empty" << std::endl;
         return false;
     }
-    targetDetection::GetResultMappingTableRequest getResultMappingTableRequest;
-    targetDetection::GetResultMappingTableResponse getResultMappingTableResponse;
-    grpc::ClientContext context;
-
-    getResultMappingTableRequest.set_taskid(pImpl->taskId);
-    grpc::Status status = pImpl->stub->getResultMappingTable(&context, getResultMappingTableRequest, &getResultMappingTableResponse);
-    targetDetection::CustomResponse response = getResultMappingTableResponse.response();
-    int32_t code = response.code();
-    if (200 != code) {
-        auto message = response.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
+    static const int metric = Impl::metric("getResultByImageId");
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    return pImpl->call<GetResultByImageId>(metric,
+        [taskId, imageId](targetDetection::GetResultIndexByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+        },
+        [impl, &results](const targetDetection::GetResultIndexByImageIdResponse& response) {
+            return impl->parseResults(response, results);
+        });
+}
+
+bool TargetDetectionClient::getResultByImageId(int64_t imageId, TargetDetectionClient::ResultColumns& columns) {
+    if (pImpl->shouldStop.load()) return false;
+    if (pImpl->loadLabels()->empty()) {
+        std::cout << "labels is empty" << std::endl;
         return false;
     }
-    int labelsCnt = getResultMappingTableResponse.labels_size();
-    pImpl->labels.resize(labelsCnt);
-    for (int i = 0; i < labelsCnt; ++i) {
-        pImpl->labels[i] = getResultMappingTableResponse.labels(i);
+    static const int metric = Impl::metric("getResultByImageIdColumns");
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    return pImpl->call<GetResultByImageId>(metric,
+        [taskId, imageId](targetDetection::GetResultIndexByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+        },
+        [impl, &columns](const targetDetection::GetResultIndexByImageIdResponse& response) {
+            return impl->parseResults(response, columns);
+        });
+}
+
+bool TargetDetectionClient::loadModel(int64_t taskId) {
+    if (pImpl->shouldStop.load()) return false;
+    static const int metric = Impl::metric("loadModel");
+    Impl* impl = pImpl.get();
+    return pImpl->call<LoadModel>(metric,
+        [taskId](targetDetection::LoadModelRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [impl](const targetDetection::LoadModelResponse&) {
+            impl->requestLabelsRefresh();
+            return true;
+        });
+}
+
+std::future<bool> TargetDetectionClient::getMappingTableAsync() {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    static const int metric = Impl::metric("getMappingTableAsync");
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    return pImpl->callAsync<GetMappingTable>(metric,
+        [taskId](targetDetection::GetResultMappingTableRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [impl](const targetDetection::GetResultMappingTableResponse& response) {
+            return impl->parseMappingTable(response);
+        });
+}
+
+std::future<bool> TargetDetectionClient::getResultByImageIdAsync(int64_t imageId, std::vector<TargetDetectionClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    return completionFuture([&](TargetDetectionClient::CompletionCallback callback) {
+        getResultByImageIdAsync(imageId, results, std::move(callback));
+    });
+}
+
+void TargetDetectionClient::getResultByImageIdAsync(int64_t imageId, std::vector<TargetDetectionClient::Result>& results, TargetDetectionClient::CompletionCallback callback) {
+    if (pImpl->loadLabels()->empty()) {
+        std::cout << "labels is empty" << std::endl;
+        callback(false);
+        return;
+    }
+    static const int metric = Impl::metric("getResultByImageIdAsync");
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    std::vector<TargetDetectionClient::Result>* output = &results;
+    pImpl->callAsync<GetResultByImageId>(metric,
+        [taskId, imageId](targetDetection::GetResultIndexByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+        },
+        [impl, output](const targetDetection::GetResultIndexByImageIdResponse& response) {
+            return impl->parseResults(response, *output);
+        },
+        std::move(callback));
+}
+
+std::future<bool> TargetDetectionClient::loadModelAsync(int64_t taskId) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    static const int metric = Impl::metric("loadModelAsync");
+    Impl* impl = pImpl.get();
+    return pImpl->callAsync<LoadModel>(metric,
+        [taskId](targetDetection::LoadModelRequest& request) {
+            request.set_taskid(taskId);
+        },
+        [impl](const targetDetection::LoadModelResponse&) {
+            impl->requestLabelsRefresh();
+            return true;
+        });
+}
+
+bool TargetDetectionClient::setBatchChunkSize(size_t chunkSize) {
+    if (pImpl->shouldStop.load()) return false;
+    if (0 == chunkSize) {
+        return false;
     }
+    pImpl->batchChunkSize.store(chunkSize);
     return true;
 }
 
-bool TargetDetectionClient::getResultByImageId(int64_t imageId, std::vector<TargetDetectionClient::Result>& results) {
+bool TargetDetectionClient::getResultsByImageIds(const int64_t* imageIds, size_t count, TargetDetectionClient::BatchResults& batchResults) {
+    batchResults.results.clear();
+    batchResults.offsets.assign(1, 0);
+    batchResults.ok.clear();
     if (pImpl->shouldStop.load()) return false;
-    std::lock_guard<std::mutex> lock(pImpl->labelsMutex);
-    if (nullptr == pImpl->stub) {
+    if (nullptr == pImpl->stub.load()) {
         return false;
     }
-    if (pImpl->labels.empty()) {
+    if (0 == count) {
+        return true;
+    }
+    if (pImpl->loadLabels()->empty()) {
         std::cout << "labels is empty" << std::endl;
+        batchResults.offsets.assign(count + 1, 0);
+        batchResults.ok.assign(count, false);
         return false;
     }
-    targetDetection::GetResultIndexByImageIdRequest getResultIndexByImageIdRequest;
-    targetDetection::GetResultIndexByImageIdResponse getResultIndexByImageIdResponse;
-    grpc::ClientContext context;
-
-    getResultIndexByImageIdRequest.set_taskid(pImpl->taskId);
-    getResultIndexByImageIdRequest.set_imageid(imageId);
-    getResultIndexByImageIdRequest.set_wait(true);
-    grpc::Status status = pImpl->stub->getResultIndexByImageId(&context, getResultIndexByImageIdRequest, &getResultIndexByImageIdResponse);
-    targetDetection::CustomResponse response = getResultIndexByImageIdResponse.response();
-    int32_t code = response.code();
-    if (200 != code) {
-        auto message = response.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
-        return false;
+    batchResults.offsets.reserve(count + 1);
+    batchResults.ok.reserve(count);
+    static const int metric = Impl::metric("getResultByImageIdAsync");
+    // 服务端没有批量接口，分块后以异步请求流水线发出，省去逐个等待的往返时间
+    // 各请求的结果缓冲按线程复用，整块以计数等待，不为每个请求创建 promise
+    size_t chunkSize = pImpl->batchChunkSize.load();
+    thread_local std::vector<std::vector<TargetDetectionClient::Result>> chunkResults;
+    thread_local std::vector<char> chunkOk;
+    if (chunkResults.size() < std::min(chunkSize, count)) {
+        chunkResults.resize(std::min(chunkSize, count));
+        chunkOk.resize(chunkResults.size());
     }
-    int resultsCnt = getResultIndexByImageIdResponse.results_size();
-    results.resize(resultsCnt);
-    for (int i = 0; i < resultsCnt; ++i) {
-        auto result = getResultIndexByImageIdResponse.results(i);
-        int c = result.labelid();
-        if (c >= pImpl->labels.size()) {
-            std::cout << "Invalid label ID: " << c << std::endl;
-            results[i].label = std::to_string(c);
+    struct Pending {
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t remaining = 0;
+    } pending;
+    Pending* waiting = &pending;
+    int64_t taskId = pImpl->taskId.load();
+    Impl* impl = pImpl.get();
+    bool allOk = true;
+    for (size_t begin = 0; begin < count; begin += chunkSize) {
+        size_t end = std::min(count, begin + chunkSize);
+        {
+            std::lock_guard<std::mutex> lock(pending.mutex);
+            pending.remaining = end - begin;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            std::vector<TargetDetectionClient::Result>* output = &chunkResults[i - begin];
+            char* succeeded = &chunkOk[i - begin];
+            auto complete = [waiting, succeeded](bool ok) {
+                *succeeded = ok;
+                std::lock_guard<std::mutex> lock(waiting->mutex);
+                if (0 == --waiting->remaining) {
+                    waiting->done.notify_all();
+                }
+            };
+            StubHolder<Stub>::Lease current = pImpl->leaseFor<GetResultByImageId>();
+            if (pImpl->shouldStop.load() || nullptr == current) {
+                complete(false);
+                continue;
+            }
+            targetDetection::GetResultIndexByImageIdRequest request;
+            request.set_taskid(taskId);
+            request.set_imageid(imageIds[i]);
+            request.set_wait(true);
+            pImpl->startCall<GetResultByImageId>(metric, std::move(current), request,
+                [impl, output](const targetDetection::GetResultIndexByImageIdResponse& response) {
+                    return impl->parseResults(response, *output);
+                },
+                complete);
+        }
+        {
+            std::unique_lock<std::mutex> lock(pending.mutex);
+            pending.done.wait(lock, [waiting]() { return 0 == waiting->remaining; });
         }
-        else {
-            results[i].label = pImpl->labels[c];
+        for (size_t i = begin; i < end; ++i) {
+            std::vector<TargetDetectionClient::Result>& results = chunkResults[i - begin];
+            bool ok = 0 != chunkOk[i - begin];
+            if (ok) {
+                batchResults.results.insert(batchResults.results.end(), results.begin(), results.end());
+            }
+            allOk = allOk && ok;
+            batchResults.ok.push_back(ok);
+            batchResults.offsets.push_back(batchResults.results.size());
+            results.clear();
         }
-        results[i].confidence = result.confidence();
-        results[i].x1 = result.x1();
-        results[i].y1 = result.y1();
-        results[i].x2 = result.x2();
-        results[i].y2 = result.y2();
     }
-    return true;
+    return allOk;
 }
 
-bool TargetDetectionClient::loadModel(int64_t taskId) {
-    if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
-        return false;
-    }
-    targetDetection::LoadModelRequest loadModelRequest;
-    targetDetection::LoadModelResponse loadModelResponse;
-    grpc::ClientContext context;
-
-    loadModelRequest.set_taskid(taskId);
-    grpc::Status status = pImpl->stub->loadModel(&context, loadModelRequest, &loadModelResponse);
-    targetDetection::CustomResponse response = loadModelResponse.response();
-    int32_t code = response.code();
-    if (200 != code) {
-        auto message = response.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
-        return false;
-    }
-    return true;
+bool TargetDetectionClient::getResultsByImageIds(const std::vector<int64_t>& imageIds, TargetDetectionClient::BatchResults& batchResults) {
+    return getResultsByImageIds(imageIds.data(), imageIds.size(), batchResults);
 }
 
 // bool TargetDetectionClient::checkModelState(int64_t taskId, targetDetection::ModelState& modelState) {
@@ -157,7 +447,7 @@ bool TargetDetectionClient::loadModel(int64_t taskId) {
 //     grpc::ClientContext context;
 
 //     checkModelStateRequest.set_taskid(taskId);
-//     grpc::Status status = pImpl->stub->checkModelState(&context, checkModelStateRequest, &checkModelStateResponse);
+//     grpc::Status status = stub->checkModelState(&context, checkModelStateRequest, &checkModelStateResponse);
 //     targetDetection::CustomResponse response = checkModelStateResponse.response();
 //     int32_t code = response.code();
 //     if (200 != code) {
@@ -16,6 +16,10 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <future>
+#include <functional>
+#include <string_view>
+#include "call_policy.h"
 
 class TargetDetectionClient {
 public:
@@ -29,12 +33,65 @@ public:
         double x2;
         double y2;
     };
+    // 多帧结果连续存放，第 i 帧的结果为 results[offsets[i], offsets[i + 1])
+    struct BatchResults {
+        std::vector<TargetDetectionClient::Result> results;
+        std::vector<size_t> offsets;
+        std::vector<bool> ok;           // 第 i 帧是否获取成功，失败时结果为空
+        size_t size() const { return ok.size(); }
+    };
+    // 按列存放的单帧结果，跨调用复用时稳态下不分配内存
+    // 标签名不逐框拷贝，通过 label(i) 从映射表快照中按需取得
+    struct ResultColumns {
+        std::vector<float> x1;
+        std::vector<float> y1;
+        std::vector<float> x2;
+        std::vector<float> y2;
+        std::vector<float> confidence;
+        std::vector<int32_t> labelId;
+        std::shared_ptr<const std::vector<std::string>> labels;
+        size_t size() const { return labelId.size(); }
+        // 清空内容，保留容量
+        void clear();
+        // labelId 不在映射表中时返回空串
+        std::string_view label(size_t i) const;
+    };
+    // 异步请求完成时在轮询线程中调用，未能发起时在调用线程中同步调用
+    using CompletionCallback = std::function<void(bool)>;
 
     bool setAddress(std::string ip, int port);
+    // 地址形如 ip:port，请求在全部地址的全部连接间按轮询或最少在途请求分摊
+    // 连接在同一进程的客户端实例间共享
+    bool setAddresses(std::vector<std::string> addresses, int channelsPerAddress = 1, bool leastOutstanding = false);
     bool setTaskId(int64_t taskId);
+    // 各方法的超时、重试与对冲策略，方法名为 getMappingTable、getResultByImageId、loadModel
+    // 异步版本沿用同名方法的超时，默认不限时、不重试；loadModel 不幂等，不对冲
+    // compression 让该方法声明接受压缩的响应，是否压缩由服务端决定
+    bool setCallPolicy(CallPolicy policy);
+    // 各方法成功响应的次数与序列化字节数；compressedCalls 为按策略走接受压缩的连接完成的次数
+    bool getPayloadCounters(std::vector<PayloadCounters>& counters);
     bool getMappingTable();
     bool getResultByImageId(int64_t imageId, std::vector<TargetDetectionClient::Result>& results);
+    bool getResultByImageId(int64_t imageId, TargetDetectionClient::ResultColumns& columns);
     bool loadModel(int64_t taskId);
+    // 启动后台刷新映射表，intervalMs 为 0 时只在切换任务、加载模型或出现未知 labelId 后刷新
+    // 映射表以不可变快照发布，取结果时不加锁
+    bool setMappingTableRefresh(int intervalMs);
+    // 映射表内容每变化一次加一
+    uint64_t getMappingTableVersion();
+
+    // 异步版本，由共享的 CompletionQueue 驱动，results 须在 future 就绪前保持有效
+    std::future<bool> getMappingTableAsync();
+    std::future<bool> getResultByImageIdAsync(int64_t imageId, std::vector<TargetDetectionClient::Result>& results);
+    // 回调版本，results 须在回调前保持有效
+    void getResultByImageIdAsync(int64_t imageId, std::vector<TargetDetectionClient::Result>& results, TargetDetectionClient::CompletionCallback callback);
+    std::future<bool> loadModelAsync(int64_t taskId);
+
+    // 批量获取多帧结果，按 chunkSize 分块，每块内的请求并发发出
+    // 全部成功时返回 true，单帧失败不影响其他帧
+    bool setBatchChunkSize(size_t chunkSize);
+    bool getResultsByImageIds(const int64_t* imageIds, size_t count, TargetDetectionClient::BatchResults& batchResults);
+    bool getResultsByImageIds(const std::vector<int64_t>& imageIds, TargetDetectionClient::BatchResults& batchResults);
 private:
     struct Impl;
     std::unique_ptr<Impl> pImpl;
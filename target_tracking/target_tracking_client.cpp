@@ -1,15 +1,101 @@
 #include "target_tracking_client.h"
 #include <grpc++/grpc++.h>
 #include <mutex>
+#include <deque>
+#include <unordered_map>
 #include <opencv2/opencv.hpp>
 #include "target_tracking.grpc.pb.h"
 #include "target_tracking.pb.h"
+#include "grpc_client_base.h"
 
-struct TargetTrackingClient::Impl {
-    std::mutex stubMutex;
-    targetTracking::Communicate::Stub* stub = nullptr;
-    int64_t taskId = 0;
-    std::atomic<bool> shouldStop{false};
+template <>
+struct ServiceTraits<targetTracking::Communicate> {
+    static constexpr const char* NAME = "target_tracking";
+    static constexpr bool ACCEPT_COMPRESSION = true;
+};
+
+namespace {
+
+using Stub = targetTracking::Communicate::Stub;
+
+struct GetResultByImageId: RpcMethod<Stub, targetTracking::GetResultByImageIdRequest, targetTracking::GetResultByImageIdResponse, &Stub::getResultByImageId, &Stub::PrepareAsyncgetResultByImageId> {
+    static constexpr const char* NAME = "getResultByImageId";
+};
+
+// 同一个 RPC，增量合并轨迹时单独配置策略
+struct UpdateTracks: GetResultByImageId {
+    static constexpr const char* NAME = "updateTracks";
+};
+
+} // namespace
+
+struct TargetTrackingClient::Impl: GrpcClientBase<targetTracking::Communicate> {
+    std::atomic<int64_t> taskId{0};     // setTaskId 与取结果的线程并发读写
+
+    // 客户端维护的轨迹，首帧取完整历史，之后只取每条轨迹的最新框追加
+    struct Track {
+        std::deque<TargetTrackingClient::BoundingBox> bboxs;
+        uint64_t lastUpdate = 0;
+    };
+    std::mutex tracksMutex;
+    std::unordered_map<int, Track> tracks;
+    int64_t lastTrackedImageId = 0;
+    uint64_t tracksGeneration = 0;  // setTaskId 清空轨迹时递增，在途请求据此丢弃切换前的响应
+    uint64_t trackUpdates = 0;
+    size_t maxBoxesPerTrack = 0;    // 0 表示不限制
+    uint64_t maxIdleUpdates = 0;    // 0 表示不移除消失的轨迹
+
+    // 调用方需持有 tracksMutex
+    void trimTracksLocked() {
+        for (auto it = tracks.begin(); it != tracks.end();) {
+            Track& track = it->second;
+            if (maxBoxesPerTrack > 0 && track.bboxs.size() > maxBoxesPerTrack) {
+                track.bboxs.erase(track.bboxs.begin(), track.bboxs.end() - maxBoxesPerTrack);
+            }
+            if (maxIdleUpdates > 0 && trackUpdates - track.lastUpdate > maxIdleUpdates) {
+                it = tracks.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // 调用方需持有 tracksMutex
+    void mergeTracksLocked(const targetTracking::GetResultByImageIdResponse& getResultByImageIdResponse, bool onlyTheLatest) {
+        ++trackUpdates;
+        for (const targetTracking::Result& result : getResultByImageIdResponse.results()) {
+            Track& track = tracks[result.id()];
+            if (!onlyTheLatest) {
+                track.bboxs.clear();
+            }
+            for (const auto& bbox : result.bboxs()) {
+                track.bboxs.push_back(TargetTrackingClient::BoundingBox{bbox.x1(), bbox.y1(), bbox.x2(), bbox.y2()});
+            }
+            track.lastUpdate = trackUpdates;
+        }
+        trimTracksLocked();
+    }
+
+    static bool parseResults(const targetTracking::GetResultByImageIdResponse& getResultByImageIdResponse, std::vector<TargetTrackingClient::Result>& results) {
+        int resultsCnt = getResultByImageIdResponse.results_size();
+        results.resize(resultsCnt);
+        for (int i = 0; i < resultsCnt; ++i) {
+            // 以引用访问，不拷贝消息
+            const targetTracking::Result& result = getResultByImageIdResponse.results(i);
+            int id = result.id();
+            results[i].id = id;
+            const auto& bboxs = result.bboxs();
+            int bboxsCnt = result.bboxs_size();
+            results[i].bboxs.resize(bboxsCnt);
+            for (int j = 0; j < bboxsCnt; ++j) {
+                results[i].bboxs[j].x1 = bboxs[j].x1();
+                results[i].bboxs[j].y1 = bboxs[j].y1();
+                results[i].bboxs[j].x2 = bboxs[j].x2();
+                results[i].bboxs[j].y2 = bboxs[j].y2();
+            }
+        }
+        return true;
+    }
 };
 
 TargetTrackingClient::TargetTrackingClient(): pImpl(new Impl()) {
@@ -17,73 +103,138 @@ TargetTrackingClient::TargetTrackingClient(): pImpl(new Impl()) {
 }
 
 TargetTrackingClient::~TargetTrackingClient() {
-    pImpl->shouldStop.store(true);
-    std::lock_guard<std::mutex> lock(pImpl->stubMutex);
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
-    }
+    pImpl->stop();
 }
 
 bool TargetTrackingClient::setAddress(std::string ip, int port) {
+    return pImpl->connect(ip, port);
+}
+
+bool TargetTrackingClient::setAddresses(std::vector<std::string> addresses, int channelsPerAddress, bool leastOutstanding) {
+    return pImpl->connect(addresses, channelsPerAddress, leastOutstanding);
+}
+
+bool TargetTrackingClient::setTaskId(int64_t taskId) {
     if (pImpl->shouldStop.load()) return false;
-    // TODO 重置时未考虑线程安全
-    std::shared_ptr<grpc::ChannelInterface> channel = grpc::CreateChannel(ip + ":" + std::to_string(port), grpc::InsecureChannelCredentials());
-    std::unique_ptr<targetTracking::Communicate::Stub> stubTmp = targetTracking::Communicate::NewStub(channel);
-    // 重置
-    if (pImpl->stub) {
-        delete pImpl->stub;
-        pImpl->stub = nullptr;
+    // 与 updateTracks 读取 taskId 和 tracksGeneration 在同一把锁下，二者保持一致
+    std::lock_guard<std::mutex> lock(pImpl->tracksMutex);
+    if (pImpl->taskId.load() != taskId) {
+        pImpl->tracks.clear();
+        pImpl->lastTrackedImageId = 0;
+        ++pImpl->tracksGeneration;
     }
-    // unique_ptr 转为 普通指针
-    pImpl->stub = stubTmp.get();
-    stubTmp.release();
+    pImpl->taskId.store(taskId);
     return true;
 }
 
-bool TargetTrackingClient::setTaskId(int64_t taskId) {
+bool TargetTrackingClient::setCallPolicy(CallPolicy policy) {
+    return pImpl->setCallPolicy(std::move(policy));
+}
+
+bool TargetTrackingClient::getPayloadCounters(std::vector<PayloadCounters>& counters) {
+    return pImpl->getPayloadCounters(counters);
+}
+
+bool TargetTrackingClient::getResultByImageId(int64_t imageId, std::vector<TargetTrackingClient::Result>& results) {
     if (pImpl->shouldStop.load()) return false;
-    pImpl->taskId = taskId;
+    static const int metric = Impl::metric("getResultByImageId");
+    int64_t taskId = pImpl->taskId.load();
+    // wait 为 true 时服务端等到结果才返回，由策略中的超时兜底
+    return pImpl->call<GetResultByImageId>(metric,
+        [taskId, imageId](targetTracking::GetResultByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+            request.set_onlythelatest(false);
+        },
+        [&results](const targetTracking::GetResultByImageIdResponse& response) {
+            return Impl::parseResults(response, results);
+        });
+}
+
+std::future<bool> TargetTrackingClient::getResultByImageIdAsync(int64_t imageId, std::vector<TargetTrackingClient::Result>& results) {
+    if (pImpl->shouldStop.load()) return makeReadyFuture(false);
+    return completionFuture([&](TargetTrackingClient::CompletionCallback callback) {
+        getResultByImageIdAsync(imageId, results, std::move(callback));
+    });
+}
+
+void TargetTrackingClient::getResultByImageIdAsync(int64_t imageId, std::vector<TargetTrackingClient::Result>& results, TargetTrackingClient::CompletionCallback callback) {
+    static const int metric = Impl::metric("getResultByImageIdAsync");
+    int64_t taskId = pImpl->taskId.load();
+    std::vector<TargetTrackingClient::Result>* output = &results;
+    pImpl->callAsync<GetResultByImageId>(metric,
+        [taskId, imageId](targetTracking::GetResultByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+            request.set_onlythelatest(false);
+        },
+        [output](const targetTracking::GetResultByImageIdResponse& response) {
+            return Impl::parseResults(response, *output);
+        },
+        std::move(callback));
+}
+
+bool TargetTrackingClient::setTrackHistoryLimit(size_t maxBoxesPerTrack, uint64_t maxIdleUpdates) {
+    if (pImpl->shouldStop.load()) return false;
+    std::lock_guard<std::mutex> lock(pImpl->tracksMutex);
+    pImpl->maxBoxesPerTrack = maxBoxesPerTrack;
+    pImpl->maxIdleUpdates = maxIdleUpdates;
+    pImpl->trimTracksLocked();
     return true;
 }
 
-bool TargetTrackingClient::getResultByImageId(int64_t imageId, std::vector<TargetTrackingClient::Result>& results) {
+bool TargetTrackingClient::updateTracks(int64_t imageId) {
     if (pImpl->shouldStop.load()) return false;
-    if (nullptr == pImpl->stub) {
-        return false;
-    }
-    targetTracking::GetResultByImageIdRequest getResultByImageIdRequest;
-    targetTracking::GetResultByImageIdResponse getResultByImageIdResponse;
-    grpc::ClientContext context;
-
-    getResultByImageIdRequest.set_taskid(pImpl->taskId);
-    getResultByImageIdRequest.set_imageid(imageId);
-    getResultByImageIdRequest.set_wait(true);
-    getResultByImageIdRequest.set_onlythelatest(false);
-    grpc::Status status = pImpl->stub->getResultByImageId(&context, getResultByImageIdRequest, &getResultByImageIdResponse);
-    targetTracking::CustomResponse response = getResultByImageIdResponse.response();
-    int32_t code = response.code();
-    if (200 != code) {
-        auto message = response.message();
-        // TODO 以后改成日志
-        std::cout << message << std::endl;
-        return false;
-    }
-    int resultsCnt = getResultByImageIdResponse.results_size();
-    results.resize(resultsCnt);
-    for (int i = 0; i < resultsCnt; ++i) {
-        auto result = getResultByImageIdResponse.results(i);
-        int id = result.id();
-        results[i].id = id;
-        auto bboxs = result.bboxs();
-        int bboxsCnt = result.bboxs_size();
-        results[i].bboxs.resize(bboxsCnt);
-        for (int j = 0; j < bboxsCnt; ++j) {
-            results[i].bboxs[j].x1 = bboxs[j].x1();
-            results[i].bboxs[j].y1 = bboxs[j].y1();
-            results[i].bboxs[j].x2 = bboxs[j].x2();
-            results[i].bboxs[j].y2 = bboxs[j].y2();
+    bool onlyTheLatest = false;
+    int64_t taskId = 0;
+    uint64_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(pImpl->tracksMutex);
+        if (0 != pImpl->lastTrackedImageId && imageId <= pImpl->lastTrackedImageId) {
+            // 该帧已合并过
+            return true;
         }
+        // 首帧取完整历史，之后每帧只取增量
+        onlyTheLatest = 0 != pImpl->lastTrackedImageId;
+        taskId = pImpl->taskId.load();
+        generation = pImpl->tracksGeneration;
+    }
+    static const int metric = Impl::metric("updateTracks");
+    Impl* impl = pImpl.get();
+    return pImpl->call<UpdateTracks>(metric,
+        [taskId, imageId, onlyTheLatest](targetTracking::GetResultByImageIdRequest& request) {
+            request.set_taskid(taskId);
+            request.set_imageid(imageId);
+            request.set_wait(true);
+            request.set_onlythelatest(onlyTheLatest);
+        },
+        [impl, imageId, onlyTheLatest, generation](const targetTracking::GetResultByImageIdResponse& response) {
+            // 请求期间不持有锁，getTracks 不会被网络延迟阻塞
+            std::lock_guard<std::mutex> lock(impl->tracksMutex);
+            if (generation != impl->tracksGeneration) {
+                // 请求期间切换了任务，旧任务的轨迹不能并入已清空的存储
+                return false;
+            }
+            if (0 != impl->lastTrackedImageId && imageId <= impl->lastTrackedImageId) {
+                return true;
+            }
+            impl->mergeTracksLocked(response, onlyTheLatest);
+            impl->lastTrackedImageId = imageId;
+            return true;
+        });
+}
+
+bool TargetTrackingClient::getTracks(std::vector<TargetTrackingClient::Result>& results) {
+    std::lock_guard<std::mutex> lock(pImpl->tracksMutex);
+    // 复用调用方已有的 bboxs 容量
+    results.resize(pImpl->tracks.size());
+    size_t i = 0;
+    for (const auto& track : pImpl->tracks) {
+        results[i].id = track.first;
+        results[i].bboxs.assign(track.second.bboxs.begin(), track.second.bboxs.end());
+        ++i;
     }
     return true;
 }
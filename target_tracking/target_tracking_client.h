@@ -16,6 +16,9 @@
 #include <string>
 #include <memory>
 #include <vector>
+#include <future>
+#include <functional>
+#include "call_policy.h"
 
 class TargetTrackingClient {
 public:
@@ -31,10 +34,33 @@ public:
         int id;
         std::vector<TargetTrackingClient::BoundingBox> bboxs;
     };
+    // 异步请求完成时在轮询线程中调用，未能发起时在调用线程中同步调用
+    using CompletionCallback = std::function<void(bool)>;
 
     bool setAddress(std::string ip, int port);
+    // 地址形如 ip:port，请求在全部地址的全部连接间按轮询或最少在途请求分摊
+    // 连接在同一进程的客户端实例间共享
+    bool setAddresses(std::vector<std::string> addresses, int channelsPerAddress = 1, bool leastOutstanding = false);
     bool setTaskId(int64_t taskId);
+    // 各方法的超时、重试与对冲策略，方法名为 getResultByImageId、updateTracks，默认不限时、不重试
+    // compression 让该方法声明接受压缩的响应，是否压缩由服务端决定
+    bool setCallPolicy(CallPolicy policy);
+    // 各方法成功响应的次数与序列化字节数；compressedCalls 为按策略走接受压缩的连接完成的次数
+    bool getPayloadCounters(std::vector<PayloadCounters>& counters);
     bool getResultByImageId(int64_t imageId, std::vector<TargetTrackingClient::Result>& results);
+
+    // 异步版本，由共享的 CompletionQueue 驱动，results 须在 future 就绪前保持有效
+    std::future<bool> getResultByImageIdAsync(int64_t imageId, std::vector<TargetTrackingClient::Result>& results);
+    // 回调版本，results 须在回调前保持有效
+    void getResultByImageIdAsync(int64_t imageId, std::vector<TargetTrackingClient::Result>& results, TargetTrackingClient::CompletionCallback callback);
+
+    // 客户端轨迹存储：首次取完整历史，之后按帧只取各轨迹的最新框并追加
+    // 须对每一帧按 imageId 递增调用 updateTracks，跳过的帧不会补取
+    // setTaskId 切换任务时清空存储，切换前发出的 updateTracks 丢弃响应并返回 false
+    bool updateTracks(int64_t imageId);
+    bool getTracks(std::vector<TargetTrackingClient::Result>& results);
+    // 每条轨迹最多保留的框数，连续多少次更新未出现即移除该轨迹，0 表示不限制
+    bool setTrackHistoryLimit(size_t maxBoxesPerTrack, uint64_t maxIdleUpdates);
 private:
     struct Impl;
     std::unique_ptr<Impl> pImpl;